@@ -14,7 +14,7 @@ void check_leaks(void) {
 #endif
 
 response_t* test_handler(request_t* request) {
-    response_t* r = response_from_string(STATUS_OK, "{\"response\":\"hello world!\"}");
+    response_t* r = response_from_static(STATUS_OK, "{\"response\":\"hello world!\"}");
     response_set_content_type(r, CONTENT_TYPE_JSON);
 
     return r;
@@ -22,11 +22,11 @@ response_t* test_handler(request_t* request) {
 
 response_t* dummy(request_t* request) {
     response_t* r = NULL;
-    if ( request->body->type == RQBT_STRING ) {
+    if ( request->body && request->body->type == RQBT_STRING ) {
         r = response_from_string(STATUS_OK, request->body->content.str);
         LOG("%s", request->body->content.str);
     } else {
-        r = response_from_string(STATUS_OK, "{\"response\":\"Data is too long to format\"}");
+        r = response_from_static(STATUS_OK, "{\"response\":\"Data is too long to format\"}");
     }
     
     response_set_content_type(r, CONTENT_TYPE_JSON);
@@ -35,19 +35,57 @@ response_t* dummy(request_t* request) {
 }
 
 response_t* favicon(request_t* request) {
-    response_t* r = response_from_file(STATUS_OK, fopen("./favicon.png", "r"));
+    response_t* r = response_from_cached_file(STATUS_OK, "./favicon.png");
+    if ( !r ) 
+        return response_resource_not_found(request);
+
     response_set_content_type(r, CONTENT_TYPE_PNG);
 
     return r;
 }
 
 response_t* handout(request_t* request) {
-    response_t* r = response_from_file(STATUS_OK, fopen("./handouts.pdf", "r"));
+    response_t* r = response_from_cached_file(STATUS_OK, "./handouts.pdf");
+    if ( !r ) 
+        return response_resource_not_found(request);
+
     response_set_content_type(r, CONTENT_TYPE_PDF);
 
     return r;
 }
 
+response_t* subscribe_events(request_t* request) {
+    return response_event_stream("updates");
+}
+
+response_t* publish_event(request_t* request) {
+    if ( !request->body || request->body->type != RQBT_STRING ) 
+        return response_bad_request(request);
+
+    size_t subscribers = sse_publish("updates", NULL, NULL, request->body->content.str);
+    char buf[64];
+    sprintf(buf, "{\"subscribers\":%zu}", subscribers);
+
+    response_t* r = response_from_string(STATUS_OK, buf);
+    response_set_content_type(r, CONTENT_TYPE_JSON);
+
+    return r;
+}
+
+void chat_on_open(websocket_t* ws, request_t* request) {
+    websocket_join(ws, "chat");
+}
+
+void chat_on_message(websocket_t* ws, websocket_opcode_t opcode, const char* data, size_t len) {
+    websocket_broadcast("chat", opcode, data, len);
+}
+
+static const websocket_handlers_t chat_handlers = {
+    .on_open = chat_on_open,
+    .on_message = chat_on_message,
+    .on_close = NULL
+};
+
 int main(int argc, char** argv) {
 #if defined(__APPLE__) && defined(DEBUG)
     atexit(check_leaks);
@@ -62,6 +100,10 @@ int main(int argc, char** argv) {
     server_register_route(HTTP_POST, "/v1/api/test", dummy);
     server_register_route(HTTP_GET, "/favicon.ico", favicon);
     server_register_route(HTTP_GET, "/handout.pdf", handout);
+    server_register_route(HTTP_GET, "/v1/events", subscribe_events);
+    server_register_route(HTTP_POST, "/v1/events", publish_event);
+    server_register_websocket("/v1/chat", &chat_handlers);
+    server_register_static_dir("/static", "./static");
     
     server_launch();
 
@@ -0,0 +1,20 @@
+#pragma once
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// The number of characters (without the NUL-terminator) needed to encode len bytes
+#define BASE64_ENCODED_LENGTH(len) (((len) + 2) / 3 * 4)
+
+// The number of bytes that decoding len base64 characters can produce
+#define BASE64_DECODED_LENGTH(len) (((len) + 3) / 4 * 3)
+
+// Encode len bytes as padded base64 with the standard alphabet into out, which
+// must hold BASE64_ENCODED_LENGTH(len) + 1 characters. Returns the length of
+// the NUL-terminated string.
+size_t base64_encode(const uint8_t* in, size_t len, char* out);
+
+// Decode len characters of base64 into out. Both the standard and the URL-safe
+// alphabets are accepted and the trailing padding is optional. Returns the 
+// number of decoded bytes, or -1 if in is not valid base64.
+ssize_t base64_decode(const char* in, size_t len, uint8_t* out);
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+
+// The most bytes that connections may grow their buffers by in total, counting
+// both the local buffers of connections and the socket buffers they enlarge
+// with setsockopt. Define it at build time to change it.
+#ifndef BUFFER_BUDGET_MAX_BYTES
+#define BUFFER_BUDGET_MAX_BYTES (256UL << 20UL)
+#endif
+
+// Once this much of the budget is in use, connections holding more than their
+// fair share give the excess back
+#define BUFFER_BUDGET_PRESSURE_BYTES (BUFFER_BUDGET_MAX_BYTES / 4 * 3)
+
+// Ask for requested more bytes of buffer growth on behalf of a connection that
+// already holds *held bytes. No connection is granted more than its fair
+// share while others hold some, and nothing is granted past the budget.
+// Returns how many bytes were granted, which are added to *held.
+size_t buffer_budget_grow(size_t* held, size_t requested);
+
+// Give back bytes of the *held bytes a connection holds.
+void buffer_budget_shrink(size_t* held, size_t bytes);
+
+// The bytes of growth each connection holding some is entitled to.
+size_t buffer_budget_fair_share(void);
+
+// Check if enough of the budget is in use that it should be reclaimed.
+int buffer_budget_under_pressure(void);
+
+// The bytes of the budget in use right now.
+size_t buffer_budget_used(void);
+
+// The number of connections holding part of the budget right now.
+size_t buffer_budget_holders(void);
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+#include "response.h"
+
+// Bodies smaller than this are sent as they are since compressing them saves
+// less than it costs
+#define COMPRESSION_MIN_SIZE 1024
+
+// Bodies larger than this are sent as they are
+#define COMPRESSION_MAX_SIZE (8UL << 20UL)
+
+// The most bytes the compressed-response cache keeps at once, counting every
+// entry as its compressed bytes plus COMPRESSION_CACHE_ENTRY_COST
+#define COMPRESSION_CACHE_MAX_BYTES (16UL << 20UL)
+
+// What an entry costs on top of its compressed bytes. Entries that remember a
+// body did not get any smaller cost only this.
+#define COMPRESSION_CACHE_ENTRY_COST 256
+
+// The most entries the compressed-response cache keeps at once
+#define COMPRESSION_CACHE_MAX_ENTRIES 4096
+
+// The zlib compression level, from 1 (fastest) to 9 (smallest)
+#define COMPRESSION_LEVEL 6
+
+#ifndef __DISABLE_COMPRESSION__
+// Choose between gzip and deflate for the body of a response from 
+// accept_encoding (the client's Accept-Encoding header, or NULL) without 
+// compressing anything yet. Small bodies, bodies that already have a 
+// Content-Encoding and types that are already compressed, such as 
+// CONTENT_TYPE_PNG, are left alone. When a coding is chosen the ETag names it
+// too, so that conditional requests can be answered before the body is
+// compressed. Returns the name of the coding, or NULL if there is none.
+const char* response_negotiate_coding(response_t* response, const char* accept_encoding);
+
+// Compress the body of a response with the coding response_negotiate_coding
+// chose. Does nothing if the response no longer has a body to compress, e.g.
+// because it became a 304. Compressed copies of file bodies, static bodies and
+// shared bodies with a strong ETag are kept in an LRU cache so that each one
+// is only compressed once.
+void response_try_compress(response_t* response, const char* coding);
+
+// Drop every cached compressed body.
+void compression_cache_clear(void);
+#endif
\ No newline at end of file
@@ -8,6 +8,9 @@
 #define REQUEST_BODY_LENGTH_PARSED 0x01
 #define RESPONSE_BODY_LENGTH_PARSED 0x02
 #define MULTI_CYCLE_RESPONSE_DELIVERY 0x04
+#define SPLICE_REQUEST_BODY 0x08
+#define EDGE_TRIGGERED 0x10
+#define ZEROCOPY 0x20
 
 #define SET_REQUEST_BODY_LENGTH_PARSED(connection) \
     do { connection->flags |= REQUEST_BODY_LENGTH_PARSED; } while (0)
@@ -15,6 +18,12 @@
     do { connection->flags |= RESPONSE_BODY_LENGTH_PARSED; } while (0)
 #define SET_MULTI_CYCLE_RESPONSE_DELIVERY(connection) \
     do { connection->flags |= MULTI_CYCLE_RESPONSE_DELIVERY; } while (0)
+#define SET_SPLICE_REQUEST_BODY(connection) \
+    do { connection->flags |= SPLICE_REQUEST_BODY; } while (0)
+#define SET_EDGE_TRIGGERED(connection) \
+    do { connection->flags |= EDGE_TRIGGERED; } while (0)
+#define SET_ZEROCOPY(connection) \
+    do { connection->flags |= ZEROCOPY; } while (0)
 
 #define WAS_REQUEST_BODY_LENGTH_PARSED(connection) \
     (connection->flags & REQUEST_BODY_LENGTH_PARSED)
@@ -22,6 +31,26 @@
     (connection->flags & RESPONSE_BODY_LENGTH_PARSED)
 #define IS_MULTI_CYCLE_RESPONSE_DELIVERY(connection) \
     (connection->flags & MULTI_CYCLE_RESPONSE_DELIVERY)
+#define IS_SPLICE_REQUEST_BODY(connection) \
+    (connection->flags & SPLICE_REQUEST_BODY)
+#define IS_EDGE_TRIGGERED(connection) \
+    (connection->flags & EDGE_TRIGGERED)
+#define IS_ZEROCOPY(connection) \
+    (connection->flags & ZEROCOPY)
+
+// Sending large in-memory bodies with MSG_ZEROCOPY is opt-in (build with 
+// -D__ENABLE_ZEROCOPY__) and only available on Linux.
+#if defined(__ENABLE_ZEROCOPY__) && defined(ZEROCOPY_SUPPORTED)
+#define ZEROCOPY_ENABLED
+
+// Below this size pinning the pages and reaping the notification costs more
+// than copying the body into the socket buffer.
+#define ZEROCOPY_MIN_SIZE (1UL << 14UL)
+#endif
+
+typedef struct _http2_session http2_session_t;
+typedef struct _websocket websocket_t;
+typedef struct _sse_subscriber sse_subscriber_t;
 
 typedef struct _connection_initializer {
     char* client_address;
@@ -38,24 +67,38 @@ typedef enum _connection_state {
     CS_HEADERS_PARSED,
     CS_REQUEST_RECEIVED,
     CS_WRITING_RESPONSE_HEADER,
-    CS_WRITING_RESPONSE_BODY
+    CS_WRITING_RESPONSE_BODY,
+    CS_HTTP2,        // the connection now carries HTTP/2 frames, see http2.h
+    CS_WEBSOCKET,    // the connection now carries WebSocket frames, see websocket.h
+    CS_EVENT_STREAM, // the response is an open-ended event stream, see sse.h
+    CS_AWAITING_ZEROCOPY // the response is sent but the kernel still reads from its body
 } connection_state;
 
 // This data structure keeps track of a connection to a client.
 typedef struct _connection {
     request_t* request;
     response_t* response;
+    http2_session_t* h2;
+    websocket_t* ws;
+    sse_subscriber_t* sse;
     char* client_address;
     char* buf;
     size_t buf_size;
+    size_t buf_budget;     // bytes of the buffer budget held, see buffer_budget.h
+    size_t snd_buf_growth; // how much of buf_budget went to the socket send buffer
     size_t body_bytes_to_transmit;
     size_t body_bytes_transmitted;
     size_t body_bytes_to_receive;
     size_t body_bytes_received;
     connection_state state;    
     int client_fd;
+    int splice_pipe[2];
     int buf_end;
     int buf_ptr;
+#ifdef ZEROCOPY_ENABLED
+    uint32_t zerocopy_sends;     // MSG_ZEROCOPY sends made from the response body
+    uint32_t zerocopy_completed; // how many of them the kernel is done with
+#endif
 #ifndef __SKIP_LOG_REQUESTS__
     struct timespec time_connected;
     struct timespec time_received;
@@ -72,8 +115,10 @@ void* connection_init(void* ptr);
 // Destroy all resources used to keep track of this connection instance.
 void connection_destroy(void* ptr);
 
-// Read bytes from a file descriptor and save to the connection buffer. 
-ssize_t connection_read(connection_t* conn, size_t event_data);
+// Read the bytes available on the socket into the connection buffer, up to 
+// the room left in it and the per-event budget. Returns the number of bytes
+// read, 0 if the client disconnected, or -1 if none were available.
+ssize_t connection_read(connection_t* conn);
 
 void connection_shift_buffer(connection_t* conn);
 
@@ -94,6 +139,20 @@ void connection_try_parse_headers(connection_t* conn);
 
 void connection_read_request_body(connection_t* conn);
 
+// Move request body bytes straight from the socket into the temporary file 
+// backing the request body without copying them through userspace. Only used
+// on Linux for bodies too large to buffer in memory. Returns the number of bytes
+// moved, -1 if none were available, or 0 if the connection should be closed.
+// If the file runs out of room the response becomes a 507 instead.
+ssize_t connection_splice_request_body(connection_t* conn);
+
 void connection_write_response_header(connection_t* connection);
 
-int connection_try_send_response_body(connection_t* conn, size_t max_receivable);
\ No newline at end of file
+int connection_try_send_response_body(connection_t* conn);
+
+#ifdef ZEROCOPY_ENABLED
+// Collect the kernel's notifications for MSG_ZEROCOPY sends. Returns the number
+// of sends the kernel may still read the response body for (it must not be 
+// freed until this is 0), or -1 if there was an error.
+int connection_reap_zerocopy(connection_t* conn);
+#endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include "outbox.h"
+#include "format.h"
+#include "lru.h"
+
+#include <sys/types.h>
+#include <time.h>
+
+// The most bytes of file contents the cache keeps in memory at once
+#define FILE_CACHE_MAX_BYTES (64UL << 20UL)
+
+// Files larger than this are not cached and are sent with sendfile instead
+#define FILE_CACHE_MAX_FILE_SIZE (8UL << 20UL)
+
+// A cached file is checked against the filesystem at most this often
+#define FILE_CACHE_REVALIDATE_MS 1000
+
+// This struct is a file held in memory by the static file cache along with the
+// header values that describe it. Entries are kept in an lru_list_t ordered
+// from most to least recently used.
+typedef struct _file_cache_entry {
+    lru_node_t node; // must come first
+    char* path;
+    refbuf_t* contents;
+    time_t mtime;
+    ino_t ino;
+    struct timespec validated; // CLOCK_MONOTONIC time the file was last checked
+    char last_modified[TIME_BUFFER_SIZE];
+    char etag[ETAG_BUFFER_SIZE];
+} file_cache_entry_t;
+
+// Look up the file at path, reading it into the cache on first use or when it
+// has changed on disk. Returns NULL if the file cannot be read or is too large
+// to cache. The entry may be evicted by the next call into the cache, so 
+// retain its contents to keep them.
+const file_cache_entry_t* file_cache_get(const char* path);
+
+// Drop every cached file. Responses still sending a file keep its contents.
+void file_cache_clear(void);
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 #include <time.h>
 
 // Constants used to print in color to the command line
@@ -26,6 +27,9 @@
 
 #define TIME_BUFFER_SIZE 30
 
+// Big enough for a quoted inode, mtime and size in hex, e.g. "4e21a-671318a2-8140a"
+#define ETAG_BUFFER_SIZE 64
+
 #ifdef DEBUG
 #define LOG(...)                                         \
     do {                                                 \
@@ -58,11 +62,30 @@ double timespec_difftime(const struct timespec* beg, const struct timespec* end)
 
 void format_time(char* buf, time_t time);
 
-// buf must be a buffer of at least 30 characters
+// buf must be a buffer of at least 30 characters. The time is copied from the
+// cache kept by refresh_cached_time instead of being formatted again.
 void format_current_time(char* buf);
 
+// Reformat the cached current time if the second has changed since the last
+// call. The reactor calls this once per wakeup so that every response and log
+// line in a batch shares the same preformatted bytes.
+void refresh_cached_time(void);
+
+// The second the cached time was last refreshed at
+time_t cached_time(void);
+
+// The cached current time formatted as an RFC 7231 IMF-fixdate, along with
+// its length. The string is only valid until the next refresh.
+const char* cached_time_str(size_t* len);
+
+// Parse an HTTP date such as "Sun, 06 Nov 1994 08:49:37 GMT". Returns -1 if 
+// the date is malformed.
 time_t parse_time_str(const char* time_buf);
 
+// Format a strong entity tag for a file from its inode, mtime and size. buf 
+// must be a buffer of at least ETAG_BUFFER_SIZE characters.
+void format_etag(char* buf, ino_t ino, time_t mtime, size_t size);
+
 #ifndef __SKIP_LOG_REQUESTS__
 void init_logging(void);
 
@@ -0,0 +1,60 @@
+#pragma once
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+#define HPACK_STATIC_TABLE_LENGTH 61
+
+// Every entry in the dynamic table is charged 32 bytes on top of its length
+#define HPACK_ENTRY_OVERHEAD 32
+
+// An upper bound on the bytes needed to encode one header with hpack_encode_*
+#define HPACK_MAX_ENCODED_LENGTH(name_len, value_len) \
+    (1 + 5 + (name_len) + 5 + (value_len))
+
+typedef struct _hpack_entry {
+    char* name;  // name and value share one allocation
+    char* value;
+    size_t name_len;
+    size_t value_len;
+} hpack_entry_t;
+
+// This struct is the dynamic table used by a decoder. Entries are stored in a
+// ring buffer with the most recently inserted entry at head.
+typedef struct _hpack_table {
+    hpack_entry_t* entries;
+    size_t capacity;         // number of slots in entries
+    size_t head;
+    size_t length;           // number of entries in the table
+    size_t size;             // size of the table as defined in RFC 7541 4.1
+    size_t max_size;         // the maximum size chosen by the encoder
+    size_t settings_max_size; // upper bound on max_size that we advertised
+} hpack_table_t;
+
+// This callback receives every header decoded from a header block. The name
+// and value are NUL-terminated but are only valid during the callback.
+typedef void (*hpack_header_callback_t)(
+    void* ctx, const char* name, size_t name_len,
+    const char* value, size_t value_len);
+
+void hpack_table_init(hpack_table_t* table, size_t max_size);
+
+void hpack_table_destroy(hpack_table_t* table);
+
+// Decode a complete header block, calling callback for each header in order.
+// Returns 0 on success or -1 on a decoding error (a COMPRESSION_ERROR).
+int hpack_decode(hpack_table_t* table, const uint8_t* block, size_t len,
+    hpack_header_callback_t callback, void* ctx);
+
+// Decode a Huffman-encoded string into out, which must be able to hold
+// (len * 8 / 5) + 1 bytes. Returns the decoded length or -1 on error.
+ssize_t hpack_huffman_decode(const uint8_t* in, size_t len, char* out);
+
+// Encode the :status pseudo-header into out. Returns the number of bytes used.
+size_t hpack_encode_status(uint8_t* out, int status);
+
+// Encode a header as a literal that is never added to the dynamic table,
+// lowercasing the name on the way. Returns the number of bytes used.
+size_t hpack_encode_header(uint8_t* out, const char* name, size_t name_len,
+    const char* value, size_t value_len);
\ No newline at end of file
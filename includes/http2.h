@@ -0,0 +1,124 @@
+#pragma once
+#include "connection.h"
+#include "hpack.h"
+
+#include <stdint.h>
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LENGTH 24UL
+
+#define HTTP2_FRAME_HEADER_LENGTH 9
+#define HTTP2_DEFAULT_WINDOW_SIZE 65535
+#define HTTP2_DEFAULT_MAX_FRAME_SIZE (1U << 14U)
+#define HTTP2_MAX_WINDOW_SIZE 0x7fffffff
+#define HTTP2_MAX_CONCURRENT_STREAMS 256
+
+// Frame types (RFC 7540 6)
+typedef enum _http2_frame_type {
+    H2F_DATA          = 0x0,
+    H2F_HEADERS       = 0x1,
+    H2F_PRIORITY      = 0x2,
+    H2F_RST_STREAM    = 0x3,
+    H2F_SETTINGS      = 0x4,
+    H2F_PUSH_PROMISE  = 0x5,
+    H2F_PING          = 0x6,
+    H2F_GOAWAY        = 0x7,
+    H2F_WINDOW_UPDATE = 0x8,
+    H2F_CONTINUATION  = 0x9
+} http2_frame_type_t;
+
+#define H2_FLAG_END_STREAM  0x01
+#define H2_FLAG_ACK         0x01
+#define H2_FLAG_END_HEADERS 0x04
+#define H2_FLAG_PADDED      0x08
+#define H2_FLAG_PRIORITY    0x20
+
+// Error codes sent in RST_STREAM and GOAWAY frames (RFC 7540 7)
+typedef enum _http2_error {
+    H2E_NO_ERROR            = 0x0,
+    H2E_PROTOCOL_ERROR      = 0x1,
+    H2E_INTERNAL_ERROR      = 0x2,
+    H2E_FLOW_CONTROL_ERROR  = 0x3,
+    H2E_STREAM_CLOSED       = 0x5,
+    H2E_FRAME_SIZE_ERROR    = 0x6,
+    H2E_REFUSED_STREAM      = 0x7,
+    H2E_COMPRESSION_ERROR   = 0x9
+} http2_error_t;
+
+// This enum indicates what a stream is waiting on. Streams are destroyed as
+// soon as they close, so there is no closed state.
+typedef enum _http2_stream_state {
+    H2SS_RECEIVING_BODY,  // open, the request body is still arriving
+    H2SS_SENDING_BODY     // half-closed (remote), the response body is queued
+} http2_stream_state_t;
+
+// This struct keeps track of a single request/response exchange multiplexed
+// onto an HTTP/2 connection.
+typedef struct _http2_stream {
+    struct _http2_stream* next;
+    request_t* request;
+    response_t* response;
+    size_t content_length;     // SIZE_MAX if the client did not send one
+    size_t body_bytes_received;
+    size_t body_bytes_to_transmit;
+    size_t body_bytes_transmitted;
+    int64_t send_window;       // bytes the peer lets us send on this stream
+    int64_t recv_window;       // bytes we let the peer send on this stream
+    uint32_t id;
+    http2_stream_state_t state;
+#ifndef __SKIP_LOG_REQUESTS__
+    struct timespec time_opened;
+    struct timespec time_received;
+    struct timespec time_begin_send;
+#endif
+} http2_stream_t;
+
+// This struct holds the state of an HTTP/2 connection: its frame buffers, the
+// HPACK decoder, connection-level flow control and every open stream.
+struct _http2_session {
+    connection_t* conn;
+    hpack_table_t decoder;
+    http2_stream_t* streams;   // a linked list of the open streams
+    size_t num_streams;
+    uint8_t* in_buf;
+    size_t in_len;
+    size_t in_size;
+    uint8_t* out_buf;
+    size_t out_ptr;            // bytes of out_buf already written to the socket
+    size_t out_len;
+    size_t out_size;
+    uint8_t* header_block;     // a header block split over CONTINUATION frames
+    size_t header_block_len;
+    uint32_t header_stream_id; // nonzero while a header block is incomplete
+    uint8_t header_flags;      // flags of the HEADERS frame that began it
+    uint32_t last_stream_id;
+    int64_t send_window;
+    int64_t recv_window;
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame_size;
+    int expect_preface;
+    int goaway;
+};
+
+// Construct a session for a connection that has switched to HTTP/2. The
+// client connection preface is expected to be the first thing fed to it. The
+// server's own preface (a SETTINGS frame) is queued immediately.
+http2_session_t* http2_session_create(connection_t* conn);
+
+// Destroy the session along with every stream that is still open.
+void http2_session_destroy(http2_session_t* session);
+
+// Hand the session bytes that were read off the socket before the connection
+// switched to HTTP/2.
+void http2_session_feed(http2_session_t* session, const char* buf, size_t len);
+
+// Read and process every frame available on the socket, then write as much
+// queued output as the socket accepts. The connection must be edge triggered.
+// Returns 0 if the connection should stay open, or -1 if it should be closed.
+int http2_session_on_event(http2_session_t* session);
+
+// If the request just received on an HTTP/1.1 connection asks to upgrade to
+// h2c, send 101 Switching Protocols and switch the connection to HTTP/2 with
+// the request as stream 1. Returns 1 if the connection was upgraded, 0 if it
+// should carry on with HTTP/1.
+int http2_try_upgrade(connection_t* conn);
\ No newline at end of file
@@ -1,5 +1,11 @@
 #pragma once
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <stdio.h>
+#include <stdint.h>
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
 
 #define MIN(x, y) (x < y ? x : y)
 #define MAX(x, y) (x > y ? x : y)
@@ -13,6 +19,15 @@
  */
 ssize_t read_all_from_socket(int socket, char *buffer, size_t count);
 
+/**
+ * Reads up to count bytes from a non-blocking socket into buffer, stopping
+ * early once the socket has no more bytes available.
+ *
+ * Returns the number of bytes read, 0 if socket is disconnected,
+ * or -1 on failure (errno is EAGAIN if no bytes were available).
+ */
+ssize_t read_available_from_socket(int socket, char *buffer, size_t count);
+
 /**
  * Attempts to write all count bytes from buffer to socket.
  * Assumes buffer contains at least count bytes.
@@ -34,6 +49,15 @@ ssize_t write_all_to_socket(int socket, const char *buffer, size_t count);
  */
 ssize_t buffered_read_from_socket(int socket_fd, FILE* out, size_t count);
 
+/**
+ * Attempts to write every buffer in iov to socket with as few sendmsg(2) 
+ * calls as possible. The iovecs are advanced past whatever was written.
+ *
+ * Returns the number of bytes written, which is short if the socket would
+ * block, or -1 on failure.
+ */
+ssize_t sendmsg_all_to_socket(int socket, struct iovec* iov, int iovcnt, int flags);
+
 /**
  * @brief Read bytes from the provided stream into a buffer and write those 
  * bytes to the specified socket in chunks of, at most, the size of the buffer. 
@@ -46,50 +70,85 @@ ssize_t buffered_read_from_socket(int socket_fd, FILE* out, size_t count);
  */
 ssize_t buffered_write_to_socket(int socket_fd, FILE* in, size_t count);
 
+#if defined(__linux__)
 /**
- * @brief Read bytes from a socket until a newline is reached.
+ * @brief Move bytes from a socket into a file without copying them through 
+ * userspace by splicing them through an intermediate pipe. Stops early once
+ * the socket has no more bytes available.
  * 
- * @param socket the socket to read from
- * @return char* the characters read from the socket (excluding the newline) 
- * allocated to a string on the heap.
+ * @param socket_fd the socket to read from
+ * @param pipe_fds a pipe used as the in-kernel buffer between the two fds
+ * @param out_fd the file to write to
+ * @param count the maximum number of bytes to move
+ * @return ssize_t the number of bytes moved, 0 if socket is disconnected,
+ * or -1 on failure (errno is EAGAIN if no bytes were available).
  */
-char* robust_getline(int socket);
+ssize_t splice_from_socket(int socket_fd, int pipe_fds[2], int out_fd, size_t count);
+#endif
 
-// Use the fcntl interface to make the specified socket non-blocking.
-void make_socket_non_blocking(int fd);
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define ZEROCOPY_SUPPORTED
+
+// Set SO_ZEROCOPY on a socket so MSG_ZEROCOPY sends are allowed. Returns 0 on
+// success or -1 if the kernel does not support it.
+int enable_socket_zerocopy(int fd);
 
 /**
- * @brief Check if a socket has bytes to read.
- * Calls ioctl(fd, FIONREAD, ...) internally.
+ * @brief Write bytes to a socket with MSG_ZEROCOPY, so the kernel transmits 
+ * straight from buffer instead of copying it. Stops early once the socket 
+ * would block. The buffer must not change or be freed until the kernel 
+ * reports every send complete, see reap_zerocopy_completions. If the kernel
+ * runs out of memory for notifications the rest is written normally.
  * 
- * @param fd the socket to check
- * @return the number of bytes available.
+ * @param socket_fd the socket to write to
+ * @param buffer the bytes to write
+ * @param count the number of bytes to write
+ * @param sends incremented once for every send(2) that will be reported 
+ * @return ssize_t the number of bytes written, or -1 on failure.
  */
-int num_bytes_in_rd_socket(int fd);
+ssize_t zerocopy_write_to_socket(int socket_fd, const char* buffer, size_t count, uint32_t* sends);
 
 /**
- * @brief Get the number of unsent bytes in the socket.
- * Internally calls ioctl(fd, TIOCOUTQ, ...) on Linux or 
- * getsockopt(fd, SOL_SOCKET, SO_NWRITE, &count, &m) on Apple.
+ * @brief Drain the completion notifications for MSG_ZEROCOPY sends from the
+ * error queue of a socket without blocking.
  * 
- * @param fd the socket to check
- * @return the number of bytes available.
+ * @param socket_fd the socket to check
+ * @return ssize_t the number of sends that completed, or -1 on failure.
  */
-int num_bytes_in_wr_socket(int fd);
+ssize_t reap_zerocopy_completions(int socket_fd);
+#endif
 
 /**
- * @brief Get the size of the internal socket send buffer. 
- * Calls getsockopt(fd, SOL_SOCKET, SO_SNDBUF, ...) internally
+ * @brief Send part of a file to a socket with sendfile(2), so the bytes never
+ * pass through userspace. Stops early once the socket would block.
  * 
- * @param fd the socket to check
- * @return the internal socket buffer size.
+ * @param socket_fd the socket to write to
+ * @param file_fd the file to read from
+ * @param offset the position in the file to start at (the file offset of 
+ * file_fd is not used or changed)
+ * @param count the maximum number of bytes to send
+ * @return ssize_t the number of bytes sent, 0 if the file ended, or -1 on 
+ * failure (errno is EAGAIN if no bytes could be sent).
+ */
+ssize_t sendfile_to_socket(int socket_fd, int file_fd, off_t offset, size_t count);
+
+/**
+ * @brief Read bytes from a socket until a newline is reached.
+ * 
+ * @param socket the socket to read from
+ * @return char* the characters read from the socket (excluding the newline) 
+ * allocated to a string on the heap.
  */
-int socket_snd_buf_size(int fd);
+char* robust_getline(int socket);
+
+// Use the fcntl interface to make the specified socket non-blocking.
+void make_socket_non_blocking(int fd);
 
 /**
- * @brief Get the number of bytes we can send to the socket.
+ * @brief Get the size of the internal socket send buffer. 
+ * Calls getsockopt(fd, SOL_SOCKET, SO_SNDBUF, ...) internally
  * 
  * @param fd the socket to check
- * @return the number of bytes we can send.
+ * @return the internal socket buffer size.
  */
-int free_bytes_in_wr_socket(int fd);
\ No newline at end of file
+int socket_snd_buf_size(int fd);
\ No newline at end of file
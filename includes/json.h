@@ -0,0 +1,53 @@
+#pragma once
+#include "response.h"
+#include <stdint.h>
+
+// Containers may not be nested deeper than this
+#define JSON_MAX_DEPTH 64
+
+// This struct writes JSON text straight into the buffer that becomes the body
+// of a response, so no tree of nodes is built and the text is never copied.
+// Commas and colons are inserted automatically; a value inside an object must
+// be preceded by json_key. Misuse, such as closing a container that is not
+// open, is a programming error and exits.
+typedef struct _json_writer {
+    char* buf;
+    size_t len;
+    size_t capacity;
+    uint64_t has_members; // bit n is set once the container at depth n has one
+    uint64_t is_object;   // bit n is set if the container at depth n is an object
+    int depth;
+    int after_key;
+} json_writer_t;
+
+// Construct a writer with an empty buffer.
+json_writer_t* json_writer_create(void);
+
+// Discard a writer and the JSON written so far.
+void json_writer_destroy(json_writer_t* writer);
+
+void json_begin_object(json_writer_t* writer);
+void json_end_object(json_writer_t* writer);
+void json_begin_array(json_writer_t* writer);
+void json_end_array(json_writer_t* writer);
+
+// Write the key of the next member of an object.
+void json_key(json_writer_t* writer, const char* key);
+
+// Write a NUL-terminated string, escaped as needed, or null if value is NULL.
+void json_string(json_writer_t* writer, const char* value);
+
+// Write len bytes of UTF-8 as an escaped string.
+void json_string_len(json_writer_t* writer, const char* value, size_t len);
+
+void json_int(json_writer_t* writer, long long value);
+
+// Write a number. NaN and infinities, which JSON cannot represent, become null.
+void json_double(json_writer_t* writer, double value);
+
+void json_bool(json_writer_t* writer, int value);
+void json_null(json_writer_t* writer);
+
+// Destroy the writer and hand its buffer to a new application/json response
+// with the Content-Length already set. Every container must be closed.
+response_t* json_finish(json_writer_t* writer, http_status status);
\ No newline at end of file
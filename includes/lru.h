@@ -0,0 +1,31 @@
+#pragma once
+#include <stdlib.h>
+
+// This struct links a cache entry into an lru_list_t. It is embedded as the
+// first member of the entry so that a node can be cast back to its entry.
+typedef struct _lru_node {
+    struct _lru_node* prev;
+    struct _lru_node* next;
+} lru_node_t;
+
+// This struct is a doubly linked list of cache entries ordered from most to
+// least recently used. The entries themselves are owned by the cache, which
+// usually also finds them through a dictionary keyed on the same entries.
+typedef struct _lru_list {
+    lru_node_t* most_recent;
+    lru_node_t* least_recent;
+} lru_list_t;
+
+// Take a node out of the list.
+void lru_unlink(lru_list_t* list, lru_node_t* node);
+
+// Make a node that is not in the list its most recently used entry.
+void lru_push_front(lru_list_t* list, lru_node_t* node);
+
+// Make a node that is already in the list its most recently used entry.
+void lru_touch(lru_list_t* list, lru_node_t* node);
+
+// Dictionary value callbacks for dictionaries that only point at entries owned
+// by an lru_list_t.
+void* lru_shallow_copy(void* ptr);
+void lru_shallow_destroy(void* ptr);
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+#include "route.h"
+
+#include <time.h>
+
+// The most bytes the microcache keeps in memory at once, counting every entry
+// as its body, key and headers plus MICROCACHE_ENTRY_COST
+#define MICROCACHE_MAX_BYTES (32UL << 20UL)
+
+// What an entry costs on top of its body, key and headers
+#define MICROCACHE_ENTRY_COST 256
+
+// The most responses the microcache keeps at once
+#define MICROCACHE_MAX_ENTRIES 4096
+
+// Responses with larger bodies are never cached
+#define MICROCACHE_MAX_BODY_SIZE (1UL << 20UL)
+
+// Requests whose cache key would be longer than this are not cached
+#define MICROCACHE_MAX_KEY_SIZE 1024
+
+// This struct is how a route opts in to having the responses of its handler
+// cached for a short time. Requests share a cached response if they have the
+// same method and path and agree on every query parameter and header named
+// here. route.h declares the microcache_policy_t typedef.
+struct _microcache_policy {
+    unsigned int ttl_ms;        // how long a response is reused for
+    const char** params;        // NULL-terminated query parameter names, or NULL
+    const char** headers;       // NULL-terminated request header names, or NULL
+};
+
+#ifndef __DISABLE_MICROCACHE__
+// Copy a policy, including its lists of names.
+microcache_policy_t* microcache_policy_copy(const microcache_policy_t* policy);
+
+// Destroy a policy made by microcache_policy_copy.
+void microcache_policy_destroy(microcache_policy_t* policy);
+
+// Route a request and answer it. A GET or HEAD request to a route registered
+// with register_cached_route is answered from the cache if there is a fresh
+// response for it, or else its handler is called and what it returns is 
+// remembered. Handlers of other routes are simply called. Only 200 responses
+// with in-memory bodies are cached, and never ones marked Cache-Control: 
+// no-store or private.
+response_t* microcache_serve(request_t* request);
+
+// Drop every cached response.
+void microcache_clear(void);
+#endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#include "dictionary.h"
+#include "request.h"
+
+#include <stdio.h>
+
+// RFC 2046 limits boundaries to 70 characters
+#define MULTIPART_MAX_BOUNDARY_LENGTH 70
+#define MULTIPART_MAX_HEADER_SIZE (1UL << 13UL)
+
+// Parts larger than this are spilled from memory into their own tmpfile
+#define MULTIPART_MAX_IN_MEMORY_PART (1UL << 16UL)
+
+// This enum indicates what the parser expects to see next in the body.
+typedef enum _multipart_state {
+    MPS_PREAMBLE,
+    MPS_BOUNDARY_TAIL,
+    MPS_HEADERS,
+    MPS_PART_BODY,
+    MPS_EPILOGUE,
+    MPS_ERROR
+} multipart_state_t;
+
+// This struct keeps track of a multipart/form-data body as it is streamed in.
+// Every finished part is saved in the form dictionary under its field name.
+struct _multipart_parser {
+    dictionary* form;          // a dictionary of (char*) -> (request_body_t*)
+    request_body_t* part;      // the part currently being received
+    char* part_name;
+    size_t part_capacity;      // bytes allocated for an in-memory part
+    size_t skip[256];          // Boyer-Moore-Horspool bad character table
+    char delimiter[MULTIPART_MAX_BOUNDARY_LENGTH + 4]; // CRLF "--" boundary, unterminated
+    size_t delimiter_len;
+    char carry[2 * (MULTIPART_MAX_BOUNDARY_LENGTH + 4)];
+    size_t carry_len;          // bytes of the last chunk that may begin a delimiter
+    char headers[MULTIPART_MAX_HEADER_SIZE];
+    size_t headers_len;
+    char tail;                 // first character seen after a delimiter
+    multipart_state_t state;
+};
+
+// Extract the boundary parameter from a multipart/form-data Content-Type
+// header value. Returns a heap-allocated string, or NULL if the content type is
+// not multipart/form-data or the boundary is missing or invalid.
+char* multipart_parse_boundary(const char* content_type);
+
+// Construct a parser that saves the parts it finds into form. The boundary
+// must be 1 to MULTIPART_MAX_BOUNDARY_LENGTH characters long.
+multipart_parser_t* multipart_parser_create(const char* boundary, dictionary* form);
+
+// Destroy the parser along with any partially received part.
+void multipart_parser_destroy(multipart_parser_t* parser);
+
+// Run the parser over the next len bytes of the body. Returns 0 on success or
+// -1 if the body is malformed, in which case all further input is ignored.
+int multipart_parser_feed(multipart_parser_t* parser, const char* buf, size_t len);
+
+// Returns 0 if the parser saw the closing delimiter, or -1 otherwise.
+int multipart_parser_finish(multipart_parser_t* parser);
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+#include <sys/types.h>
+#include <stdlib.h>
+
+// The most buffers handed to a single writev(2) call
+#define OUTBOX_MAX_IOVECS 64
+
+// This struct is an immutable, reference counted chunk of output. A message
+// sent to many connections is encoded once into a refbuf and every connection
+// queues a pointer to it instead of a copy.
+typedef struct _refbuf {
+    size_t refcount;
+    size_t len;
+    char data[];
+} refbuf_t;
+
+// This struct is a bounded queue of refbufs waiting to be written to a socket.
+// Entries live in a ring buffer with the oldest one at head.
+typedef struct _outbox {
+    refbuf_t** entries;
+    size_t capacity;     // the most refbufs that may be queued at once
+    size_t head;
+    size_t length;       // number of refbufs queued
+    size_t offset;       // bytes of the head refbuf already written
+    size_t bytes_queued; // unwritten bytes across every queued refbuf
+} outbox_t;
+
+// Construct a refbuf holding a copy of len bytes of data (if data is not NULL)
+// with a reference count of 1.
+refbuf_t* refbuf_create(const void* data, size_t len);
+
+// Take another reference to a refbuf.
+refbuf_t* refbuf_retain(refbuf_t* buf);
+
+// Drop a reference to a refbuf, freeing it once the last one is gone.
+void refbuf_release(refbuf_t* buf);
+
+void outbox_init(outbox_t* outbox, size_t capacity);
+
+// Release every refbuf still queued in the outbox.
+void outbox_destroy(outbox_t* outbox);
+
+// Queue a refbuf behind everything else in the outbox, taking a reference to
+// it. Returns 0 on success, or -1 if the outbox is full.
+int outbox_push(outbox_t* outbox, refbuf_t* buf);
+
+// Write queued refbufs to fd with writev(2) until it would block or the outbox
+// is empty. Returns 0 on success, or -1 if the socket failed.
+int outbox_flush(outbox_t* outbox, int fd);
+
+// Queue a refbuf for a client that is sent to from outside of its own events,
+// e.g. by a broadcast. An idle socket would not be woken up to write, so if
+// the outbox was empty and flush_if_idle is set it is flushed right away. A
+// client whose outbox is full or whose socket fails is dropped: the socket is
+// shut down rather than closed so that nothing is freed in the middle of the
+// broadcast, and the event loop closes the connection once it sees the hangup.
+// Returns 0 on success, or -1 if the client was dropped.
+int outbox_enqueue_or_drop(outbox_t* outbox, refbuf_t* buf, int fd, int flush_if_idle);
+
+static inline int outbox_is_empty(const outbox_t* outbox) {
+    return outbox->length == 0;
+}
\ No newline at end of file
@@ -1,6 +1,6 @@
 #pragma once
 
-#define NUM_HTTP_STATUS_CODES 29
+#define NUM_HTTP_STATUS_CODES 32
 #define NUM_HTTP_METHODS 8
 #define MAX_URL_LENGTH 2048
 
@@ -18,6 +18,15 @@
 #define CONTENT_TYPE_ZIP   "application/zip"
 #define CONTENT_TYPE_JSON  "application/json"
 #define CONTENT_TYPE_JS    "application/javascript"
+#define CONTENT_TYPE_GIF   "image/gif"
+#define CONTENT_TYPE_SVG   "image/svg+xml"
+#define CONTENT_TYPE_ICO   "image/x-icon"
+#define CONTENT_TYPE_WEBP  "image/webp"
+#define CONTENT_TYPE_WASM  "application/wasm"
+#define CONTENT_TYPE_WOFF2 "font/woff2"
+#define CONTENT_TYPE_OCTET_STREAM "application/octet-stream"
+#define CONTENT_TYPE_EVENT_STREAM "text/event-stream"
+#define CONTENT_TYPE_MULTIPART_BYTERANGES "multipart/byteranges"
 
 static const char CRLF[] = "\r\n";
 
@@ -38,10 +47,12 @@ typedef enum _http_method {
 // Change the NUM_HTTP_STATUS_CODES definition in protocol.h in case any enums 
 // are added or removed from this list...
 typedef enum _http_status {
+    STATUS_SWITCHING_PROTOCOLS        = 101,
     STATUS_OK                         = 200,
     STATUS_CREATED                    = 201,
     STATUS_ACCEPTED                   = 202,
     STATUS_NO_CONTENT                 = 204,
+    STATUS_PARTIAL_CONTENT            = 206,
     STATUS_MOVED_PERMANENTLY          = 301,
     STATUS_FOUND                      = 302,
     STATUS_SEE_OTHER                  = 303,
@@ -58,6 +69,7 @@ typedef enum _http_status {
     STATUS_PAYLOAD_TOO_LARGE          = 413,
     STATUS_URI_TOO_LONG               = 414,
     STATUS_UNSUPPORTED_MEDIA_TYPE     = 415,
+    STATUS_RANGE_NOT_SATISFIABLE      = 416,
     STATUS_IM_A_TEAPOT                = 418,
     STATUS_TOO_MANY_REQUESTS          = 429,
     STATUS_INTERNAL_SERVER_ERROR      = 500,
@@ -73,4 +85,26 @@ const char* http_method_to_string(http_method method);
 
 const char* http_status_to_string(http_status status);
 
-int url_decode(char* out, const char* in);
\ No newline at end of file
+// Map a case-sensitive method name such as "GET" to its http_method, or 
+// HTTP_UNKNOWN if the method is not recognized.
+http_method http_method_from_string(const char* method);
+
+int url_decode(char* out, const char* in);
+
+// Decode an application/x-www-form-urlencoded key or value, which differs from
+// url_decode in that '+' stands for a space. out may be the same buffer as in.
+// Returns the number of decoded bytes (not counting the NUL-terminator), or -1
+// if in contains an invalid percent-escape.
+int form_url_decode(char* out, const char* in);
+
+// Check for a token in a comma separated header value like "keep-alive, Upgrade".
+// Tokens are compared case-insensitively. Returns 0 if value is NULL.
+int http_header_has_token(const char* value, const char* token);
+
+// Check whether an Accept-Encoding header value allows a content coding such as
+// "gzip". Codings listed with q=0 are refused. Returns 0 if value is NULL.
+int http_accepts_encoding(const char* value, const char* coding);
+
+// Pick a content type for a file from the extension of its name, falling back
+// to CONTENT_TYPE_OCTET_STREAM.
+const char* content_type_from_extension(const char* path);
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+#include "response.h"
+#include "request.h"
+
+// Requests for more ranges than this are answered with the whole body
+#define RANGE_MAX_PARTS 16
+
+// A multipart/byteranges body larger than this is not assembled and the whole
+// body is sent instead
+#define RANGE_MAX_MULTIPART_SIZE (8UL << 20UL)
+
+#ifndef __DISABLE_RANGE_REQUESTS__
+// Advertise Accept-Ranges on a 200 response whose body is a file (one that has
+// an ETag or Last-Modified header) and narrow it to the byte ranges the
+// request asks for, subject to If-Range. A single range becomes a 206 that
+// starts sending at the first requested byte, several ranges become a 206 with
+// a multipart/byteranges body, and ranges that all fall outside the body
+// become a 416 Range Not Satisfiable. A malformed Range header is ignored.
+void response_try_apply_range(response_t** response, request_t* request);
+#endif
\ No newline at end of file
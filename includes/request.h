@@ -14,11 +14,25 @@ typedef union _request_body_content {
     char* str;
 } request_body_content_t;
 
+typedef struct _multipart_parser multipart_parser_t;
+
+// The most parameters a route may have, e.g. /v1/users/<id> has one
+#define MAX_ROUTE_PARAMS 8
+
+// A route parameter captured from the request path. The value is a slice of
+// request->path and is not NUL-terminated.
+typedef struct _route_param {
+    const char* name;
+    const char* value;
+    size_t len;
+} route_param_t;
+
 typedef struct _request_body {
     request_body_content_t content;
     size_t length;
     size_t __ptr;
     request_body_type_t type;
+    int __borrowed; // content points into memory owned by another body
 } request_body_t;
 
 // This struct contains information about a client's request
@@ -28,8 +42,11 @@ typedef struct _request {
     dictionary* params;  // a dictionary of (char*) -> (char*) 
     char* protocol;
     char* path;
+    route_param_t route_params[MAX_ROUTE_PARAMS];
+    size_t num_route_params;
     request_body_t* body;
     dictionary* form;    // a dictionary of (char*) -> (request_body_t*)
+    multipart_parser_t* __form_parser;
 } request_t;
 
 // Construct a request_t struct using the specified HTTP request method
@@ -40,10 +57,44 @@ void request_destroy(request_t* request);
 
 void request_parse_query_params(request_t* request);
 
+// Get the value of the route parameter called name, which is a slice of the
+// request path that is len bytes long, or NULL if the route has no such 
+// parameter.
+const char* request_get_route_param(request_t* request, const char* name, size_t* len);
+
+// Construct a request body of the specified type that can hold len bytes
+request_body_t* request_create_body(request_body_type_t type, size_t len);
+
+// Destroy the passed request_body_t struct
+void request_destroy_body(request_body_t* body);
+
 void request_init_str_body(request_t* request, size_t len);
 
 void request_init_tmp_file_body(request_t* request, size_t len);
 
+// Stream a multipart/form-data body into request->form as it arrives instead 
+// of buffering it in request->body.
+void request_init_multipart_body(request_t* request, const char* boundary);
+
 void request_convert_str_body_to_tmp_file(request_t* request);
 
-void request_read_body(request_t* request, char* rd_buf, size_t rd_len);
\ No newline at end of file
+// Move the bytes received so far in an in-memory body into a tmpfile.
+void request_convert_body_to_tmp_file(request_body_t* body);
+
+void request_read_body(request_t* request, char* rd_buf, size_t rd_len);
+
+// Called once the whole body has been received. Returns 0 on success, or -1 
+// if the body could not be parsed. An in-memory body sent as 
+// application/x-www-form-urlencoded is decoded in place into request->form, so
+// the form entries borrow from (and overwrite) request->body.
+int request_finish_body(request_t* request);
+
+// Get the raw file descriptor backing a request body that was spooled to a 
+// temporary file, or -1 if the body is held in memory. Handlers may use it 
+// directly with copy_file_range(2), sendfile(2), etc.
+int request_body_fd(request_t* request);
+
+// Give a name to a request body that was spooled to an anonymous temporary 
+// file by linking it into the filesystem at path. Returns 0 on success or -1 on
+// failure with errno set.
+int request_link_body(request_t* request, const char* path);
\ No newline at end of file
@@ -2,34 +2,97 @@
 #include "dictionary.h"
 #include "protocol.h"
 #include "request.h"
+#include "outbox.h"
+#include <sys/uio.h>
 #include <stdio.h>
 
 typedef enum _response_type {
     RT_FILE,
     RT_STRING,
-    RT_EMPTY
+    RT_IOVEC,
+    RT_EMPTY,
+    RT_EVENT_STREAM
 } response_type;
 
+// Headers that most responses carry are kept in fixed slots instead of the 
+// headers dictionary so that they can be set and serialized cheaply.
+typedef enum _response_header_field {
+    RHF_CONTENT_TYPE,
+    RHF_LAST_MODIFIED,
+    RHF_CACHE_CONTROL,
+    RHF_EXPIRES,
+    RHF_ETAG,
+    NUM_RESPONSE_HEADER_FIELDS
+} response_header_field_t;
+
+// The complete HTTP/1 bytes of a built-in response, serialized once at 
+// startup. Only the value of the Date header is missing: it belongs between
+// bytes[date_offset - 1] and bytes[date_offset].
+typedef struct _preserialized_response {
+    char* bytes;         // the status line, headers and body
+    size_t date_offset;
+    size_t len;
+} preserialized_response_t;
+
+// This enum indicates who owns the memory behind a string body.
+typedef enum _body_ownership {
+    BO_OWNED,   // freed when the response is destroyed
+    BO_STATIC,  // never freed, e.g. a string literal
+    BO_SHARED   // a refbuf that is released when the response is destroyed
+} body_ownership_t;
+
+// This callback frees or releases whatever backs one segment of an RT_IOVEC
+// body, e.g. free, once the response is destroyed.
+typedef void (*body_segment_release_t)(void* ctx);
+
+// One piece of an RT_IOVEC body. The bytes must not change until release is 
+// called with ctx. release is NULL for memory that outlives the response.
+typedef struct _body_segment {
+    const char* data;
+    size_t len;
+    body_segment_release_t release;
+    void* ctx;
+} body_segment_t;
+
 typedef union _body_content {
     FILE* file;
-    const char* body;
+    const char* body;    // or the channel name of an RT_EVENT_STREAM response
+    body_segment_t* segments;
 } body_content_t;
 
 // This struct represents a response to a HTTP request. The server will format
 // the fields in this structure and send the formatted response to the client
 // who made the request that corresponds to this response.
 // 
-// The server will automatically add the following headers to the response: 
-// Date, Server, Connection. If the Content-Length header is not set, then the 
-// server sets the value to the length of the NUL-terminated response body 
-// string. 
+// The server will automatically add the following headers to the response 
+// when it is sent: Date, Server, Connection. If the Content-Length header is 
+// not set, then the server sets the value to the length of the NUL-terminated 
+// response body string. Use response_set_header and response_get_header rather
+// than touching fields and headers directly.
+//
+// The built-in error responses point preserialized at bytes that are written
+// to the socket as they are. Setting a header detaches such a response so that
+// it is formatted like any other.
 typedef struct _response {
     body_content_t body_content;
-    dictionary* headers; // a dictionary of (char*) -> (char*) 
+    const preserialized_response_t* preserialized; // NULL for most responses
+    refbuf_t* shared_body; // the refbuf behind the body of a BO_SHARED response
+    body_ownership_t ownership;
+    char* fields[NUM_RESPONSE_HEADER_FIELDS]; // see response_header_field_t
+    dictionary* headers; // any other headers, (char*) -> (char*), or NULL
+    size_t content_length; // SIZE_MAX if there is no Content-Length header
+    size_t body_offset;    // bytes at the start of the body that are not sent
+    size_t num_segments;   // the length of body_content.segments for RT_IOVEC
+    time_t last_modified;  // the Last-Modified header parsed, or -1 if unset
     http_status status;
     response_type rt;
 } response_t;
 
+// This callback receives every header of a response. The strings are only 
+// valid during the callback.
+typedef void (*response_header_callback_t)(
+    void* ctx, const char* key, size_t key_len, const char* value, size_t value_len);
+
 /// STANDARD RESPONSE CONSTRUCTORS
 
 // Construct a response that will send the contents of a file as the response body
@@ -39,9 +102,43 @@ response_t* response_from_file(http_status status, FILE* file);
 // UP UNTIL THE FIRST NULL BYTE!
 response_t* response_from_string(http_status status, const char* body);
 
+// Construct a response that takes ownership of a heap-allocated body instead of
+// copying it. The body is freed when the response is destroyed.
+response_t* response_from_owned(http_status status, char* body);
+
+// Like response_from_owned, for a body of len bytes that may not be 
+// NUL-terminated.
+response_t* response_from_owned_buffer(http_status status, char* body, size_t len);
+
+// Construct a response that sends a body that outlives every response, such 
+// as a string literal, without copying or freeing it.
+response_t* response_from_static(http_status status, const char* body);
+
+// Construct a response that sends the contents of a refbuf. The response takes
+// its own reference, so one buffer can back any number of concurrent responses.
+response_t* response_from_shared(http_status status, refbuf_t* body);
+
+// Construct a response whose body is sent as the concatenation of segments,
+// without joining them into one string. The array is copied, and the response
+// takes over releasing each segment. More can be added with 
+// response_append_segment.
+response_t* response_from_segments(
+    http_status status, const body_segment_t* segments, size_t num_segments);
+
+// Construct a response that sends the file at path out of the static file 
+// cache (see file_cache.h) with its Last-Modified and ETag headers. Files too
+// large to cache are sent like response_from_file. Returns NULL if the file 
+// cannot be opened.
+response_t* response_from_cached_file(http_status status, const char* path);
+
 // Construct a response that will send an empty body
 response_t* response_empty(http_status status);
 
+// Construct a text/event-stream response that keeps the connection open and 
+// sends it every event published to channel with sse_publish (see sse.h). 
+// Event streams are only served over HTTP/1.
+response_t* response_event_stream(const char* channel);
+
 /// ERROR RESPONSE CONSTRUCTORS
 
 // Construct a response for 304 Not Modified
@@ -65,14 +162,31 @@ response_t* response_length_required(request_t* request);
 // Constructs a response for 414 URI Too Long with a pre-populated json message
 response_t* response_uri_too_long(request_t* request);
 
+// Serialize the built-in error responses ahead of time. The server calls this 
+// once at startup; the error constructors also call it if it has not run.
+void response_preserialize_errors(void);
+
 // Response destructor. This does not need to be called by users as it will 
 // automatically be called internally.
 void response_destroy(response_t* response);
 
-#ifndef __DISABLE_HANDLE_IF_MODIFIED_SINCE__
-void response_try_optimize_if_not_modified_since(
-    response_t** response, char* target_date);
-#endif
+// Replace the body of a response with a reference to a refbuf, releasing the
+// old body and updating the content length.
+void response_set_shared_body(response_t* response, refbuf_t* body);
+
+// Add a segment to the end of the body of an RT_IOVEC response and count it in
+// the content length. The response calls release with ctx once it is done.
+void response_append_segment(response_t* response, const char* data, size_t len,
+    body_segment_release_t release, void* ctx);
+
+// Add the contents of a refbuf to the end of the body of an RT_IOVEC response.
+// The response takes its own reference.
+void response_append_shared_segment(response_t* response, refbuf_t* buf);
+
+// Point up to max_iov iovecs at the body of an RT_IOVEC response, starting 
+// offset bytes into what is sent (after body_offset) and stopping at the 
+// content length. Returns the number of iovecs filled.
+int response_body_iovec(response_t* response, size_t offset, struct iovec* iov, int max_iov);
 
 // Utility function to make it easier to set the Content-Type header
 void response_set_content_type(response_t* response, const char* content_type);
@@ -83,6 +197,33 @@ void response_set_content_length(response_t* response, size_t length);
 // Utility function to set any response header
 void response_set_header(response_t* response, const char* key, const char* value);
 
+// Get the value of a response header, or NULL if it is not set. The 
+// Content-Length header lives in response->content_length instead.
+const char* response_get_header(response_t* response, const char* key);
+
+// Add a request header to the Vary header of the response, keeping any that
+// are already listed there.
+void response_add_vary(response_t* response, const char* header);
+
+// Call callback for every header of the response, including the ones the 
+// server adds automatically.
+void response_for_each_header(
+    response_t* response, response_header_callback_t callback, void* ctx);
+
+// Serialize the HTTP/1 status line and headers (ending in a blank line) into 
+// buf. Like snprintf, this returns the length of the complete header even if 
+// it did not fit in size bytes, in which case buf holds nothing useful.
+size_t response_format_header(response_t* response, char* buf, size_t size);
+
 #ifndef __DISABLE_HANDLE_IF_MODIFIED_SINCE__
-void response_try_optimize_if_not_modified_since(response_t** response, char* target_date);
+// Check the conditional headers of a request against the validators of the 
+// resource it asks for. If-None-Match is compared with etag (either may be 
+// NULL) and takes precedence over If-Modified-Since, which is compared with 
+// last_modified. Returns 1 if the client's copy is current.
+int request_is_not_modified(request_t* request, const char* etag, time_t last_modified);
+
+// Replace a 200 response with 304 Not Modified if the request shows that the 
+// client already has it. The 304 keeps the ETag, Cache-Control, Expires and 
+// Vary headers of the response it replaces.
+void response_try_optimize_not_modified(response_t** response, request_t* request);
 #endif
\ No newline at end of file
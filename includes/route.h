@@ -8,23 +8,51 @@
 // this handler serves.
 typedef response_t* (*route_handler_t)(request_t*);
 
+typedef struct _microcache_policy microcache_policy_t;
+
 typedef enum _url_component_type {
     UCT_CONSTANT,
     UCT_ROUTE_PARAM,
 } url_component_type_t;
 
 typedef struct _node {
-    char* component;
+    char* component;              // the parameter name for UCT_ROUTE_PARAM
     dictionary* const_children;
-    dictionary* var_children;
+    struct _node* var_child;      // matches any component, e.g. <id>
     url_component_type_t uct;
     route_handler_t* handlers;
+    microcache_policy_t** policies; // by method, for routes that opted in to caching
 } node_t;
 
 node_t* node_init(char* component);
 
 void node_destroy(node_t* node);
 
+// Register a handler for a route. A component written as <name> matches any
+// single component of a request path, e.g. /v1/users/<id>/orders/<oid>. Routes
+// sharing a parameter position must give it the same name.
 void register_route(http_method method, const char* route, route_handler_t handler);
 
-route_handler_t find_route_handler(http_method method, const char* route);
\ No newline at end of file
+#ifndef __DISABLE_MICROCACHE__
+// Register a handler for a route like register_route, and have the microcache
+// keep its responses according to policy, which is copied. Only this route 
+// is cached, even if handler serves other routes too.
+void register_cached_route(http_method method, const char* route, 
+    route_handler_t handler, const microcache_policy_t* policy);
+#endif
+
+// Freeze the registered routes into a compact table that lookups search in 
+// place, without copying or hashing the route. The server calls it when it 
+// launches. Registering a route afterwards drops the table until this is 
+// called again.
+void router_compile(void);
+
+// Find the handler for a route. Constant components are preferred over 
+// parameters, which are only tried when the route cannot match otherwise.
+route_handler_t find_route_handler(http_method method, const char* route);
+
+// Find the handler for a request the same way and capture the components its
+// path matched to route parameters into request->route_params. If policy is
+// not NULL it is set to the microcache policy of the route that matched, or
+// NULL if the route is not cached.
+route_handler_t find_request_handler(request_t* request, const microcache_policy_t** policy);
\ No newline at end of file
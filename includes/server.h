@@ -5,6 +5,12 @@
 #include "response.h"
 #include "request.h"
 #include "route.h"
+#include "websocket.h"
+#include "static_dir.h"
+#include "sse.h"
+#include "json.h"
+#include "microcache.h"
+#include "buffer_budget.h"
 
 // Initialize the server and bind to the specified port.
 void server_init(char* port);
@@ -13,4 +19,17 @@ void server_init(char* port);
 void server_launch(void);
 
 // Register a handler function to respond to the specified method and route.
-void server_register_route(http_method http_method, char* route, route_handler_t handler);
\ No newline at end of file
+void server_register_route(http_method http_method, char* route, route_handler_t handler);
+
+// Register a handler like server_register_route, and reuse what it returns for
+// identical GET requests until policy->ttl_ms runs out. See microcache.h.
+void server_register_cached_route(http_method method, char* route, 
+    route_handler_t handler, const microcache_policy_t* policy);
+
+// Accept WebSocket upgrade requests made to the specified route and hand the
+// resulting connections to handlers.
+void server_register_websocket(char* route, const websocket_handlers_t* handlers);
+
+// Serve the files under root_dir to GET requests for paths beginning with 
+// prefix. See static_dir.h.
+void server_register_static_dir(char* prefix, char* root_dir);
\ No newline at end of file
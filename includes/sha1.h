@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SHA1_DIGEST_LENGTH 20
+
+// Compute the SHA-1 digest of len bytes of data. SHA-1 is only used where a
+// protocol requires it (the WebSocket handshake), never for security.
+void sha1(const uint8_t* data, size_t len, uint8_t digest[SHA1_DIGEST_LENGTH]);
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include "connection.h"
+#include "outbox.h"
+
+// The most events that may wait on a slow subscriber before it is dropped
+#define SSE_MAX_BACKLOG 256
+
+typedef struct _sse_channel sse_channel_t;
+
+// This struct holds the state of a connection that is streaming a
+// text/event-stream response. Events are queued by reference on its outbox.
+struct _sse_subscriber {
+    connection_t* conn;
+    sse_channel_t* channel;
+    outbox_t outbox;
+    int failed;
+};
+
+// Start streaming events published on the channel named by the connection's 
+// RT_EVENT_STREAM response. Called once its header has been written.
+void sse_subscribe(connection_t* conn);
+
+// Discard anything the client sends and write as much queued output as the 
+// socket accepts. The connection must be edge triggered. Returns 0 if the 
+// connection should stay open, or -1 if it should be closed.
+int sse_on_event(sse_subscriber_t* subscriber);
+
+// Remove the subscriber from its channel and release its backlog.
+void sse_subscriber_destroy(sse_subscriber_t* subscriber);
+
+// Publish an event to every subscriber of a channel. The event is encoded 
+// once and shared by every subscriber's queue. event and id may be NULL; data 
+// may span multiple lines. Returns the number of subscribers it was queued for.
+size_t sse_publish(const char* channel, const char* event, const char* id, const char* data);
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+#include "response.h"
+#include "request.h"
+
+// Serve the files under root_dir for GET requests whose path begins with 
+// prefix, e.g. "/static/css/app.css" -> "<root_dir>/css/app.css". A path that
+// names a directory is served its index.html.
+void static_dir_register(const char* prefix, const char* root_dir);
+
+// Build the response to a request that falls under a registered static 
+// directory. A sibling .br, .zst or .gz file is sent in place of the file when
+// the client's Accept-Encoding allows it. Returns NULL if the request is not
+// for a static directory.
+response_t* static_dir_try_serve(request_t* request);
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+#include "connection.h"
+#include "outbox.h"
+
+#include <stdint.h>
+
+// Messages larger than this (after reassembling fragments) fail the connection
+#define WEBSOCKET_MAX_MESSAGE_SIZE (1UL << 24UL)
+
+// The most frames that may wait on a slow client before it is dropped
+#define WEBSOCKET_MAX_BACKLOG 1024
+
+// Opcodes (RFC 6455 5.2)
+typedef enum _websocket_opcode {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT         = 0x1,
+    WS_BINARY       = 0x2,
+    WS_CLOSE        = 0x8,
+    WS_PING         = 0x9,
+    WS_PONG         = 0xA
+} websocket_opcode_t;
+
+// Status codes sent in close frames (RFC 6455 7.4.1)
+typedef enum _websocket_close_code {
+    WS_CLOSE_NORMAL           = 1000,
+    WS_CLOSE_GOING_AWAY       = 1001,
+    WS_CLOSE_PROTOCOL_ERROR   = 1002,
+    WS_CLOSE_NO_STATUS        = 1005, // never sent, the close frame had no code
+    WS_CLOSE_ABNORMAL         = 1006, // never sent, there was no close frame
+    WS_CLOSE_INVALID_DATA     = 1007,
+    WS_CLOSE_POLICY_VIOLATION = 1008,
+    WS_CLOSE_MESSAGE_TOO_BIG  = 1009
+} websocket_close_code_t;
+
+typedef struct _websocket websocket_t;
+
+// The callbacks an application registers for a WebSocket endpoint. Any of them
+// may be NULL. Messages are only valid for the duration of on_message.
+typedef struct _websocket_handlers {
+    // Called once the handshake completes. The request that asked for the 
+    // upgrade (headers, query params, ...) stays alive until the socket closes.
+    void (*on_open)(websocket_t* ws, request_t* request);
+    // Called with every complete text or binary message.
+    void (*on_message)(websocket_t* ws, websocket_opcode_t opcode, 
+        const char* data, size_t len);
+    // Called right before the connection is destroyed with the code from the 
+    // client's close frame, or WS_CLOSE_ABNORMAL if it never sent one.
+    void (*on_close)(websocket_t* ws, uint16_t code);
+} websocket_handlers_t;
+
+typedef struct _websocket_group websocket_group_t;
+
+// This struct holds the state of a connection that has switched to the 
+// WebSocket protocol.
+struct _websocket {
+    connection_t* conn;
+    const websocket_handlers_t* handlers;
+    void* data;                 // set by the application, see websocket_set_data
+    outbox_t outbox;
+    websocket_group_t** groups; // the groups this socket has joined
+    size_t num_groups;
+    uint8_t* in_buf;
+    size_t in_len;
+    size_t in_size;
+    char* message;              // a message reassembled from fragments
+    size_t message_len;
+    size_t message_size;
+    websocket_opcode_t message_opcode; // WS_CONTINUATION if no message is open
+    uint16_t close_code;
+    int close_sent;
+    int close_received;
+    int failed;
+    int dispatching;            // output is flushed once the event is handled
+};
+
+// Register callbacks for WebSocket upgrade requests made to route. The route 
+// is matched exactly against the request path.
+void websocket_register(const char* route, const websocket_handlers_t* handlers);
+
+// If the request just received asks to upgrade a registered route to a 
+// WebSocket, send 101 Switching Protocols and switch the connection over. 
+// Returns 1 if the connection was upgraded, 0 if the route is not a WebSocket
+// endpoint, or -1 if it is one but the handshake was invalid.
+int websocket_try_upgrade(connection_t* conn);
+
+// Read and process every frame available on the socket, then write as much 
+// queued output as the socket accepts. The connection must be edge triggered.
+// Returns 0 if the connection should stay open, or -1 if it should be closed.
+int websocket_on_event(websocket_t* ws);
+
+// Destroy the WebSocket state, calling on_close and leaving every group.
+void websocket_destroy(websocket_t* ws);
+
+// Queue a message for the client. Returns 0 on success, or -1 if the socket 
+// is closing or the client fell too far behind (in which case it is dropped).
+int websocket_send(websocket_t* ws, websocket_opcode_t opcode, 
+    const char* data, size_t len);
+
+int websocket_send_text(websocket_t* ws, const char* text);
+
+// Begin the closing handshake. reason may be NULL.
+void websocket_close(websocket_t* ws, uint16_t code, const char* reason);
+
+// Add the socket to a named group, creating the group if needed.
+void websocket_join(websocket_t* ws, const char* group);
+
+// Remove the socket from a group, destroying the group once it is empty.
+void websocket_leave(websocket_t* ws, const char* group);
+
+// Send a message to every member of a group. The frame is encoded once and 
+// shared by every member's queue. Returns the number of members it was queued
+// for.
+size_t websocket_broadcast(const char* group, websocket_opcode_t opcode, 
+    const char* data, size_t len);
+
+static inline void websocket_set_data(websocket_t* ws, void* data) { ws->data = data; }
+
+static inline void* websocket_get_data(websocket_t* ws) { return ws->data; }
\ No newline at end of file
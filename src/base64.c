@@ -0,0 +1,78 @@
+#include "base64.h"
+
+static const char BASE64_ALPHABET[] = 
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Maps a base64 character (either alphabet) to its 6-bit value, or -1
+static const int8_t BASE64_DECODE_TABLE[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,62,-1,63,
+    52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+    15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,63,
+    -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+    41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+size_t base64_encode(const uint8_t* in, size_t len, char* out) {
+    char* out_start = out;
+    size_t i = 0;
+
+    for (; i + 3 <= len; i += 3) {
+        uint32_t bits = ((uint32_t) in[i] << 16) | ((uint32_t) in[i + 1] << 8) | in[i + 2];
+        *out++ = BASE64_ALPHABET[(bits >> 18) & 0x3f];
+        *out++ = BASE64_ALPHABET[(bits >> 12) & 0x3f];
+        *out++ = BASE64_ALPHABET[(bits >> 6) & 0x3f];
+        *out++ = BASE64_ALPHABET[bits & 0x3f];
+    }
+
+    if ( i < len ) {
+        uint32_t bits = (uint32_t) in[i] << 16;
+        if ( i + 1 < len ) 
+            bits |= (uint32_t) in[i + 1] << 8;
+
+        *out++ = BASE64_ALPHABET[(bits >> 18) & 0x3f];
+        *out++ = BASE64_ALPHABET[(bits >> 12) & 0x3f];
+        *out++ = i + 1 < len ? BASE64_ALPHABET[(bits >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+
+    *out = '\0';
+    return out - out_start;
+}
+
+ssize_t base64_decode(const char* in, size_t len, uint8_t* out) {
+    // padding carries no information, so drop it
+    while ( len && in[len - 1] == '=' )
+        --len;
+
+    // a single leftover character cannot encode a whole byte
+    if ( len % 4 == 1 ) { return -1; }
+
+    uint8_t* out_start = out;
+    uint32_t bits = 0;
+    size_t num_bits = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        int8_t value = BASE64_DECODE_TABLE[(unsigned char) in[i]];
+        if ( value < 0 ) { return -1; }
+
+        bits = (bits << 6) | value;
+        num_bits += 6;
+        if ( num_bits >= 8 ) {
+            num_bits -= 8;
+            *out++ = (bits >> num_bits) & 0xff;
+        }
+    }
+
+    return out - out_start;
+}
@@ -0,0 +1,46 @@
+#include "buffer_budget.h"
+#include "io_utils.h"
+
+static size_t bytes_used = 0;
+static size_t num_holders = 0;
+
+size_t buffer_budget_grow(size_t* held, size_t requested) {
+    // a connection asking for the first time counts towards the fair share
+    size_t fair_share = BUFFER_BUDGET_MAX_BYTES / (num_holders + (*held == 0));
+    size_t allowed = fair_share > *held ? fair_share - *held : 0;
+
+    size_t granted = MIN(requested, allowed);
+    granted = MIN(granted, BUFFER_BUDGET_MAX_BYTES - bytes_used);
+    if ( !granted ) { return 0; }
+
+    if ( *held == 0 ) { ++num_holders; }
+    *held += granted;
+    bytes_used += granted;
+
+    return granted;
+}
+
+void buffer_budget_shrink(size_t* held, size_t bytes) {
+    bytes = MIN(bytes, *held);
+    if ( !bytes ) { return; }
+
+    *held -= bytes;
+    bytes_used -= bytes;
+    if ( *held == 0 ) { --num_holders; }
+}
+
+size_t buffer_budget_fair_share(void) {
+    return BUFFER_BUDGET_MAX_BYTES / (num_holders ? num_holders : 1);
+}
+
+int buffer_budget_under_pressure(void) {
+    return bytes_used >= BUFFER_BUDGET_PRESSURE_BYTES;
+}
+
+size_t buffer_budget_used(void) {
+    return bytes_used;
+}
+
+size_t buffer_budget_holders(void) {
+    return num_holders;
+}
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include "compression.h"
+
+#ifndef __DISABLE_COMPRESSION__
+#include "dictionary.h"
+#include "lru.h"
+#include "io_utils.h"
+#include "format.h"
+
+#include <sys/stat.h>
+#include <strings.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+#define DEFAULT_DICT_CAPACITY 16
+#define FILE_CHUNK_SIZE (1UL << 16UL)
+#define CACHE_KEY_SIZE 96
+
+// This struct is a content coding that zlib can produce.
+typedef struct _content_coding {
+    const char* name;
+    int window_bits;     // selects the gzip or zlib wrapper
+} content_coding_t;
+
+// Codings are offered in order of preference
+static const content_coding_t CODINGS[] = {
+    { "gzip",    MAX_WBITS + 16 },
+    { "deflate", MAX_WBITS }
+};
+
+#define NUM_CODINGS (sizeof(CODINGS) / sizeof(CODINGS[0]))
+
+// Formats that are already compressed and would only grow
+static const char* INCOMPRESSIBLE_TYPES[] = {
+    CONTENT_TYPE_PNG, CONTENT_TYPE_JPG, CONTENT_TYPE_JPEG, CONTENT_TYPE_GIF,
+    CONTENT_TYPE_WEBP, CONTENT_TYPE_ZIP, CONTENT_TYPE_WOFF2, CONTENT_TYPE_PDF
+};
+
+#define NUM_INCOMPRESSIBLE_TYPES (sizeof(INCOMPRESSIBLE_TYPES) / sizeof(INCOMPRESSIBLE_TYPES[0]))
+
+static const char* CONTENT_TYPE_HEADER_KEY = "Content-Type";
+static const char* CONTENT_ENCODING_HEADER_KEY = "Content-Encoding";
+static const char* ETAG_HEADER_KEY = "ETag";
+static const char* ACCEPT_ENCODING_HEADER_KEY = "Accept-Encoding";
+
+// This struct is a compressed body in the compressed-response cache. Entries
+// are kept in an lru_list_t ordered from most to least recently used.
+typedef struct _compressed_entry {
+    lru_node_t node; // must come first
+    char* key;
+    refbuf_t* compressed; // NULL if the body did not get any smaller
+    size_t cost;          // what the entry counts against the byte cap
+} compressed_entry_t;
+
+static dictionary* entries = NULL; // (char*) -> (compressed_entry_t*)
+static lru_list_t lru = { NULL, NULL };
+static size_t bytes_cached = 0;
+static size_t num_entries = 0;
+
+static void __compression_evict(compressed_entry_t* entry) {
+    lru_unlink(&lru, &entry->node);
+    dictionary_remove(entries, entry->key);
+
+    bytes_cached -= entry->cost;
+    --num_entries;
+    if ( entry->compressed ) { refbuf_release(entry->compressed); }
+
+    free(entry->key);
+    free(entry);
+}
+
+static compressed_entry_t* __compression_cache_get(const char* key) {
+    if ( !entries || !dictionary_contains(entries, (void*) key) ) { return NULL; }
+
+    compressed_entry_t* entry = dictionary_get(entries, (void*) key);
+    lru_touch(&lru, &entry->node);
+
+    return entry;
+}
+
+// Remember the compressed form of a body, or that it has none if compressed is NULL
+static void __compression_cache_set(const char* key, refbuf_t* compressed) {
+    size_t cost = (compressed ? compressed->len : 0) + COMPRESSION_CACHE_ENTRY_COST;
+    if ( cost > COMPRESSION_CACHE_MAX_BYTES ) { return; }
+
+    if ( !entries ) {
+        entries = dictionary_create_with_capacity(
+            DEFAULT_DICT_CAPACITY, string_hash_function, string_compare,
+            string_copy_constructor, string_destructor,
+            lru_shallow_copy, lru_shallow_destroy
+        );
+    }
+
+    while ( lru.least_recent && (bytes_cached + cost > COMPRESSION_CACHE_MAX_BYTES 
+            || num_entries >= COMPRESSION_CACHE_MAX_ENTRIES) )
+        __compression_evict((compressed_entry_t*) lru.least_recent);
+
+    compressed_entry_t* entry = calloc(1, sizeof(compressed_entry_t));
+    entry->key = strdup(key);
+    entry->compressed = compressed ? refbuf_retain(compressed) : NULL;
+    entry->cost = cost;
+
+    dictionary_set(entries, entry->key, entry);
+    lru_push_front(&lru, &entry->node);
+    bytes_cached += cost;
+    ++num_entries;
+}
+
+// Compress len bytes, taken from data or else read from fd, into a new refbuf.
+// Returns NULL if zlib fails or the result is no smaller than the input.
+static refbuf_t* __compression_deflate(
+        const content_coding_t* coding, const char* data, int fd, size_t len) {
+    z_stream stream = { 0 };
+    if ( deflateInit2(&stream, COMPRESSION_LEVEL, Z_DEFLATED, coding->window_bits,
+            MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK )
+        return NULL;
+
+    size_t bound = deflateBound(&stream, len);
+    refbuf_t* out = refbuf_create(NULL, bound);
+    stream.next_out = (Bytef*) out->data;
+    stream.avail_out = bound;
+
+    int status = Z_OK;
+    if ( data ) {
+        stream.next_in = (Bytef*) data;
+        stream.avail_in = len;
+        status = deflate(&stream, Z_FINISH);
+    } else {
+        // files are streamed through zlib a chunk at a time
+        char chunk[FILE_CHUNK_SIZE];
+        size_t offset = 0;
+
+        while ( status == Z_OK ) {
+            ssize_t bytes_read = pread(fd, chunk, MIN(sizeof(chunk), len - offset), offset);
+            if ( bytes_read == -1 && errno == EINTR ) { continue; }
+            if ( bytes_read < 0 ) { break; }
+
+            offset += bytes_read;
+            stream.next_in = (Bytef*) chunk;
+            stream.avail_in = bytes_read;
+            status = deflate(&stream, offset == len || !bytes_read ? Z_FINISH : Z_NO_FLUSH);
+        }
+    }
+
+    size_t compressed_len = stream.total_out;
+    deflateEnd(&stream);
+
+    if ( status != Z_STREAM_END || compressed_len >= len ) {
+        refbuf_release(out);
+        return NULL;
+    }
+
+    out = realloc(out, sizeof(refbuf_t) + compressed_len);
+    out->len = compressed_len;
+    return out;
+}
+
+static int __compression_is_worthwhile(response_t* response) {
+    if ( response->rt != RT_STRING && response->rt != RT_FILE ) { return 0; }
+    if ( response->preserialized ) { return 0; }
+
+    size_t len = response->content_length;
+    if ( len == SIZE_MAX || len < COMPRESSION_MIN_SIZE || len > COMPRESSION_MAX_SIZE )
+        return 0;
+
+    if ( response_get_header(response, CONTENT_ENCODING_HEADER_KEY) ) { return 0; }
+
+    const char* content_type = response_get_header(response, CONTENT_TYPE_HEADER_KEY);
+    for (size_t i = 0; content_type && i < NUM_INCOMPRESSIBLE_TYPES; ++i) {
+        if ( !strncasecmp(content_type, INCOMPRESSIBLE_TYPES[i], strlen(INCOMPRESSIBLE_TYPES[i])) )
+            return 0;
+    }
+
+    return 1;
+}
+
+// Build the key a body is cached under, or return 0 if it should not be cached.
+// Shared bodies are keyed on their strong ETag, which names their contents,
+// since a refbuf's address is reused once it is freed and every reload of a
+// cached file or handler response makes a new one.
+static int __compression_cache_key(
+        response_t* response, const content_coding_t* coding, char* key) {
+    if ( response->rt == RT_FILE ) {
+        struct stat info;
+        if ( fstat(fileno(response->body_content.file), &info) ) { return 0; }
+
+        snprintf(key, CACHE_KEY_SIZE, "%s:f:%lx:%lx:%lx:%lx", coding->name,
+            (unsigned long) info.st_dev, (unsigned long) info.st_ino,
+            (unsigned long) info.st_mtime, (unsigned long) info.st_size);
+        return 1;
+    } else if ( response->ownership == BO_SHARED ) {
+        const char* etag = response->fields[RHF_ETAG];
+        if ( !etag || !strncmp(etag, "W/", 2) ) { return 0; }
+
+        int len = snprintf(key, CACHE_KEY_SIZE, "%s:e:%s:%zx", coding->name,
+            etag, response->content_length);
+        return len < CACHE_KEY_SIZE;
+    } else if ( response->ownership == BO_STATIC ) {
+        snprintf(key, CACHE_KEY_SIZE, "%s:s:%p:%zx", coding->name,
+            (void*) response->body_content.body, response->content_length);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Tell the coding apart in the ETag, e.g. "671318a2-8140a" -> "671318a2-8140a-gzip"
+static void __compression_update_etag(response_t* response, const content_coding_t* coding) {
+    const char* etag = response_get_header(response, ETAG_HEADER_KEY);
+    if ( !etag ) { return; }
+
+    size_t len = strlen(etag);
+    int quoted = len >= 2 && etag[len - 1] == '"';
+
+    char* updated = NULL;
+    asprintf(&updated, "%.*s-%s%s", (int) (len - quoted), etag, coding->name, quoted ? "\"" : "");
+    response_set_header(response, ETAG_HEADER_KEY, updated);
+    free(updated);
+}
+
+// Undo __compression_update_etag once the body turns out not to get any smaller
+static void __compression_restore_etag(response_t* response, const content_coding_t* coding) {
+    const char* etag = response_get_header(response, ETAG_HEADER_KEY);
+    if ( !etag ) { return; }
+
+    size_t len = strlen(etag);
+    int quoted = len >= 2 && etag[len - 1] == '"';
+    size_t suffix_len = strlen(coding->name) + 1;
+
+    if ( len < suffix_len + quoted ) { return; }
+
+    char* restored = NULL;
+    asprintf(&restored, "%.*s%s", (int) (len - quoted - suffix_len), etag, quoted ? "\"" : "");
+    response_set_header(response, ETAG_HEADER_KEY, restored);
+    free(restored);
+}
+
+static const content_coding_t* __compression_find_coding(const char* name) {
+    for (size_t i = 0; name && i < NUM_CODINGS; ++i) {
+        if ( !strcmp(CODINGS[i].name, name) )
+            return &CODINGS[i];
+    }
+
+    return NULL;
+}
+
+const char* response_negotiate_coding(response_t* response, const char* accept_encoding) {
+    if ( !__compression_is_worthwhile(response) ) { return NULL; }
+
+    // the body depends on Accept-Encoding whether or not this client gets it
+    response_add_vary(response, ACCEPT_ENCODING_HEADER_KEY);
+
+    const content_coding_t* coding = NULL;
+    for (size_t i = 0; i < NUM_CODINGS && !coding; ++i) {
+        if ( http_accepts_encoding(accept_encoding, CODINGS[i].name) )
+            coding = &CODINGS[i];
+    }
+
+    if ( !coding ) { return NULL; }
+
+    // a body already known not to get any smaller keeps its own ETag
+    char key[CACHE_KEY_SIZE];
+    if ( __compression_cache_key(response, coding, key) ) {
+        compressed_entry_t* entry = __compression_cache_get(key);
+        if ( entry && !entry->compressed ) { return NULL; }
+    }
+
+    __compression_update_etag(response, coding);
+    return coding->name;
+}
+
+void response_try_compress(response_t* response, const char* coding_name) {
+    const content_coding_t* coding = __compression_find_coding(coding_name);
+    if ( !coding || !__compression_is_worthwhile(response) ) { return; }
+
+    char key[CACHE_KEY_SIZE];
+    int cacheable = __compression_cache_key(response, coding, key);
+    compressed_entry_t* entry = cacheable ? __compression_cache_get(key) : NULL;
+    refbuf_t* compressed = NULL;
+
+    if ( entry && entry->compressed ) {
+        compressed = refbuf_retain(entry->compressed);
+    } else if ( !entry ) {
+        int is_file = response->rt == RT_FILE;
+        compressed = __compression_deflate(
+            coding, is_file ? NULL : response->body_content.body,
+            is_file ? fileno(response->body_content.file) : -1,
+            response->content_length
+        );
+
+        if ( cacheable )
+            __compression_cache_set(key, compressed);
+    }
+
+    if ( !compressed ) {
+        __compression_restore_etag(response, coding);
+        return;
+    }
+
+    response_set_shared_body(response, compressed);
+    refbuf_release(compressed);
+
+    response_set_header(response, CONTENT_ENCODING_HEADER_KEY, coding->name);
+}
+
+void compression_cache_clear(void) {
+    while ( lru.least_recent )
+        __compression_evict((compressed_entry_t*) lru.least_recent);
+
+    if ( entries ) {
+        dictionary_destroy(entries);
+        entries = NULL;
+    }
+}
+#endif
@@ -1,11 +1,20 @@
 #include "connection.h"
+#include "multipart.h"
 #include "format.h"
+#include "websocket.h"
+#include "sse.h"
+#include "http2.h"
+#include "compression.h"
+#include "range.h"
+#include "buffer_budget.h"
 
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <err.h>
 
@@ -19,7 +28,21 @@
 
 #define MAX_BUFFER_SIZE MAX_RCV_BUFFER_SIZE
 
+#define SPLICE_PIPE_SIZE (1 << 20)
+
+// Big enough for the header of every response the server builds itself
+#define RESPONSE_HEADER_BUFFER_SIZE (1UL << 13UL)
+
+// The most segments of an RT_IOVEC body handed to one sendmsg call
+#define MAX_BODY_IOVECS 64
+
+// The most bytes a connection reads or sends per readiness event before the
+// loop moves on to the others. Connections are level triggered, so one that
+// stops at this budget is woken up again on the next loop iteration.
+#define MAX_BYTES_PER_EVENT (1UL << 20UL)
+
 static char* CONTENT_LENGTH_HEADER_KEY = "Content-Length";
+static char* CONTENT_TYPE_HEADER_KEY = "Content-Type";
 
 void* connection_init(void* ptr) {
     connection_initializer_t* c = (connection_initializer_t*) ptr;
@@ -33,6 +56,8 @@ void* connection_init(void* ptr) {
 
     this->buf = calloc(DEFAULT_RCV_BUFFER_SIZE, sizeof(char));
     this->buf_size = DEFAULT_RCV_BUFFER_SIZE;
+    this->buf_budget = 0;
+    this->snd_buf_growth = 0;
     this->buf_end = 0;
     this->buf_ptr = 0;
 
@@ -41,12 +66,21 @@ void* connection_init(void* ptr) {
     this->body_bytes_to_receive = 0;
     this->body_bytes_received = 0;
     this->flags = 0;
+#ifdef ZEROCOPY_ENABLED
+    this->zerocopy_sends = 0;
+    this->zerocopy_completed = 0;
+#endif
 
     this->response = NULL;
     this->request = NULL;
     this->client_address = strdup(c->client_address);
     this->client_port = c->client_port;
     this->client_fd = c->client_fd;
+    this->splice_pipe[0] = -1;
+    this->splice_pipe[1] = -1;
+    this->h2 = NULL;
+    this->ws = NULL;
+    this->sse = NULL;
 
     return (void*) this;
 }
@@ -56,6 +90,15 @@ void connection_destroy(void* ptr) {
 
     if ( this->buf )
         free(this->buf);
+
+    buffer_budget_shrink(&this->buf_budget, this->buf_budget);
+
+    // on_close may still look at the request that opened the socket
+    if ( this->ws )
+        websocket_destroy(this->ws);
+
+    if ( this->sse )
+        sse_subscriber_destroy(this->sse);
         
     if ( this->request )
         request_destroy(this->request);
@@ -66,15 +109,23 @@ void connection_destroy(void* ptr) {
     if ( this->client_address )
         free(this->client_address);
 
+    if ( this->h2 )
+        http2_session_destroy(this->h2);
+
+    if ( this->splice_pipe[0] != -1 ) {
+        close(this->splice_pipe[0]);
+        close(this->splice_pipe[1]);
+    }
+
     // WARN("destroy connection on fd=%d", this->client_fd);
     close(this->client_fd);
     free(this);
 }
 
-ssize_t connection_read(connection_t* conn, size_t event_data) {
-    size_t to_read = MIN(event_data, conn->buf_size - conn->buf_end);
+ssize_t connection_read(connection_t* conn) {
+    size_t to_read = MIN(MAX_BYTES_PER_EVENT, conn->buf_size - conn->buf_end);
     ssize_t bytes_read = 
-        read_all_from_socket(conn->client_fd, conn->buf + conn->buf_end, to_read);
+        read_available_from_socket(conn->client_fd, conn->buf + conn->buf_end, to_read);
 
     // adapted from: https://github.com/eliben/code-for-blog/blob/master/2017/async-socket-server/epoll-server.c
     if (bytes_read < 0) {
@@ -86,7 +137,7 @@ ssize_t connection_read(connection_t* conn, size_t event_data) {
         }
     }
 
-    conn->buf_end = bytes_read;
+    conn->buf_end += bytes_read;
     return bytes_read;
 }
 
@@ -97,26 +148,97 @@ void connection_shift_buffer(connection_t* conn) {
     conn->buf_ptr = 0;
 }
 
+// Grow the local buffer towards buffer_size bytes, as far as the buffer budget
+// allows.
 void __connection_resize_local_buffer(connection_t* conn, size_t buffer_size) {
-    if ( conn->buf_size < buffer_size ) {
-        buffer_size = MIN(MAX_BUFFER_SIZE, buffer_size);
-        // LOG("resize local buffer to %zu", buffer_size);
-        conn->buf_size = buffer_size;
-        conn->buf = realloc(conn->buf, conn->buf_size);
-    }
+    buffer_size = MIN(MAX_BUFFER_SIZE, buffer_size);
+    if ( conn->buf_size >= buffer_size ) { return; }
+
+    size_t granted = buffer_budget_grow(&conn->buf_budget, buffer_size - conn->buf_size);
+    if ( !granted ) { return; }
+
+    // LOG("resize local buffer to %zu", conn->buf_size + granted);
+    conn->buf_size += granted;
+    conn->buf = realloc(conn->buf, conn->buf_size);
+}
+
+// Shrink the local buffer back to its default size once the request has been
+// received, returning its growth to the buffer budget.
+void __connection_release_local_buffer(connection_t* conn) {
+    size_t buffer_size = MAX(DEFAULT_RCV_BUFFER_SIZE, (size_t) conn->buf_end + 1);
+    if ( conn->buf_size <= buffer_size ) { return; }
+
+    buffer_budget_shrink(&conn->buf_budget, conn->buf_size - buffer_size);
+    conn->buf_size = buffer_size;
+    conn->buf = realloc(conn->buf, conn->buf_size);
 }
 
 void __connection_resize_sock_rcv_buf(connection_t* conn, size_t buffer_size) {
     // LOG("resize rcv buffer to %zu", buffer_size);
-    setsockopt(conn->client_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    int size = buffer_size;
+    setsockopt(conn->client_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
 }
 
 void __connection_resize_sock_send_buf(connection_t* conn, size_t buffer_size) {
     // LOG("resize send buffer to %zu", buffer_size);
-    setsockopt(conn->client_fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    int size = buffer_size;
+    setsockopt(conn->client_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+// Set the size of the socket send buffer and return the size the kernel chose.
+// Linux doubles the value it is given to leave room for bookkeeping and caps it
+// at net.core.wmem_max.
+size_t __connection_set_sock_send_buf(connection_t* conn, size_t buffer_size) {
+#if defined(__linux__)
+    buffer_size /= 2;
+#endif
+    __connection_resize_sock_send_buf(conn, buffer_size);
+    return socket_snd_buf_size(conn->client_fd);
+}
+
+// Enlarge the socket send buffer by up to growth bytes out of the buffer
+// budget. Whatever the kernel did not actually grant is given back.
+void __connection_grow_sock_send_buf(connection_t* conn, size_t current, size_t growth) {
+    size_t granted = buffer_budget_grow(&conn->buf_budget, growth);
+    if ( !granted ) { return; }
+
+    size_t actual = __connection_set_sock_send_buf(conn, current + granted);
+    size_t gained = actual > current ? MIN(actual - current, granted) : 0;
+
+    buffer_budget_shrink(&conn->buf_budget, granted - gained);
+    conn->snd_buf_growth += gained;
+}
+
+// Give back the part of a large send buffer past this connection's fair share
+// when the buffer budget runs low, so that new transfers can grow theirs too.
+void __connection_reclaim_sock_send_buf(connection_t* conn) {
+    size_t fair_share = buffer_budget_fair_share();
+    if ( !buffer_budget_under_pressure() || conn->buf_budget <= fair_share ) { return; }
+
+    size_t excess = MIN(conn->buf_budget - fair_share, conn->snd_buf_growth);
+    if ( !excess ) { return; }
+
+    size_t current = socket_snd_buf_size(conn->client_fd);
+    size_t actual = __connection_set_sock_send_buf(conn, current - MIN(excess, current));
+    size_t released = current > actual ? MIN(current - actual, conn->snd_buf_growth) : 0;
+
+    buffer_budget_shrink(&conn->buf_budget, released);
+    conn->snd_buf_growth -= released;
 }
 
 void connection_try_parse_verb(connection_t* conn) {
+    // a client with prior knowledge of HTTP/2 opens with the connection preface
+    size_t preface_bytes = MIN((size_t) conn->buf_end, HTTP2_PREFACE_LENGTH);
+    if ( !memcmp(conn->buf, HTTP2_PREFACE, preface_bytes) ) {
+        if ( preface_bytes < HTTP2_PREFACE_LENGTH ) { return; }
+
+        conn->h2 = http2_session_create(conn);
+        http2_session_feed(conn->h2, conn->buf, conn->buf_end);
+        conn->buf_end = 0;
+        conn->state = CS_HTTP2;
+        return;
+    }
+
     size_t idx_space = 0;
     for (size_t i = 3; i < 8; ++i) { // look for a space between index 3 and 8
         if ( conn->buf[i] == ' ' ) {
@@ -131,28 +253,11 @@ void connection_try_parse_verb(connection_t* conn) {
     }
 
     conn->buf[idx_space] = '\0';
-    
-    // hash the string value and compare against known hash values to avoid many 
-    // calls to strncmp since HTTP methods ARE case sensitive
-    switch ( string_hash_function(conn->buf) ) {
-        case 193456677UL:
-            conn->request = request_create(HTTP_GET); break;
-        case 6384105719UL:
-            conn->request = request_create(HTTP_HEAD); break;
-        case 6384404715UL:
-            conn->request = request_create(HTTP_POST); break;
-        case 193467006UL:
-            conn->request = request_create(HTTP_PUT); break;
-        case 6952134985656UL:
-            conn->request = request_create(HTTP_DELETE); break;
-        case 229419557091567UL:
-            conn->request = request_create(HTTP_CONNECT); break;
-        case 229435100789681UL:
-            conn->request = request_create(HTTP_OPTIONS); break;
-        case 210690186996UL:
-            conn->request = request_create(HTTP_TRACE); break;
-        default:
-            conn->request = request_create(HTTP_UNKNOWN); conn->state = CS_REQUEST_RECEIVED; return;
+    conn->request = request_create(http_method_from_string(conn->buf));
+
+    if ( conn->request->method == HTTP_UNKNOWN ) {
+        conn->state = CS_REQUEST_RECEIVED;
+        return;
     }
 
     conn->state = CS_METHOD_PARSED;
@@ -232,6 +337,67 @@ void __allocate_buffer_for_request(connection_t* conn) {
     __connection_resize_local_buffer(conn, new_buf_len);
 }
 
+// Try to switch the connection over to splicing the request body into its 
+// temporary file. Any body bytes already read alongside the headers are written
+// out first. Returns 1 if the body will be spliced, 0 otherwise.
+int __connection_try_begin_splice(connection_t* conn) {
+#if defined(__linux__)
+    if ( pipe2(conn->splice_pipe, O_CLOEXEC) ) {
+        LOG("(fd=%d) pipe2 failed, falling back to buffered reads", conn->client_fd);
+        conn->splice_pipe[0] = conn->splice_pipe[1] = -1;
+        return 0;
+    }
+
+    // a bigger pipe means fewer splice round trips, but it is only a hint
+    fcntl(conn->splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+    request_read_body(conn->request, conn->buf, conn->buf_end);
+    fflush(conn->request->body->content.file);
+    conn->body_bytes_received += conn->buf_end;
+    conn->buf_end = 0;
+    conn->buf_ptr = 0;
+
+    SET_SPLICE_REQUEST_BODY(conn);
+    return 1;
+#else
+    (void) conn;
+    return 0;
+#endif
+}
+
+ssize_t connection_splice_request_body(connection_t* conn) {
+#if defined(__linux__)
+    size_t remaining = MIN(MAX_BYTES_PER_EVENT, 
+        conn->body_bytes_to_receive - conn->body_bytes_received);
+    ssize_t bytes_moved = splice_from_socket(
+        conn->client_fd, conn->splice_pipe, 
+        fileno(conn->request->body->content.file), remaining
+    );
+
+    if (bytes_moved < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -1;
+
+        WARN("(fd=%d) splice: %s", conn->client_fd, strerror(errno));
+
+        // the client is told when there is no room left for its body, and
+        // any other failure (e.g. the client resetting) ends only this connection
+        if (errno != ENOSPC && errno != EDQUOT && errno != EFBIG)
+            return 0;
+
+        conn->state = CS_WRITING_RESPONSE_HEADER;
+        conn->response = response_empty(STATUS_INSUFFICIENT_STORAGE);
+        return 1;
+    }
+
+    conn->body_bytes_received += bytes_moved;
+    return bytes_moved;
+#else
+    (void) conn;
+    return -1;
+#endif
+}
+
 void connection_read_request_body(connection_t* conn) {
     /// @todo send error if not put or post and has request body
     request_t* request = conn->request;
@@ -253,9 +419,21 @@ void connection_read_request_body(connection_t* conn) {
             "%zu", &conn->body_bytes_to_receive
         );
 
-        if ( conn->body_bytes_to_receive > MAX_RCV_BUFFER_SIZE ) {
-            request_init_tmp_file_body(request, conn->body_bytes_to_receive);
+        char* boundary = NULL;
+        if ( dictionary_contains(request->headers, CONTENT_TYPE_HEADER_KEY) ) {
+            boundary = multipart_parse_boundary(
+                dictionary_get(request->headers, CONTENT_TYPE_HEADER_KEY));
+        }
+
+        if ( boundary ) {
+            request_init_multipart_body(request, boundary);
             __allocate_buffer_for_request(conn);
+            free(boundary);
+        } else if ( conn->body_bytes_to_receive > MAX_RCV_BUFFER_SIZE ) {
+            request_init_tmp_file_body(request, conn->body_bytes_to_receive);
+
+            if ( !__connection_try_begin_splice(conn) )
+                __allocate_buffer_for_request(conn);
         } else {
             request_init_str_body(request, conn->body_bytes_to_receive);
         }
@@ -271,120 +449,249 @@ void connection_read_request_body(connection_t* conn) {
     size_t byte_diff = conn->body_bytes_to_receive - conn->body_bytes_received;
     if ( (is_put_or_post && byte_diff == 0) || !is_put_or_post ) {
         conn->state = CS_REQUEST_RECEIVED;
+
+        if ( IS_SPLICE_REQUEST_BODY(conn) ) {
+            close(conn->splice_pipe[0]);
+            close(conn->splice_pipe[1]);
+            conn->splice_pipe[0] = conn->splice_pipe[1] = -1;
+        }
+
+        if ( is_put_or_post && request_finish_body(request) ) {
+            conn->state = CS_WRITING_RESPONSE_HEADER;
+            conn->response = response_bad_request(NULL);
+            return;
+        }
 #ifndef __SKIP_LOG_REQUESTS__
         clock_gettime(CLOCK_REALTIME, &conn->time_received);
 #endif
     }
 }
 
-int __format_response_header(response_t* response, char** buffer) {
-    static const char* HEADER_FMT = "%s: %s\r\n";
-    static const char* RESPONSE_HEADER_FMT = "HTTP/1.0 %d %s\r\n%s\r\n";
+void __allocate_buffer_for_response(connection_t* conn) {
+    // bodies are sent from where they live and never touch conn->buf, so the
+    // room it grew to for the request goes back to the budget
+    __connection_release_local_buffer(conn);
+
+    size_t target_size = conn->body_bytes_to_transmit / MIN_SND_CLKS;
+    size_t new_buf_len = MIN(MAX_SND_BUFFER_SIZE, target_size) * 2;
+    size_t snd_buffer_size = socket_snd_buf_size(conn->client_fd);
+
+    if ( new_buf_len > snd_buffer_size ) 
+        __connection_grow_sock_send_buf(conn, snd_buffer_size, new_buf_len - snd_buffer_size);
+}
+
+// Parse the length of the response body and size the buffers used to send it.
+void __connection_begin_response_body(connection_t* conn) {
+    if ( WAS_RESPONSE_BODY_LENGTH_PARSED(conn) ) { return; }
 
-    vector* defined_header_keys = dictionary_keys(response->headers);
-    vector* formatted_headers = string_vector_create();
-    int allocated_space = 1; // allow for NUL-byte at the end
+    size_t content_length = conn->response->content_length;
+    conn->body_bytes_to_transmit = content_length == SIZE_MAX ? 0 : content_length;
 
-    for (size_t i = 0; i < vector_size(defined_header_keys); ++i) {
-        char* key = vector_get(defined_header_keys, i);
-        char* value = dictionary_get(response->headers, key);
-        char* buffer = NULL;
-        allocated_space += asprintf(&buffer, HEADER_FMT, key, value);
+    __allocate_buffer_for_response(conn);
+    SET_RESPONSE_BODY_LENGTH_PARSED(conn);
+#ifndef __SKIP_LOG_REQUESTS__
+    clock_gettime(CLOCK_REALTIME, &conn->time_begin_send);
+#endif
+}
 
-        vector_push_back(formatted_headers, buffer);
-        free(buffer);
-    }
+// Write a built-in response straight from its preserialized bytes, splicing in
+// the cached Date header value.
+void __connection_write_preserialized_response(connection_t* connection) {
+    const preserialized_response_t* preserialized = connection->response->preserialized;
+    __connection_begin_response_body(connection);
 
-    char* joined_headers = calloc(1, allocated_space);
-    for (size_t i = 0; i < vector_size(formatted_headers); ++i)
-        strcat(joined_headers, vector_get(formatted_headers, i));
-    
-    strcat(joined_headers, "\0");
+    size_t date_len;
+    const char* date = cached_time_str(&date_len);
+    size_t header_len = 
+        preserialized->len + date_len - connection->body_bytes_to_transmit;
 
-    const char* status_str = http_status_to_string(response->status);
-    int ret = asprintf(
-        buffer, RESPONSE_HEADER_FMT, 
-        response->status, status_str, joined_headers
-    );
-    
-    vector_destroy(defined_header_keys);
-    vector_destroy(formatted_headers);
-    free(joined_headers);
+    struct iovec iov[3] = {
+        { preserialized->bytes, preserialized->date_offset },
+        { (void*) date, date_len },
+        { preserialized->bytes + preserialized->date_offset, 
+            preserialized->len - preserialized->date_offset }
+    };
 
-    return ret;
+    ssize_t bytes_sent = sendmsg_all_to_socket(connection->client_fd, iov, 3, 0);
+    if ( bytes_sent > (ssize_t) header_len )
+        connection->body_bytes_transmitted = bytes_sent - header_len;
+
+    connection->state = CS_WRITING_RESPONSE_BODY;
 }
 
-void connection_write_response_header(connection_t* connection) {
-#ifndef __DISABLE_HANDLE_IF_MODIFIED_SINCE__
-    // only do this if response is a file
-    static char* IF_MODIFIED_SINCE_HEADER_KEY = "If-Modified-Since";
+#ifdef ZEROCOPY_ENABLED
+// Check if the rest of the body should go out with MSG_ZEROCOPY, turning it on
+// for the socket the first time.
+static int __connection_should_zerocopy(connection_t* conn) {
+    if ( conn->response->rt != RT_STRING ) { return 0; }
+    if ( conn->body_bytes_to_transmit - conn->body_bytes_transmitted < ZEROCOPY_MIN_SIZE )
+        return 0;
 
-    dictionary* request_headers = connection->request->headers;
-    char* target = NULL;
+    if ( !IS_ZEROCOPY(conn) && !enable_socket_zerocopy(conn->client_fd) )
+        SET_ZEROCOPY(conn);
 
-    if ( dictionary_contains(request_headers, IF_MODIFIED_SINCE_HEADER_KEY))
-        target = dictionary_get(request_headers, IF_MODIFIED_SINCE_HEADER_KEY);
+    return IS_ZEROCOPY(conn);
+}
 
-    response_try_optimize_if_not_modified_since(&connection->response, target);
+int connection_reap_zerocopy(connection_t* conn) {
+    if ( conn->zerocopy_completed == conn->zerocopy_sends ) { return 0; }
+
+    ssize_t completed = reap_zerocopy_completions(conn->client_fd);
+    if ( completed < 0 ) { return -1; }
+
+    conn->zerocopy_completed += completed;
+    return conn->zerocopy_sends - conn->zerocopy_completed;
+}
 #endif
 
-    char* header_str = NULL;
-    int header_len = __format_response_header(connection->response, &header_str);
-    
-    write_all_to_socket(connection->client_fd, header_str, header_len);
-    free(header_str);
-    
-    connection->state = CS_WRITING_RESPONSE_BODY;
+// Trim a list of body segments to at most limit bytes. Returns how many of
+// them are left.
+static int __connection_limit_iovec(struct iovec* iov, int iovcnt, size_t limit) {
+    for (int i = 0; i < iovcnt; ++i) {
+        if ( iov[i].iov_len >= limit ) {
+            iov[i].iov_len = limit;
+            return i + 1;
+        }
+
+        limit -= iov[i].iov_len;
+    }
+
+    return iovcnt;
 }
 
-void __allocate_buffer_for_response(connection_t* conn) {
-    size_t target_size = conn->body_bytes_to_transmit / MIN_SND_CLKS;
-    size_t new_buf_len = MIN(MAX_SND_BUFFER_SIZE, target_size);
+void connection_write_response_header(connection_t* connection) {
+#ifndef __DISABLE_COMPRESSION__
+    static char* ACCEPT_ENCODING_HEADER_KEY = "Accept-Encoding";
+    char* accept_encoding = NULL;
 
-    __connection_resize_local_buffer(conn, new_buf_len);
+    if ( dictionary_contains(connection->request->headers, ACCEPT_ENCODING_HEADER_KEY) )
+        accept_encoding = dictionary_get(connection->request->headers, ACCEPT_ENCODING_HEADER_KEY);
 
-    new_buf_len *= 2;
-    size_t snd_buffer_size = socket_snd_buf_size(conn->client_fd);
+    const char* coding = response_negotiate_coding(connection->response, accept_encoding);
+#endif
 
-    if ( new_buf_len > snd_buffer_size ) 
-        __connection_resize_sock_send_buf(conn, new_buf_len);
+#ifndef __DISABLE_HANDLE_IF_MODIFIED_SINCE__
+    // this runs before compression so that a 304 never compresses its body
+    response_try_optimize_not_modified(&connection->response, connection->request);
+#endif
+
+#ifndef __DISABLE_COMPRESSION__
+    response_try_compress(connection->response, coding);
+#endif
+
+#ifndef __DISABLE_RANGE_REQUESTS__
+    response_try_apply_range(&connection->response, connection->request);
+#endif
+
+    response_t* response = connection->response;
+    if ( response->preserialized ) {
+        __connection_write_preserialized_response(connection);
+        return;
+    }
+
+    // the header is serialized into a static buffer since it is always sent
+    // (or given up on) before the next connection is served
+    static char header_buf[RESPONSE_HEADER_BUFFER_SIZE];
+
+    char* header_str = header_buf;
+    size_t header_len = response_format_header(response, header_buf, sizeof(header_buf));
+
+    if ( header_len > sizeof(header_buf) ) {
+        header_str = malloc(header_len);
+        response_format_header(response, header_str, header_len);
+    }
+
+    if ( response->rt == RT_EVENT_STREAM ) {
+        write_all_to_socket(connection->client_fd, header_str, header_len);
+        if ( header_str != header_buf ) { free(header_str); }
+        sse_subscribe(connection);
+        return;
+    }
+
+    __connection_begin_response_body(connection);
+
+    struct iovec iov[1 + MAX_BODY_IOVECS] = { { header_str, header_len } };
+    int iovcnt = 1;
+    int flags = 0;
+
+#ifdef ZEROCOPY_ENABLED
+    if ( __connection_should_zerocopy(connection) ) {
+        // the header is copied as usual and the body follows it zero-copy
+        flags = MSG_MORE;
+    } else
+#endif
+    if ( response->rt == RT_STRING ) {
+        // the header and body leave in one syscall (and usually one segment)
+        iov[1].iov_base = (void*) (response->body_content.body + response->body_offset);
+        iov[1].iov_len = MIN(MAX_BYTES_PER_EVENT, connection->body_bytes_to_transmit);
+        iovcnt = 2;
+    } else if ( response->rt == RT_IOVEC ) {
+        iovcnt += __connection_limit_iovec(iov + 1, 
+            response_body_iovec(response, 0, iov + 1, MAX_BODY_IOVECS), MAX_BYTES_PER_EVENT);
+    }
+#if defined(MSG_MORE)
+    else if ( response->rt == RT_FILE && connection->body_bytes_to_transmit ) {
+        // hold the header back so it shares a segment with the start of the
+        // file, which sendfile pushes right after
+        flags = MSG_MORE;
+    }
+#endif
+
+    ssize_t bytes_sent = sendmsg_all_to_socket(connection->client_fd, iov, iovcnt, flags);
+    if ( bytes_sent > (ssize_t) header_len )
+        connection->body_bytes_transmitted = bytes_sent - header_len;
+
+    if ( header_str != header_buf ) { free(header_str); }
+    connection->state = CS_WRITING_RESPONSE_BODY;
 }
 
 // @return -1 if there was an error, 1 if the request is ongoing, 0 if the request is complete
-int connection_try_send_response_body(connection_t* conn, size_t max_receivable) {
+int connection_try_send_response_body(connection_t* conn) {
     /// @todo handle RT_EMPTY
     response_t* response = conn->response;
 
-    if ( !WAS_RESPONSE_BODY_LENGTH_PARSED(conn) ) {
-        sscanf(
-            dictionary_get(response->headers, CONTENT_LENGTH_HEADER_KEY), 
-            "%zu", &conn->body_bytes_to_transmit
-        );
-
-        __allocate_buffer_for_response(conn);
-        SET_RESPONSE_BODY_LENGTH_PARSED(conn);
-#ifndef __SKIP_LOG_REQUESTS__
-        clock_gettime(CLOCK_REALTIME, &conn->time_begin_send);
-#endif
-    }
+    __connection_begin_response_body(conn);
 
-    if ( response->rt == RT_EMPTY )
+    if ( response->rt == RT_EMPTY 
+            || conn->body_bytes_transmitted == conn->body_bytes_to_transmit )
         return 0;
 
-    size_t to_send = conn->body_bytes_to_transmit - conn->body_bytes_transmitted;
-    to_send = MIN(to_send, MIN(conn->buf_size, max_receivable));
+    __connection_reclaim_sock_send_buf(conn);
+
+    // the body goes out until the socket is full or the connection has used up
+    // its budget for this event, whichever comes first
+    size_t to_send = MIN(MAX_BYTES_PER_EVENT, 
+        conn->body_bytes_to_transmit - conn->body_bytes_transmitted);
+    ssize_t return_code = 0;
 
     if ( response->rt == RT_FILE ) {
-        fread(conn->buf, sizeof(char), to_send, response->body_content.file);
+        // sendfile takes an explicit offset, so a send cut short by EAGAIN
+        // resumes exactly where it stopped on the next event
+        return_code = sendfile_to_socket(
+            conn->client_fd, fileno(response->body_content.file),
+            response->body_offset + conn->body_bytes_transmitted, to_send
+        );
     } else if ( response->rt == RT_STRING ) {
-        const char* snd_buf = 
-            response->body_content.body + conn->body_bytes_transmitted;
-        memcpy(conn->buf, snd_buf, to_send);
+        // the body is immutable until the response is destroyed, so it is
+        // written straight from where it lives until the socket is full
+        const char* snd_buf = response->body_content.body 
+            + response->body_offset + conn->body_bytes_transmitted;
+#ifdef ZEROCOPY_ENABLED
+        if ( __connection_should_zerocopy(conn) )
+            return_code = zerocopy_write_to_socket(
+                conn->client_fd, snd_buf, to_send, &conn->zerocopy_sends);
+        else
+#endif
+        return_code = write_all_to_socket(conn->client_fd, snd_buf, to_send);
+    } else if ( response->rt == RT_IOVEC ) {
+        // the segments are mapped again from wherever the last send stopped
+        struct iovec iov[MAX_BODY_IOVECS];
+        int iovcnt = response_body_iovec(response, conn->body_bytes_transmitted, 
+            iov, MAX_BODY_IOVECS);
+        iovcnt = __connection_limit_iovec(iov, iovcnt, to_send);
+        return_code = sendmsg_all_to_socket(conn->client_fd, iov, iovcnt, 0);
     }
     
-    ssize_t return_code = 
-        write_all_to_socket(conn->client_fd, conn->buf, to_send);
-    
     if (return_code < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             LOG("(fd=%d) write_all_to_socket() returned with code -1 and EAGAIN/EWOULDBLOCK", conn->client_fd);
@@ -394,8 +701,9 @@ int connection_try_send_response_body(connection_t* conn, size_t max_receivable)
         }
         return -1;
     } else if (return_code == 0) {
+        // the socket is full; the rest goes out on the next writable event
         LOG("(fd=%d) write_all_to_socket() returned with code 0", conn->client_fd);
-        return 0;
+        return 1;
     } 
 
     conn->body_bytes_transmitted += return_code;
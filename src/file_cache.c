@@ -0,0 +1,148 @@
+#include "file_cache.h"
+#include "dictionary.h"
+
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define DEFAULT_DICT_CAPACITY 16
+#define NS_PER_MS 1000000L
+#define MS_PER_SECOND 1000L
+
+static dictionary* entries = NULL; // (char*) -> (file_cache_entry_t*)
+static lru_list_t lru = { NULL, NULL };
+static size_t bytes_cached = 0;
+
+static inline long __file_cache_elapsed_ms(
+        const struct timespec* start, const struct timespec* finish) {
+    return (finish->tv_sec - start->tv_sec) * MS_PER_SECOND 
+        + (finish->tv_nsec - start->tv_nsec) / NS_PER_MS;
+}
+
+static void __file_cache_evict(file_cache_entry_t* entry) {
+    lru_unlink(&lru, &entry->node);
+    dictionary_remove(entries, entry->path);
+
+    if ( entry->contents ) {
+        bytes_cached -= entry->contents->len;
+        refbuf_release(entry->contents);
+    }
+
+    free(entry->path);
+    free(entry);
+}
+
+// Read a whole file into a refbuf. Returns NULL if it could not be read or has
+// changed size since it was stat'd.
+static refbuf_t* __file_cache_read(const char* path, const struct stat* info) {
+    int fd = open(path, O_RDONLY);
+    if ( fd == -1 ) { return NULL; }
+
+    refbuf_t* contents = refbuf_create(NULL, (size_t) info->st_size);
+    size_t total = 0;
+
+    while ( total < contents->len ) {
+        ssize_t bytes_read = pread(fd, contents->data + total, contents->len - total, total);
+        if ( bytes_read == -1 && errno == EINTR ) { continue; }
+        if ( bytes_read <= 0 ) { break; }
+        total += bytes_read;
+    }
+
+    close(fd);
+    if ( total != contents->len ) {
+        refbuf_release(contents);
+        return NULL;
+    }
+
+    return contents;
+}
+
+// Load the file described by info into entry, replacing anything it held.
+static int __file_cache_load(file_cache_entry_t* entry, const struct stat* info) {
+    refbuf_t* contents = __file_cache_read(entry->path, info);
+    if ( !contents ) { return -1; }
+
+    if ( entry->contents ) {
+        bytes_cached -= entry->contents->len;
+        refbuf_release(entry->contents);
+    }
+
+    entry->contents = contents;
+    entry->mtime = info->st_mtime;
+    entry->ino = info->st_ino;
+    bytes_cached += contents->len;
+
+    format_time(entry->last_modified, entry->mtime);
+    format_etag(entry->etag, entry->ino, entry->mtime, contents->len);
+
+    // make room for the new contents, never evicting the entry itself
+    while ( bytes_cached > FILE_CACHE_MAX_BYTES && lru.least_recent != &entry->node )
+        __file_cache_evict((file_cache_entry_t*) lru.least_recent);
+
+    return 0;
+}
+
+static inline int __file_cache_is_stale(
+        const file_cache_entry_t* entry, const struct stat* info) {
+    return entry->mtime != info->st_mtime || entry->ino != info->st_ino 
+        || entry->contents->len != (size_t) info->st_size;
+}
+
+const file_cache_entry_t* file_cache_get(const char* path) {
+    if ( !entries ) {
+        entries = dictionary_create_with_capacity(
+            DEFAULT_DICT_CAPACITY, string_hash_function, string_compare,
+            string_copy_constructor, string_destructor,
+            lru_shallow_copy, lru_shallow_destroy
+        );
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    file_cache_entry_t* entry = NULL;
+    if ( dictionary_contains(entries, (void*) path) ) {
+        entry = dictionary_get(entries, (void*) path);
+        lru_touch(&lru, &entry->node);
+
+        if ( __file_cache_elapsed_ms(&entry->validated, &now) < FILE_CACHE_REVALIDATE_MS )
+            return entry;
+    }
+
+    struct stat info;
+    if ( stat(path, &info) == -1 || !S_ISREG(info.st_mode) 
+            || (size_t) info.st_size > FILE_CACHE_MAX_FILE_SIZE ) {
+        if ( entry ) { __file_cache_evict(entry); }
+        return NULL;
+    }
+
+    if ( entry ) {
+        entry->validated = now;
+        if ( !__file_cache_is_stale(entry, &info) ) { return entry; }
+    } else {
+        entry = calloc(1, sizeof(file_cache_entry_t));
+        entry->path = strdup(path);
+        entry->validated = now;
+        dictionary_set(entries, entry->path, entry);
+        lru_push_front(&lru, &entry->node);
+    }
+
+    if ( __file_cache_load(entry, &info) == -1 ) {
+        __file_cache_evict(entry);
+        return NULL;
+    }
+
+    return entry;
+}
+
+void file_cache_clear(void) {
+    while ( lru.least_recent )
+        __file_cache_evict((file_cache_entry_t*) lru.least_recent);
+
+    if ( entries ) {
+        dictionary_destroy(entries);
+        entries = NULL;
+    }
+}
@@ -3,6 +3,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <string.h>
 #include <stdio.h>
 #include <err.h>
 
@@ -16,19 +17,58 @@ typedef struct timespec timespec;
 static FILE* log_file = NULL;
 #endif 
 
+static time_t cached_second = 0;
+static char cached_time_buf[TIME_BUFFER_SIZE] = { 0 };
+static size_t cached_time_len = 0;
+
 void format_time(char* buf, time_t time) {
     struct tm gmt;
     strftime(buf, TIME_BUFFER_SIZE, TIME_FMT_GMT, gmtime_r(&time, &gmt));
 }
 
+void refresh_cached_time(void) {
+    time_t now = time(NULL);
+    if ( now == cached_second && cached_time_len )
+        return;
+
+    struct tm gmt;
+    cached_second = now;
+    cached_time_len = strftime(
+        cached_time_buf, TIME_BUFFER_SIZE, TIME_FMT_GMT, gmtime_r(&now, &gmt));
+}
+
+time_t cached_time(void) {
+    if ( !cached_time_len )
+        refresh_cached_time();
+
+    return cached_second;
+}
+
+const char* cached_time_str(size_t* len) {
+    if ( !cached_time_len )
+        refresh_cached_time();
+
+    *len = cached_time_len;
+    return cached_time_buf;
+}
+
 void format_current_time(char* buf) {
-    format_time(buf, time(NULL));
+    size_t len;
+    const char* str = cached_time_str(&len);
+    memcpy(buf, str, len + 1);
 }
 
 time_t parse_time_str(const char* time_buf) {
-    struct tm gmt;
-    strptime(time_buf, TIME_FMT_TZ, &gmt);
-    return mktime(&gmt);
+    struct tm gmt = { 0 };
+    if ( !strptime(time_buf, TIME_FMT_GMT, &gmt) ) { return (time_t) -1; }
+
+    // the date is in GMT, so it must not be shifted by the local time zone
+    return timegm(&gmt);
+}
+
+void format_etag(char* buf, ino_t ino, time_t mtime, size_t size) {
+    snprintf(buf, ETAG_BUFFER_SIZE, "\"%lx-%lx-%zx\"", 
+        (unsigned long) ino, (unsigned long) mtime, size);
 }
 
 #ifndef __SKIP_LOG_REQUESTS__
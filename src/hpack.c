@@ -0,0 +1,434 @@
+#include "hpack.h"
+#include "format.h"
+
+#include <strings.h>
+#include <string.h>
+
+#define HUFFMAN_EOS 256
+#define HUFFMAN_MAX_CODE_LENGTH 30
+
+typedef struct _hpack_static_entry {
+    const char* name;
+    const char* value;
+} hpack_static_entry_t;
+
+// RFC 7541 Appendix A
+static const hpack_static_entry_t STATIC_TABLE[HPACK_STATIC_TABLE_LENGTH] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+};
+
+// The HPACK Huffman code (RFC 7541 Appendix B) is canonical, so the code 
+// lengths of all 257 symbols are enough to reconstruct every code.
+static const uint8_t HUFFMAN_CODE_LENGTHS[HUFFMAN_EOS + 1] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+     5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+    13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+     7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+    15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+     6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+// Canonical decoding tables, filled in on first use
+static uint32_t huffman_first_code[HUFFMAN_MAX_CODE_LENGTH + 1];
+static uint16_t huffman_count[HUFFMAN_MAX_CODE_LENGTH + 1];
+static uint16_t huffman_offset[HUFFMAN_MAX_CODE_LENGTH + 1];
+static uint16_t huffman_symbols[HUFFMAN_EOS + 1];
+static int huffman_initialized = 0;
+
+void __hpack_huffman_init(void) {
+    for (size_t sym = 0; sym <= HUFFMAN_EOS; ++sym)
+        ++huffman_count[HUFFMAN_CODE_LENGTHS[sym]];
+
+    // codes of each length start right after the last code of the previous 
+    // length, shifted over by one bit
+    uint32_t code = 0;
+    uint16_t offset = 0;
+    for (size_t len = 1; len <= HUFFMAN_MAX_CODE_LENGTH; ++len) {
+        code = (code + huffman_count[len - 1]) << 1;
+        huffman_first_code[len] = code;
+        huffman_offset[len] = offset;
+        offset += huffman_count[len];
+    }
+
+    uint16_t next[HUFFMAN_MAX_CODE_LENGTH + 1];
+    memcpy(next, huffman_offset, sizeof(next));
+    for (size_t sym = 0; sym <= HUFFMAN_EOS; ++sym)
+        huffman_symbols[next[HUFFMAN_CODE_LENGTHS[sym]]++] = sym;
+
+    huffman_initialized = 1;
+}
+
+ssize_t hpack_huffman_decode(const uint8_t* in, size_t len, char* out) {
+    if ( !huffman_initialized )
+        __hpack_huffman_init();
+
+    char* out_start = out;
+    uint32_t code = 0;
+    size_t code_len = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((in[i] >> bit) & 1);
+            if ( ++code_len > HUFFMAN_MAX_CODE_LENGTH )
+                return -1;
+
+            uint32_t idx = code - huffman_first_code[code_len];
+            if ( idx < huffman_count[code_len] ) {
+                uint16_t sym = huffman_symbols[huffman_offset[code_len] + idx];
+                if ( sym == HUFFMAN_EOS ) { return -1; }
+
+                *out++ = (char) sym;
+                code = 0;
+                code_len = 0;
+            }
+        }
+    }
+
+    // whatever is left over must be padding: a prefix of EOS (all ones) that 
+    // is shorter than 8 bits
+    if ( code_len > 7 || code != (1U << code_len) - 1 )
+        return -1;
+
+    return out - out_start;
+}
+
+void hpack_table_init(hpack_table_t* table, size_t max_size) {
+    table->capacity = max_size / HPACK_ENTRY_OVERHEAD + 1;
+    table->entries = calloc(table->capacity, sizeof(hpack_entry_t));
+    table->head = 0;
+    table->length = 0;
+    table->size = 0;
+    table->max_size = max_size;
+    table->settings_max_size = max_size;
+}
+
+static inline size_t __hpack_entry_size(hpack_entry_t* entry) {
+    return entry->name_len + entry->value_len + HPACK_ENTRY_OVERHEAD;
+}
+
+void __hpack_table_evict(hpack_table_t* table) {
+    size_t tail = (table->head + table->length - 1) % table->capacity;
+    hpack_entry_t* entry = table->entries + tail;
+
+    table->size -= __hpack_entry_size(entry);
+    free(entry->name);
+    --table->length;
+}
+
+void hpack_table_destroy(hpack_table_t* table) {
+    while ( table->length )
+        __hpack_table_evict(table);
+
+    free(table->entries);
+}
+
+void __hpack_table_resize(hpack_table_t* table, size_t max_size) {
+    table->max_size = max_size;
+    while ( table->size > table->max_size )
+        __hpack_table_evict(table);
+}
+
+void __hpack_table_insert(hpack_table_t* table, const char* name, 
+        size_t name_len, const char* value, size_t value_len) {
+    // copy first since name may point into an entry that is about to be evicted
+    hpack_entry_t entry = { 0 };
+    entry.name = malloc(name_len + value_len + 2);
+    entry.value = entry.name + name_len + 1;
+    entry.name_len = name_len;
+    entry.value_len = value_len;
+    memcpy(entry.name, name, name_len);
+    entry.name[name_len] = '\0';
+    memcpy(entry.value, value, value_len);
+    entry.value[value_len] = '\0';
+
+    size_t entry_size = __hpack_entry_size(&entry);
+    while ( table->length && table->size + entry_size > table->max_size )
+        __hpack_table_evict(table);
+
+    // an entry larger than the whole table just empties it
+    if ( entry_size > table->max_size ) {
+        free(entry.name);
+        return;
+    }
+
+    table->head = (table->head + table->capacity - 1) % table->capacity;
+    table->entries[table->head] = entry;
+    table->size += entry_size;
+    ++table->length;
+}
+
+int __hpack_table_lookup(hpack_table_t* table, uint32_t index, 
+        const char** name, size_t* name_len, const char** value, size_t* value_len) {
+    if ( index == 0 ) {
+        return -1;
+    } else if ( index <= HPACK_STATIC_TABLE_LENGTH ) {
+        const hpack_static_entry_t* entry = STATIC_TABLE + index - 1;
+        *name = entry->name;
+        *name_len = strlen(entry->name);
+        *value = entry->value;
+        *value_len = strlen(entry->value);
+        return 0;
+    }
+
+    index -= HPACK_STATIC_TABLE_LENGTH + 1;
+    if ( index >= table->length ) { return -1; }
+
+    hpack_entry_t* entry = 
+        table->entries + (table->head + index) % table->capacity;
+    *name = entry->name;
+    *name_len = entry->name_len;
+    *value = entry->value;
+    *value_len = entry->value_len;
+    return 0;
+}
+
+// Decode an integer with an N-bit prefix (RFC 7541 5.1).
+int __hpack_decode_int(const uint8_t** pos, const uint8_t* end, 
+        size_t prefix_bits, uint32_t* out) {
+    if ( *pos >= end ) { return -1; }
+
+    uint32_t max_prefix = (1U << prefix_bits) - 1;
+    uint64_t value = *(*pos)++ & max_prefix;
+    if ( value < max_prefix ) {
+        *out = value;
+        return 0;
+    }
+
+    for (size_t shift = 0; *pos < end && shift <= 28; shift += 7) {
+        uint8_t byte = *(*pos)++;
+        value += (uint64_t) (byte & 0x7f) << shift;
+
+        if ( value > UINT32_MAX ) { return -1; }
+        if ( !(byte & 0x80) ) {
+            *out = value;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Decode a string literal (RFC 7541 5.2) into out and NUL-terminate it.
+ssize_t __hpack_decode_string(const uint8_t** pos, const uint8_t* end, char* out) {
+    if ( *pos >= end ) { return -1; }
+
+    int is_huffman = **pos & 0x80;
+    uint32_t len = 0;
+    if ( __hpack_decode_int(pos, end, 7, &len) || len > (size_t) (end - *pos) )
+        return -1;
+
+    ssize_t out_len = len;
+    if ( is_huffman )
+        out_len = hpack_huffman_decode(*pos, len, out);
+    else
+        memcpy(out, *pos, len);
+
+    *pos += len;
+    if ( out_len >= 0 )
+        out[out_len] = '\0';
+
+    return out_len;
+}
+
+int hpack_decode(hpack_table_t* table, const uint8_t* block, size_t len,
+        hpack_header_callback_t callback, void* ctx) {
+    const uint8_t* pos = block;
+    const uint8_t* end = block + len;
+
+    // a decoded string is never longer than 8/5 of its encoded length
+    size_t scratch_len = len * 8 / 5 + 1;
+    char* name_buf = malloc(2 * scratch_len);
+    char* value_buf = name_buf + scratch_len;
+
+    while ( pos < end ) {
+        uint8_t byte = *pos;
+        uint32_t index = 0;
+        const char* name = NULL;
+        const char* value = NULL;
+        size_t name_len = 0;
+        size_t value_len = 0;
+
+        if ( byte & 0x80 ) { // indexed header field
+            if ( __hpack_decode_int(&pos, end, 7, &index) 
+                    || __hpack_table_lookup(table, index, &name, &name_len, &value, &value_len) )
+                goto error;
+
+            callback(ctx, name, name_len, value, value_len);
+            continue;
+        } else if ( (byte & 0xe0) == 0x20 ) { // dynamic table size update
+            if ( __hpack_decode_int(&pos, end, 5, &index) 
+                    || index > table->settings_max_size )
+                goto error;
+
+            __hpack_table_resize(table, index);
+            continue;
+        }
+
+        // literal header field, either with incremental indexing (6-bit 
+        // prefix), or without indexing / never indexed (4-bit prefix)
+        int add_to_table = (byte & 0xc0) == 0x40;
+        if ( __hpack_decode_int(&pos, end, add_to_table ? 6 : 4, &index) )
+            goto error;
+
+        if ( index ) {
+            if ( __hpack_table_lookup(table, index, &name, &name_len, &value, &value_len) )
+                goto error;
+        } else {
+            ssize_t ret = __hpack_decode_string(&pos, end, name_buf);
+            if ( ret < 0 ) { goto error; }
+            name = name_buf;
+            name_len = ret;
+        }
+
+        ssize_t ret = __hpack_decode_string(&pos, end, value_buf);
+        if ( ret < 0 ) { goto error; }
+        value = value_buf;
+        value_len = ret;
+
+        callback(ctx, name, name_len, value, value_len);
+        if ( add_to_table )
+            __hpack_table_insert(table, name, name_len, value, value_len);
+    }
+
+    free(name_buf);
+    return 0;
+
+error:
+    LOG("hpack: malformed header block");
+    free(name_buf);
+    return -1;
+}
+
+// Encode an integer with an N-bit prefix, OR'ing flags into the first byte.
+size_t __hpack_encode_int(uint8_t* out, uint32_t value, size_t prefix_bits, uint8_t flags) {
+    uint32_t max_prefix = (1U << prefix_bits) - 1;
+    if ( value < max_prefix ) {
+        *out = flags | value;
+        return 1;
+    }
+
+    size_t len = 0;
+    out[len++] = flags | max_prefix;
+    value -= max_prefix;
+    while ( value >= 0x80 ) {
+        out[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+
+    return len;
+}
+
+size_t hpack_encode_status(uint8_t* out, int status) {
+    static const uint32_t STATUS_NAME_INDEX = 8;
+
+    // statuses that have a fully indexed entry in the static table
+    for (uint32_t i = STATUS_NAME_INDEX; i < STATUS_NAME_INDEX + 7; ++i) {
+        if ( atoi(STATIC_TABLE[i - 1].value) == status ) {
+            *out = 0x80 | i;
+            return 1;
+        }
+    }
+
+    size_t len = __hpack_encode_int(out, STATUS_NAME_INDEX, 4, 0x00);
+    len += __hpack_encode_int(out + len, 3, 7, 0x00);
+    len += sprintf((char*) out + len, "%03d", status % 1000);
+    return len;
+}
+
+size_t hpack_encode_header(uint8_t* out, const char* name, size_t name_len,
+        const char* value, size_t value_len) {
+    uint32_t name_index = 0;
+    for (uint32_t i = 1; i <= HPACK_STATIC_TABLE_LENGTH; ++i) {
+        const char* static_name = STATIC_TABLE[i - 1].name;
+        if ( !strncasecmp(static_name, name, name_len) && !static_name[name_len] ) {
+            name_index = i;
+            break;
+        }
+    }
+
+    size_t len = __hpack_encode_int(out, name_index, 4, 0x00);
+    if ( !name_index ) {
+        len += __hpack_encode_int(out + len, name_len, 7, 0x00);
+        for (size_t i = 0; i < name_len; ++i) {
+            char c = name[i];
+            out[len++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        }
+    }
+
+    len += __hpack_encode_int(out + len, value_len, 7, 0x00);
+    memcpy(out + len, value, value_len);
+
+    return len + value_len;
+}
@@ -0,0 +1,1090 @@
+#include "http2.h"
+#include "multipart.h"
+#include "base64.h"
+#include "format.h"
+#include "route.h"
+#include "static_dir.h"
+#include "compression.h"
+#include "microcache.h"
+#include "range.h"
+
+#include <strings.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// We let every stream (and the connection as a whole) have this many bytes in
+// flight, and top the window back up once half of it has been used.
+#define H2_RECV_WINDOW (1U << 20U)
+
+#define H2_INPUT_BUFFER_SIZE (1UL << 16UL)
+#define H2_INITIAL_OUTPUT_SIZE (1UL << 14UL)
+
+// Stop reading new frames while this much output is waiting on the socket
+#define H2_MAX_PENDING_OUTPUT (1UL << 18UL)
+
+#define H2_MAX_HEADER_BLOCK_SIZE (1UL << 16UL)
+#define H2_MAX_IN_MEMORY_BODY (1UL << 20UL)
+// segments of an RT_IOVEC body gathered into a DATA frame at a time
+#define H2_MAX_BODY_IOVECS 16
+
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+// SETTINGS parameters (RFC 7540 6.5.2)
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+#define H2_SETTING_LENGTH 6
+
+static char* CONTENT_LENGTH_HEADER_KEY = "Content-Length";
+static char* CONTENT_TYPE_HEADER_KEY = "Content-Type";
+static char* HOST_HEADER_KEY = "Host";
+static char* COOKIE_HEADER_KEY = "Cookie";
+static char* UPGRADE_HEADER_KEY = "Upgrade";
+static char* HTTP2_SETTINGS_HEADER_KEY = "HTTP2-Settings";
+
+static const char* HTTP2_PROTOCOL = "HTTP/2.0";
+static const char* UPGRADE_PROTOCOL = "HTTP/1.1";
+static const char* UPGRADE_TOKEN = "h2c";
+
+// Headers that only make sense for a single HTTP/1 connection (RFC 7540 8.1.2.2)
+static const char* CONNECTION_SPECIFIC_HEADERS[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "Transfer-Encoding", "Upgrade"
+};
+
+// This struct is passed to the HPACK decoder while decoding a header block.
+typedef struct _http2_header_ctx {
+    request_t* request;
+    int is_trailer;
+    int has_method;
+    int seen_regular_header;
+    int malformed;
+} http2_header_ctx_t;
+
+static inline uint32_t __read_u32(const uint8_t* p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+        | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline void __write_u32(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static inline size_t __http2_pending_output(http2_session_t* session) {
+    return session->out_len - session->out_ptr;
+}
+
+/// OUTPUT
+
+// Make room for len more bytes at the end of the output buffer.
+uint8_t* __http2_reserve(http2_session_t* session, size_t len) {
+    if ( session->out_len + len <= session->out_size )
+        return session->out_buf + session->out_len;
+
+    // reclaim the space taken by bytes that were already written
+    if ( session->out_ptr ) {
+        memmove(session->out_buf, session->out_buf + session->out_ptr,
+            __http2_pending_output(session));
+        session->out_len -= session->out_ptr;
+        session->out_ptr = 0;
+    }
+
+    if ( session->out_len + len > session->out_size ) {
+        while ( session->out_len + len > session->out_size )
+            session->out_size *= 2;
+        session->out_buf = realloc(session->out_buf, session->out_size);
+    }
+
+    return session->out_buf + session->out_len;
+}
+
+void __http2_write_frame_header(uint8_t* p, size_t len, http2_frame_type_t type,
+        uint8_t flags, uint32_t stream_id) {
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    __write_u32(p + 5, stream_id);
+}
+
+void __http2_queue_frame(http2_session_t* session, http2_frame_type_t type,
+        uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t len) {
+    uint8_t* p = __http2_reserve(session, HTTP2_FRAME_HEADER_LENGTH + len);
+    __http2_write_frame_header(p, len, type, flags, stream_id);
+    if ( len )
+        memcpy(p + HTTP2_FRAME_HEADER_LENGTH, payload, len);
+    session->out_len += HTTP2_FRAME_HEADER_LENGTH + len;
+}
+
+void __http2_queue_window_update(http2_session_t* session, uint32_t stream_id,
+        uint32_t increment) {
+    uint8_t payload[4];
+    __write_u32(payload, increment);
+    __http2_queue_frame(session, H2F_WINDOW_UPDATE, 0, stream_id, payload, 4);
+}
+
+// Queue a GOAWAY frame for a connection error. Always returns -1 so callers can
+// return its result to close the connection.
+int __http2_goaway(http2_session_t* session, http2_error_t code) {
+    uint8_t payload[8];
+    __write_u32(payload, session->last_stream_id);
+    __write_u32(payload + 4, code);
+    __http2_queue_frame(session, H2F_GOAWAY, 0, 0, payload, 8);
+
+    LOG("(fd=%d) HTTP/2 connection error %d", session->conn->client_fd, code);
+    session->goaway = 1;
+    return -1;
+}
+
+// Write as much queued output as the socket accepts. Returns -1 if the socket
+// failed, or 0 otherwise.
+int __http2_flush(http2_session_t* session) {
+    while ( session->out_ptr < session->out_len ) {
+        ssize_t bytes_written = write(
+            session->conn->client_fd, session->out_buf + session->out_ptr,
+            __http2_pending_output(session)
+        );
+
+        if ( bytes_written > 0 ) {
+            session->out_ptr += bytes_written;
+        } else if ( bytes_written < 0 && errno == EINTR ) {
+            continue;
+        } else if ( bytes_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+
+    session->out_ptr = 0;
+    session->out_len = 0;
+    return 0;
+}
+
+/// STREAMS
+
+http2_stream_t* __http2_find_stream(http2_session_t* session, uint32_t id) {
+    for (http2_stream_t* stream = session->streams; stream; stream = stream->next) {
+        if ( stream->id == id ) { return stream; }
+    }
+
+    return NULL;
+}
+
+// Add a stream to the end of the list so responses go out in request order.
+http2_stream_t* __http2_open_stream(http2_session_t* session, uint32_t id, request_t* request) {
+    http2_stream_t* stream = calloc(1, sizeof(http2_stream_t));
+    stream->id = id;
+    stream->request = request;
+    stream->content_length = SIZE_MAX;
+    stream->send_window = session->peer_initial_window;
+    stream->recv_window = H2_RECV_WINDOW;
+    stream->state = H2SS_RECEIVING_BODY;
+#ifndef __SKIP_LOG_REQUESTS__
+    clock_gettime(CLOCK_REALTIME, &stream->time_opened);
+#endif
+
+    http2_stream_t** tail = &session->streams;
+    while ( *tail )
+        tail = &(*tail)->next;
+    *tail = stream;
+
+    ++session->num_streams;
+    return stream;
+}
+
+void __http2_close_stream(http2_session_t* session, http2_stream_t* stream) {
+    http2_stream_t** it = &session->streams;
+    while ( *it != stream )
+        it = &(*it)->next;
+    *it = stream->next;
+    --session->num_streams;
+
+    if ( stream->request )
+        request_destroy(stream->request);
+
+    if ( stream->response )
+        response_destroy(stream->response);
+
+    free(stream);
+}
+
+// Close a stream that delivered its whole response, logging the exchange.
+void __http2_finish_stream(http2_session_t* session, http2_stream_t* stream) {
+#ifndef __SKIP_LOG_REQUESTS__
+    connection_t* conn = session->conn;
+    request_t* request = stream->request;
+    response_t* response = stream->response;
+
+    print_client_request_resolution(
+        conn->client_address, conn->client_port,
+        http_method_to_string(request->method), request->path,
+        request->protocol, conn->client_fd, response->status,
+        http_status_to_string(response->status), stream->body_bytes_received,
+        stream->body_bytes_transmitted, &stream->time_opened,
+        &stream->time_received, &stream->time_begin_send
+    );
+#endif
+    __http2_close_stream(session, stream);
+}
+
+// Reset a stream for a stream error. The stream may already be gone.
+void __http2_reset_stream(http2_session_t* session, uint32_t id, http2_error_t code) {
+    uint8_t payload[4];
+    __write_u32(payload, code);
+    __http2_queue_frame(session, H2F_RST_STREAM, 0, id, payload, 4);
+
+    http2_stream_t* stream = __http2_find_stream(session, id);
+    if ( stream )
+        __http2_close_stream(session, stream);
+}
+
+/// RESPONSES
+
+int __http2_is_connection_specific_header(const char* key) {
+    size_t n = sizeof(CONNECTION_SPECIFIC_HEADERS) / sizeof(CONNECTION_SPECIFIC_HEADERS[0]);
+    for (size_t i = 0; i < n; ++i) {
+        if ( !strcasecmp(key, CONNECTION_SPECIFIC_HEADERS[i]) ) { return 1; }
+    }
+
+    return 0;
+}
+
+// This struct is the state of __http2_send_response_headers while it encodes
+// a header block.
+typedef struct _http2_header_block {
+    uint8_t* block;  // NULL while measuring the header block
+    size_t len;
+} http2_header_block_t;
+
+void __http2_encode_response_header(void* ctx, const char* key, size_t key_len,
+        const char* value, size_t value_len) {
+    http2_header_block_t* hb = ctx;
+    if ( __http2_is_connection_specific_header(key) ) { return; }
+
+    if ( hb->block )
+        hb->len += hpack_encode_header(hb->block + hb->len, key, key_len, value, value_len);
+    else
+        hb->len += HPACK_MAX_ENCODED_LENGTH(key_len, value_len);
+}
+
+// Queue the response headers as a HEADERS frame, followed by CONTINUATION
+// frames if the header block does not fit in a single frame.
+void __http2_send_response_headers(http2_session_t* session, http2_stream_t* stream) {
+    response_t* response = stream->response;
+
+    http2_header_block_t hb = { NULL, HPACK_MAX_ENCODED_LENGTH(0, 3) };
+    response_for_each_header(response, __http2_encode_response_header, &hb);
+
+    hb.block = malloc(hb.len);
+    hb.len = hpack_encode_status(hb.block, response->status);
+    response_for_each_header(response, __http2_encode_response_header, &hb);
+
+    uint8_t* block = hb.block;
+    size_t block_len = hb.len;
+
+    if ( response->content_length != SIZE_MAX )
+        stream->body_bytes_to_transmit = response->content_length;
+
+    int end_stream = response->rt == RT_EMPTY
+        || stream->request->method == HTTP_HEAD
+        || stream->body_bytes_to_transmit == 0;
+
+    size_t offset = 0;
+    do {
+        size_t chunk = MIN(block_len - offset, session->peer_max_frame_size);
+        http2_frame_type_t type = offset ? H2F_CONTINUATION : H2F_HEADERS;
+        uint8_t flags = 0;
+
+        if ( offset + chunk == block_len )
+            flags |= H2_FLAG_END_HEADERS;
+        if ( !offset && end_stream )
+            flags |= H2_FLAG_END_STREAM;
+
+        __http2_queue_frame(session, type, flags, stream->id, block + offset, chunk);
+        offset += chunk;
+    } while ( offset < block_len );
+
+    free(block);
+
+#ifndef __SKIP_LOG_REQUESTS__
+    clock_gettime(CLOCK_REALTIME, &stream->time_begin_send);
+#endif
+
+    if ( end_stream ) {
+        __http2_finish_stream(session, stream);
+    } else {
+        stream->state = H2SS_SENDING_BODY;
+    }
+}
+
+// Run the route handler for a stream whose request has been fully received.
+void __http2_dispatch(http2_session_t* session, http2_stream_t* stream) {
+    request_t* request = stream->request;
+    response_t* response = NULL;
+
+#ifndef __SKIP_LOG_REQUESTS__
+    clock_gettime(CLOCK_REALTIME, &stream->time_received);
+#endif
+
+    if ( request_finish_body(request) ) {
+        response = response_bad_request(NULL);
+    } else {
+        response = static_dir_try_serve(request);
+        if ( !response )
+#ifndef __DISABLE_MICROCACHE__
+            response = microcache_serve(request);
+#else
+            response = find_request_handler(request, NULL)(request);
+#endif
+
+        // an event stream holds on to a whole HTTP/1 connection
+        if ( response->rt == RT_EVENT_STREAM ) {
+            response_destroy(response);
+            response = response_empty(STATUS_HTTP_VERSION_NOT_SUPPORTED);
+        }
+    }
+
+#ifndef __DISABLE_COMPRESSION__
+    static char* ACCEPT_ENCODING_HEADER_KEY = "Accept-Encoding";
+    char* accept_encoding = NULL;
+
+    if ( dictionary_contains(request->headers, ACCEPT_ENCODING_HEADER_KEY) )
+        accept_encoding = dictionary_get(request->headers, ACCEPT_ENCODING_HEADER_KEY);
+
+    const char* coding = response_negotiate_coding(response, accept_encoding);
+#endif
+
+#ifndef __DISABLE_HANDLE_IF_MODIFIED_SINCE__
+    response_try_optimize_not_modified(&response, request);
+#endif
+
+#ifndef __DISABLE_COMPRESSION__
+    response_try_compress(response, coding);
+#endif
+
+#ifndef __DISABLE_RANGE_REQUESTS__
+    response_try_apply_range(&response, request);
+#endif
+
+    stream->response = response;
+    __http2_send_response_headers(session, stream);
+}
+
+// Gather len bytes of an RT_IOVEC body, starting offset bytes into what is sent
+static void __http2_copy_segments(response_t* response, size_t offset, uint8_t* dest, size_t len) {
+    struct iovec iov[H2_MAX_BODY_IOVECS];
+
+    while ( len ) {
+        int iovcnt = response_body_iovec(response, offset, iov, H2_MAX_BODY_IOVECS);
+        if ( !iovcnt ) { return; }
+
+        for (int i = 0; i < iovcnt && len; ++i) {
+            size_t n = MIN(iov[i].iov_len, len);
+            memcpy(dest, iov[i].iov_base, n);
+            dest += n;
+            offset += n;
+            len -= n;
+        }
+    }
+}
+
+// Queue one DATA frame for the stream, as large as flow control allows.
+// Returns 1 if this was the last frame of the response, -1 if the stream had to
+// be reset, or 0 otherwise.
+int __http2_send_data(http2_session_t* session, http2_stream_t* stream) {
+    response_t* response = stream->response;
+
+    size_t chunk = stream->body_bytes_to_transmit - stream->body_bytes_transmitted;
+    chunk = MIN(chunk, session->peer_max_frame_size);
+    chunk = MIN(chunk, (size_t) MIN(session->send_window, stream->send_window));
+
+    uint8_t* frame = __http2_reserve(session, HTTP2_FRAME_HEADER_LENGTH + chunk);
+    uint8_t* payload = frame + HTTP2_FRAME_HEADER_LENGTH;
+
+    size_t offset = response->body_offset + stream->body_bytes_transmitted;
+    if ( response->rt == RT_FILE ) {
+        ssize_t bytes_read = 
+            pread(fileno(response->body_content.file), payload, chunk, offset);
+        chunk = bytes_read > 0 ? (size_t) bytes_read : 0;
+        if ( !chunk ) {
+            LOG("(fd=%d) response file ended early on stream %u",
+                session->conn->client_fd, stream->id);
+            __http2_reset_stream(session, stream->id, H2E_INTERNAL_ERROR);
+            return -1;
+        }
+    } else if ( response->rt == RT_IOVEC ) {
+        __http2_copy_segments(response, stream->body_bytes_transmitted, payload, chunk);
+    } else {
+        memcpy(payload, response->body_content.body + offset, chunk);
+    }
+
+    stream->body_bytes_transmitted += chunk;
+    stream->send_window -= chunk;
+    session->send_window -= chunk;
+
+    int done = stream->body_bytes_transmitted == stream->body_bytes_to_transmit;
+    __http2_write_frame_header(
+        frame, chunk, H2F_DATA, done ? H2_FLAG_END_STREAM : 0, stream->id);
+    session->out_len += HTTP2_FRAME_HEADER_LENGTH + chunk;
+
+    return done;
+}
+
+// Queue response bodies one frame per stream at a time so that a single large
+// response cannot starve the others. Returns 1 if it stopped because too much
+// output is pending, or 0 otherwise.
+int __http2_pump_streams(http2_session_t* session) {
+    int progress = 1;
+    while ( progress ) {
+        progress = 0;
+
+        http2_stream_t* stream = session->streams;
+        while ( stream ) {
+            http2_stream_t* next = stream->next;
+
+            if ( session->send_window <= 0 ) { return 0; }
+            if ( __http2_pending_output(session) >= H2_MAX_PENDING_OUTPUT )
+                return 1;
+
+            if ( stream->state == H2SS_SENDING_BODY && stream->send_window > 0 ) {
+                if ( __http2_send_data(session, stream) == 1 )
+                    __http2_finish_stream(session, stream);
+                progress = 1;
+            }
+
+            stream = next;
+        }
+    }
+
+    return 0;
+}
+
+/// REQUESTS
+
+void __http2_canonicalize_header_name(char* name) {
+    int upper = 1;
+    for (; *name; ++name) {
+        if ( upper && *name >= 'a' && *name <= 'z' )
+            *name -= 'a' - 'A';
+        upper = *name == '-';
+    }
+}
+
+// HPACK callback that saves a decoded header into the request. Header names
+// are canonicalized (content-type -> Content-Type) to match HTTP/1 requests.
+void __http2_on_header(void* ptr, const char* name, size_t name_len,
+        const char* value, size_t value_len) {
+    (void) name_len;
+    (void) value_len;
+
+    http2_header_ctx_t* ctx = ptr;
+    request_t* request = ctx->request;
+
+    if ( name[0] == ':' ) {
+        if ( ctx->is_trailer || ctx->seen_regular_header ) {
+            ctx->malformed = 1;
+        } else if ( !strcmp(name, ":method") ) {
+            request->method = http_method_from_string(value);
+            ctx->has_method = 1;
+        } else if ( !strcmp(name, ":path") && !request->path ) {
+            request->path = strdup(value);
+        } else if ( !strcmp(name, ":authority") ) {
+            dictionary_set(request->headers, HOST_HEADER_KEY, (void*) value);
+        } else if ( strcmp(name, ":scheme") ) {
+            ctx->malformed = 1;
+        }
+
+        return;
+    }
+
+    ctx->seen_regular_header = 1;
+    char* key = strdup(name);
+    __http2_canonicalize_header_name(key);
+
+    // cookies may be split into several headers for better compression
+    if ( !strcmp(key, COOKIE_HEADER_KEY) && dictionary_contains(request->headers, key) ) {
+        char* joined = NULL;
+        asprintf(&joined, "%s; %s", (char*) dictionary_get(request->headers, key), value);
+        dictionary_set(request->headers, key, joined);
+        free(joined);
+    } else {
+        dictionary_set(request->headers, key, (void*) value);
+    }
+
+    free(key);
+}
+
+// Set up the request body of a stream whose HEADERS did not end the stream.
+void __http2_begin_body(http2_stream_t* stream) {
+    request_t* request = stream->request;
+    dictionary* headers = request->headers;
+
+    if ( dictionary_contains(headers, CONTENT_LENGTH_HEADER_KEY) ) {
+        sscanf(
+            dictionary_get(headers, CONTENT_LENGTH_HEADER_KEY),
+            "%zu", &stream->content_length
+        );
+    }
+
+    char* boundary = NULL;
+    if ( dictionary_contains(headers, CONTENT_TYPE_HEADER_KEY) )
+        boundary = multipart_parse_boundary(dictionary_get(headers, CONTENT_TYPE_HEADER_KEY));
+
+    if ( boundary ) {
+        request_init_multipart_body(request, boundary);
+        free(boundary);
+    } else if ( stream->content_length <= H2_MAX_IN_MEMORY_BODY ) {
+        request_init_str_body(request, stream->content_length);
+    } else {
+        // the length is either unknown or too large to buffer in memory
+        size_t len = stream->content_length == SIZE_MAX ? 0 : stream->content_length;
+        request_init_tmp_file_body(request, len);
+    }
+}
+
+void __http2_end_body(http2_session_t* session, http2_stream_t* stream) {
+    request_t* request = stream->request;
+
+    if ( stream->content_length != SIZE_MAX
+            && stream->body_bytes_received != stream->content_length ) {
+        __http2_reset_stream(session, stream->id, H2E_PROTOCOL_ERROR);
+        return;
+    }
+
+    if ( request->body && request->body->type == RQBT_FILE ) {
+        request->body->length = stream->body_bytes_received;
+        fflush(request->body->content.file);
+    }
+
+    __http2_dispatch(session, stream);
+}
+
+// Decode a complete header block. It either opens a new stream or carries the
+// trailers that end the request body of an existing one.
+int __http2_on_header_block(http2_session_t* session) {
+    uint32_t id = session->header_stream_id;
+    uint8_t flags = session->header_flags;
+    session->header_stream_id = 0;
+
+    http2_stream_t* stream = __http2_find_stream(session, id);
+    http2_header_ctx_t ctx = { 0 };
+
+    if ( !stream && (id <= session->last_stream_id || !(id & 1)) )
+        return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+
+    // the header block has to be decoded even if the stream gets refused,
+    // since it may change the state of the decoder
+    int is_trailer = stream && stream->state == H2SS_RECEIVING_BODY;
+    ctx.request = is_trailer ? stream->request : request_create(HTTP_UNKNOWN);
+    ctx.is_trailer = is_trailer;
+
+    if ( hpack_decode(&session->decoder, session->header_block,
+            session->header_block_len, __http2_on_header, &ctx) ) {
+        if ( !is_trailer ) { request_destroy(ctx.request); }
+        return __http2_goaway(session, H2E_COMPRESSION_ERROR);
+    }
+
+    if ( is_trailer ) {
+        if ( ctx.malformed || !(flags & H2_FLAG_END_STREAM) ) {
+            __http2_reset_stream(session, id, H2E_PROTOCOL_ERROR);
+        } else {
+            __http2_end_body(session, stream);
+        }
+
+        return 0;
+    } else if ( stream ) {
+        // the client already finished sending this request
+        request_destroy(ctx.request);
+        __http2_reset_stream(session, id, H2E_STREAM_CLOSED);
+        return 0;
+    }
+
+    request_t* request = ctx.request;
+    session->last_stream_id = id;
+
+    if ( session->goaway ) {
+        request_destroy(request);
+        return 0;
+    } else if ( ctx.malformed || !ctx.has_method || !request->path ) {
+        request_destroy(request);
+        __http2_reset_stream(session, id, H2E_PROTOCOL_ERROR);
+        return 0;
+    } else if ( session->num_streams >= HTTP2_MAX_CONCURRENT_STREAMS ) {
+        request_destroy(request);
+        __http2_reset_stream(session, id, H2E_REFUSED_STREAM);
+        return 0;
+    }
+
+    request->protocol = strdup(HTTP2_PROTOCOL);
+    request_parse_query_params(request);
+    stream = __http2_open_stream(session, id, request);
+
+    if ( flags & H2_FLAG_END_STREAM ) {
+        __http2_dispatch(session, stream);
+    } else {
+        __http2_begin_body(stream);
+    }
+
+    return 0;
+}
+
+/// FRAMES
+
+// Strip the padding from a frame with the PADDED flag. Returns -1 if the
+// padding is longer than the frame.
+int __http2_strip_padding(uint8_t flags, uint8_t** payload, size_t* len) {
+    if ( !(flags & H2_FLAG_PADDED) ) { return 0; }
+    if ( *len < 1 ) { return -1; }
+
+    size_t padding = **payload;
+    ++*payload;
+    --*len;
+
+    if ( padding > *len ) { return -1; }
+    *len -= padding;
+
+    return 0;
+}
+
+void __http2_append_header_block(http2_session_t* session, const uint8_t* buf, size_t len) {
+    session->header_block = realloc(
+        session->header_block, session->header_block_len + len);
+    memcpy(session->header_block + session->header_block_len, buf, len);
+    session->header_block_len += len;
+}
+
+int __http2_on_headers(http2_session_t* session, uint8_t flags, uint32_t id,
+        uint8_t* payload, size_t len) {
+    if ( !id || __http2_strip_padding(flags, &payload, &len) )
+        return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+
+    // stream priorities are advisory, so they are ignored
+    if ( flags & H2_FLAG_PRIORITY ) {
+        if ( len < 5 ) { return __http2_goaway(session, H2E_PROTOCOL_ERROR); }
+        payload += 5;
+        len -= 5;
+    }
+
+    session->header_stream_id = id;
+    session->header_flags = flags;
+    session->header_block_len = 0;
+    __http2_append_header_block(session, payload, len);
+
+    if ( flags & H2_FLAG_END_HEADERS )
+        return __http2_on_header_block(session);
+
+    return 0;
+}
+
+int __http2_on_continuation(http2_session_t* session, uint8_t flags, uint32_t id,
+        uint8_t* payload, size_t len) {
+    if ( !session->header_stream_id || id != session->header_stream_id )
+        return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+
+    if ( session->header_block_len + len > H2_MAX_HEADER_BLOCK_SIZE )
+        return __http2_goaway(session, H2_ENHANCE_YOUR_CALM);
+
+    __http2_append_header_block(session, payload, len);
+
+    if ( flags & H2_FLAG_END_HEADERS )
+        return __http2_on_header_block(session);
+
+    return 0;
+}
+
+int __http2_on_data(http2_session_t* session, uint8_t flags, uint32_t id,
+        uint8_t* payload, size_t len) {
+    if ( !id ) { return __http2_goaway(session, H2E_PROTOCOL_ERROR); }
+
+    // the whole frame counts against the connection window, padding included
+    session->recv_window -= len;
+    if ( session->recv_window < 0 )
+        return __http2_goaway(session, H2E_FLOW_CONTROL_ERROR);
+
+    if ( session->recv_window < H2_RECV_WINDOW / 2 ) {
+        __http2_queue_window_update(session, 0, H2_RECV_WINDOW - session->recv_window);
+        session->recv_window = H2_RECV_WINDOW;
+    }
+
+    size_t frame_len = len;
+    if ( __http2_strip_padding(flags, &payload, &len) )
+        return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+
+    http2_stream_t* stream = __http2_find_stream(session, id);
+    if ( !stream || stream->state != H2SS_RECEIVING_BODY ) {
+        if ( id > session->last_stream_id )
+            return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+
+        __http2_reset_stream(session, id, H2E_STREAM_CLOSED);
+        return 0;
+    }
+
+    stream->recv_window -= frame_len;
+    if ( stream->recv_window < 0 ) {
+        __http2_reset_stream(session, id, H2E_FLOW_CONTROL_ERROR);
+        return 0;
+    }
+
+    // the body may not be longer than its Content-Length
+    if ( stream->content_length != SIZE_MAX
+            && stream->body_bytes_received + len > stream->content_length ) {
+        __http2_reset_stream(session, id, H2E_PROTOCOL_ERROR);
+        return 0;
+    }
+
+    request_read_body(stream->request, (char*) payload, len);
+    stream->body_bytes_received += len;
+
+    if ( flags & H2_FLAG_END_STREAM ) {
+        __http2_end_body(session, stream);
+    } else if ( stream->recv_window < H2_RECV_WINDOW / 2 ) {
+        __http2_queue_window_update(session, id, H2_RECV_WINDOW - stream->recv_window);
+        stream->recv_window = H2_RECV_WINDOW;
+    }
+
+    return 0;
+}
+
+// Apply the peer's SETTINGS parameters. Returns 0 or an error code.
+http2_error_t __http2_apply_settings(http2_session_t* session, const uint8_t* payload, size_t len) {
+    for (size_t i = 0; i + H2_SETTING_LENGTH <= len; i += H2_SETTING_LENGTH) {
+        uint16_t key = (payload[i] << 8) | payload[i + 1];
+        uint32_t value = __read_u32(payload + i + 2);
+
+        switch ( key ) {
+            case H2_SETTINGS_ENABLE_PUSH:
+                if ( value > 1 ) { return H2E_PROTOCOL_ERROR; }
+                break;
+            case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+                if ( value > HTTP2_MAX_WINDOW_SIZE ) { return H2E_FLOW_CONTROL_ERROR; }
+
+                // the change applies to the windows of every open stream
+                int64_t delta = (int64_t) value - session->peer_initial_window;
+                for (http2_stream_t* s = session->streams; s; s = s->next)
+                    s->send_window += delta;
+
+                session->peer_initial_window = value;
+                break;
+            }
+            case H2_SETTINGS_MAX_FRAME_SIZE:
+                if ( value < HTTP2_DEFAULT_MAX_FRAME_SIZE || value > 0xffffff )
+                    return H2E_PROTOCOL_ERROR;
+                session->peer_max_frame_size = value;
+                break;
+            default: // unknown settings must be ignored
+                break;
+        }
+    }
+
+    return H2E_NO_ERROR;
+}
+
+int __http2_on_settings(http2_session_t* session, uint8_t flags, uint32_t id,
+        const uint8_t* payload, size_t len) {
+    if ( id ) { return __http2_goaway(session, H2E_PROTOCOL_ERROR); }
+
+    if ( flags & H2_FLAG_ACK )
+        return len ? __http2_goaway(session, H2E_FRAME_SIZE_ERROR) : 0;
+
+    if ( len % H2_SETTING_LENGTH )
+        return __http2_goaway(session, H2E_FRAME_SIZE_ERROR);
+
+    http2_error_t error = __http2_apply_settings(session, payload, len);
+    if ( error ) { return __http2_goaway(session, error); }
+
+    __http2_queue_frame(session, H2F_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+    return 0;
+}
+
+int __http2_on_window_update(http2_session_t* session, uint32_t id,
+        const uint8_t* payload, size_t len) {
+    if ( len != 4 ) { return __http2_goaway(session, H2E_FRAME_SIZE_ERROR); }
+
+    uint32_t increment = __read_u32(payload) & HTTP2_MAX_WINDOW_SIZE;
+    if ( !id ) {
+        session->send_window += increment;
+        if ( !increment )
+            return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+        if ( session->send_window > HTTP2_MAX_WINDOW_SIZE )
+            return __http2_goaway(session, H2E_FLOW_CONTROL_ERROR);
+        return 0;
+    }
+
+    // updates may still arrive for streams that we already closed
+    http2_stream_t* stream = __http2_find_stream(session, id);
+    if ( !stream ) { return 0; }
+
+    stream->send_window += increment;
+    if ( !increment ) {
+        __http2_reset_stream(session, id, H2E_PROTOCOL_ERROR);
+    } else if ( stream->send_window > HTTP2_MAX_WINDOW_SIZE ) {
+        __http2_reset_stream(session, id, H2E_FLOW_CONTROL_ERROR);
+    }
+
+    return 0;
+}
+
+int __http2_on_frame(http2_session_t* session, uint8_t type, uint8_t flags,
+        uint32_t id, uint8_t* payload, size_t len) {
+    // nothing may come between a HEADERS frame and its CONTINUATION frames
+    if ( session->header_stream_id && type != H2F_CONTINUATION )
+        return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+
+    switch ( type ) {
+        case H2F_DATA:
+            return __http2_on_data(session, flags, id, payload, len);
+        case H2F_HEADERS:
+            return __http2_on_headers(session, flags, id, payload, len);
+        case H2F_CONTINUATION:
+            return __http2_on_continuation(session, flags, id, payload, len);
+        case H2F_SETTINGS:
+            return __http2_on_settings(session, flags, id, payload, len);
+        case H2F_WINDOW_UPDATE:
+            return __http2_on_window_update(session, id, payload, len);
+        case H2F_PRIORITY:
+            if ( !id ) { return __http2_goaway(session, H2E_PROTOCOL_ERROR); }
+            if ( len != 5 ) { __http2_reset_stream(session, id, H2E_FRAME_SIZE_ERROR); }
+            return 0;
+        case H2F_RST_STREAM: {
+            if ( !id || id > session->last_stream_id )
+                return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+            if ( len != 4 )
+                return __http2_goaway(session, H2E_FRAME_SIZE_ERROR);
+
+            http2_stream_t* stream = __http2_find_stream(session, id);
+            if ( stream ) { __http2_close_stream(session, stream); }
+            return 0;
+        }
+        case H2F_PING:
+            if ( id ) { return __http2_goaway(session, H2E_PROTOCOL_ERROR); }
+            if ( len != 8 ) { return __http2_goaway(session, H2E_FRAME_SIZE_ERROR); }
+            if ( !(flags & H2_FLAG_ACK) )
+                __http2_queue_frame(session, H2F_PING, H2_FLAG_ACK, 0, payload, len);
+            return 0;
+        case H2F_GOAWAY:
+            if ( id ) { return __http2_goaway(session, H2E_PROTOCOL_ERROR); }
+            // finish the streams that are open, but do not accept new ones
+            session->goaway = 1;
+            return 0;
+        case H2F_PUSH_PROMISE: // clients cannot push
+            return __http2_goaway(session, H2E_PROTOCOL_ERROR);
+        default: // unknown frame types must be ignored
+            return 0;
+    }
+}
+
+// Process every complete frame in the input buffer. Returns -1 on a connection
+// error, 1 if complete frames were left unprocessed because too much output is
+// pending, or 0 otherwise.
+int __http2_process_input(http2_session_t* session) {
+    size_t pos = 0;
+    int ret = 0;
+
+    if ( session->expect_preface ) {
+        size_t n = MIN(session->in_len, HTTP2_PREFACE_LENGTH);
+        if ( memcmp(session->in_buf, HTTP2_PREFACE, n) ) {
+            LOG("(fd=%d) invalid HTTP/2 connection preface", session->conn->client_fd);
+            return -1;
+        } else if ( n < HTTP2_PREFACE_LENGTH ) {
+            return 0;
+        }
+
+        pos = HTTP2_PREFACE_LENGTH;
+        session->expect_preface = 0;
+    }
+
+    while ( session->in_len - pos >= HTTP2_FRAME_HEADER_LENGTH ) {
+        uint8_t* header = session->in_buf + pos;
+        size_t len = (header[0] << 16) | (header[1] << 8) | header[2];
+
+        // we never raise SETTINGS_MAX_FRAME_SIZE above the default
+        if ( len > HTTP2_DEFAULT_MAX_FRAME_SIZE ) {
+            ret = __http2_goaway(session, H2E_FRAME_SIZE_ERROR);
+            break;
+        } else if ( session->in_len - pos < HTTP2_FRAME_HEADER_LENGTH + len ) {
+            break;
+        } else if ( __http2_pending_output(session) >= H2_MAX_PENDING_OUTPUT ) {
+            ret = 1;
+            break;
+        }
+
+        ret = __http2_on_frame(
+            session, header[3], header[4], __read_u32(header + 5) & HTTP2_MAX_WINDOW_SIZE,
+            header + HTTP2_FRAME_HEADER_LENGTH, len
+        );
+
+        pos += HTTP2_FRAME_HEADER_LENGTH + len;
+        if ( ret < 0 ) { break; }
+    }
+
+    memmove(session->in_buf, session->in_buf + pos, session->in_len - pos);
+    session->in_len -= pos;
+
+    return ret;
+}
+
+/// SESSIONS
+
+http2_session_t* http2_session_create(connection_t* conn) {
+    http2_session_t* this = calloc(1, sizeof(http2_session_t));
+    this->conn = conn;
+    hpack_table_init(&this->decoder, HPACK_DEFAULT_TABLE_SIZE);
+
+    this->in_size = H2_INPUT_BUFFER_SIZE;
+    this->in_buf = malloc(this->in_size);
+    this->out_size = H2_INITIAL_OUTPUT_SIZE;
+    this->out_buf = malloc(this->out_size);
+
+    this->send_window = HTTP2_DEFAULT_WINDOW_SIZE;
+    this->recv_window = H2_RECV_WINDOW;
+    this->peer_initial_window = HTTP2_DEFAULT_WINDOW_SIZE;
+    this->peer_max_frame_size = HTTP2_DEFAULT_MAX_FRAME_SIZE;
+    this->expect_preface = 1;
+
+    // the server connection preface, followed by the connection window since
+    // it can only be raised with a WINDOW_UPDATE
+    uint8_t settings[2 * H2_SETTING_LENGTH] = {
+        0, H2_SETTINGS_MAX_CONCURRENT_STREAMS, 0, 0, 0, 0,
+        0, H2_SETTINGS_INITIAL_WINDOW_SIZE, 0, 0, 0, 0
+    };
+    __write_u32(settings + 2, HTTP2_MAX_CONCURRENT_STREAMS);
+    __write_u32(settings + H2_SETTING_LENGTH + 2, H2_RECV_WINDOW);
+
+    __http2_queue_frame(this, H2F_SETTINGS, 0, 0, settings, sizeof(settings));
+    __http2_queue_window_update(this, 0, H2_RECV_WINDOW - HTTP2_DEFAULT_WINDOW_SIZE);
+
+    return this;
+}
+
+void http2_session_destroy(http2_session_t* session) {
+    while ( session->streams )
+        __http2_close_stream(session, session->streams);
+
+    hpack_table_destroy(&session->decoder);
+    free(session->header_block);
+    free(session->in_buf);
+    free(session->out_buf);
+    free(session);
+}
+
+void http2_session_feed(http2_session_t* session, const char* buf, size_t len) {
+    if ( session->in_len + len > session->in_size ) {
+        session->in_size = session->in_len + len;
+        session->in_buf = realloc(session->in_buf, session->in_size);
+    }
+
+    memcpy(session->in_buf + session->in_len, buf, len);
+    session->in_len += len;
+}
+
+int http2_session_on_event(http2_session_t* session) {
+    int fd = session->conn->client_fd;
+
+    // with edge triggered events we must keep going until the socket runs dry
+    for (;;) {
+        int congested = __http2_pending_output(session) >= H2_MAX_PENDING_OUTPUT;
+        size_t space = session->in_size - session->in_len;
+        ssize_t bytes_read = 0;
+
+        if ( !congested && space ) {
+            bytes_read = read(fd, session->in_buf + session->in_len, space);
+
+            if ( bytes_read == 0 ) {
+                return -1;
+            } else if ( bytes_read < 0 && errno != EAGAIN
+                    && errno != EWOULDBLOCK && errno != EINTR ) {
+                return -1;
+            } else if ( bytes_read > 0 ) {
+                session->in_len += bytes_read;
+            }
+        }
+
+        int ret = __http2_process_input(session);
+        if ( ret < 0 ) {
+            __http2_flush(session);
+            return -1;
+        }
+
+        int blocked = __http2_pump_streams(session);
+        if ( __http2_flush(session) ) { return -1; }
+
+        // go around again if input or output was held back but the output 
+        // has drained since
+        int drained = __http2_pending_output(session) < H2_MAX_PENDING_OUTPUT;
+        if ( bytes_read <= 0 && !((congested || blocked || ret > 0) && drained) )
+            break;
+    }
+
+    if ( session->goaway && !session->num_streams && !__http2_pending_output(session) )
+        return -1;
+
+    return 0;
+}
+
+/// UPGRADE
+
+int http2_try_upgrade(connection_t* conn) {
+    static const char* UPGRADE_RESPONSE =
+        "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+
+    request_t* request = conn->request;
+    dictionary* headers = request->headers;
+
+    if ( !request->protocol || strcmp(request->protocol, UPGRADE_PROTOCOL)
+            || !dictionary_contains(headers, UPGRADE_HEADER_KEY)
+            || !dictionary_contains(headers, HTTP2_SETTINGS_HEADER_KEY)
+            || !http_header_has_token(dictionary_get(headers, UPGRADE_HEADER_KEY), UPGRADE_TOKEN) )
+        return 0;
+
+    // the body would have to be read as HTTP/1 before switching, so requests
+    // with a body are just answered over HTTP/1
+    if ( request->body || request->form || request->method == HTTP_UNKNOWN )
+        return 0;
+
+    const char* encoded = dictionary_get(headers, HTTP2_SETTINGS_HEADER_KEY);
+    size_t encoded_len = strlen(encoded);
+    uint8_t* settings = malloc(BASE64_DECODED_LENGTH(encoded_len));
+    ssize_t settings_len = base64_decode(encoded, encoded_len, settings);
+
+    http2_session_t* session = NULL;
+    if ( settings_len >= 0 && settings_len % H2_SETTING_LENGTH == 0 ) {
+        // these settings are acknowledged implicitly by the 101 response
+        session = http2_session_create(conn);
+        if ( __http2_apply_settings(session, settings, settings_len) ) {
+            http2_session_destroy(session);
+            session = NULL;
+        }
+    }
+
+    free(settings);
+    if ( !session ) { return 0; }
+
+    write_all_to_socket(conn->client_fd, UPGRADE_RESPONSE, strlen(UPGRADE_RESPONSE));
+
+    // the upgraded request becomes stream 1, half-closed from the client side
+    free(request->protocol);
+    request->protocol = strdup(HTTP2_PROTOCOL);
+    session->last_stream_id = 1;
+
+    http2_stream_t* stream = __http2_open_stream(session, 1, request);
+#ifndef __SKIP_LOG_REQUESTS__
+    stream->time_opened = conn->time_connected;
+#endif
+    conn->request = NULL;
+
+    // whatever followed the request (usually the client preface) is HTTP/2
+    http2_session_feed(session, conn->buf, conn->buf_end);
+    conn->buf_end = 0;
+    conn->buf_ptr = 0;
+    conn->h2 = session;
+    conn->state = CS_HTTP2;
+
+    __http2_dispatch(session, stream);
+    return 1;
+}
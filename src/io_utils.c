@@ -3,7 +3,13 @@
 #include "vector.h"
 
 #include <sys/socket.h>
-#include <sys/ioctl.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#elif defined(__APPLE__)
+#include <sys/uio.h>
+#endif
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -83,6 +89,41 @@ ssize_t write_all_to_socket(int socket_fd, const char *buffer, size_t count) {
     return bytes_sent;
 }
 
+ssize_t sendmsg_all_to_socket(int socket_fd, struct iovec* iov, int iovcnt, int flags) {
+    struct msghdr msg = { 0 };
+    size_t bytes_sent = 0;
+
+    while (iovcnt > 0) {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t return_code = sendmsg(socket_fd, &msg, flags);
+
+        if (return_code == 0) {
+            return bytes_sent;
+        } else if (return_code == -1 && errno == EINTR) {
+            continue;
+        } else if (return_code == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return bytes_sent;
+        } else if (return_code == -1) {
+            return -1;
+        }
+
+        bytes_sent += return_code;
+        while (iovcnt > 0 && (size_t) return_code >= iov->iov_len) {
+            return_code -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + return_code;
+            iov->iov_len -= return_code;
+        }
+    }
+
+    return bytes_sent;
+}
+
 ssize_t read_all_from_socket(int socket_fd, char *buffer, size_t count) {
     ssize_t return_code = 0;
     size_t bytes_read = 0;
@@ -105,6 +146,166 @@ ssize_t read_all_from_socket(int socket_fd, char *buffer, size_t count) {
     return bytes_read;
 }
 
+ssize_t read_available_from_socket(int socket_fd, char *buffer, size_t count) {
+    size_t bytes_read = 0;
+
+    while ( bytes_read < count ) {
+        size_t to_read = count - bytes_read;
+        ssize_t return_code = read(socket_fd, buffer + bytes_read, to_read);
+
+        if (return_code == 0) {
+            return bytes_read;
+        } else if (return_code == -1 && errno == EINTR) {
+            continue;
+        } else if (return_code == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return bytes_read ? (ssize_t) bytes_read : -1;
+        } else if (return_code == -1) {
+            return -1;
+        }
+
+        bytes_read += return_code;
+
+        // a stream socket only comes up short once it is drained, so the read
+        // that would just fail with EAGAIN is skipped
+        if ( (size_t) return_code < to_read ) { break; }
+    }
+
+    return bytes_read;
+}
+
+#if defined(__linux__)
+ssize_t splice_from_socket(int socket_fd, int pipe_fds[2], int out_fd, size_t count) {
+    size_t total_bytes_moved = 0;
+
+    while ( total_bytes_moved < count ) {
+        ssize_t bytes_in = splice(
+            socket_fd, NULL, pipe_fds[1], NULL, count - total_bytes_moved, 
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+        );
+
+        if (bytes_in == 0) {
+            return total_bytes_moved;
+        } else if (bytes_in == -1 && errno == EINTR) {
+            continue;
+        } else if (bytes_in == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return total_bytes_moved ? (ssize_t) total_bytes_moved : -1;
+        } else if (bytes_in == -1) {
+            return -1;
+        }
+
+        // drain everything we just put in the pipe before reading more
+        while ( bytes_in > 0 ) {
+            ssize_t bytes_out = splice(
+                pipe_fds[0], NULL, out_fd, NULL, bytes_in, SPLICE_F_MOVE);
+
+            if (bytes_out == -1 && errno == EINTR) {
+                continue;
+            } else if (bytes_out <= 0) {
+                return -1;
+            }
+
+            bytes_in -= bytes_out;
+            total_bytes_moved += bytes_out;
+        }
+    }
+
+    return total_bytes_moved;
+}
+#endif
+
+#if defined(ZEROCOPY_SUPPORTED)
+int enable_socket_zerocopy(int fd) {
+    int opt = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt));
+}
+
+ssize_t zerocopy_write_to_socket(int socket_fd, const char* buffer, size_t count, uint32_t* sends) {
+    size_t bytes_sent = 0;
+
+    while ( bytes_sent < count ) {
+        ssize_t ret = send(socket_fd, buffer + bytes_sent, count - bytes_sent, MSG_ZEROCOPY);
+
+        if (ret > 0) {
+            bytes_sent += ret;
+            ++*sends;
+        } else if (ret == 0) {
+            return bytes_sent;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return bytes_sent;
+        } else if (errno == ENOBUFS) {
+            // too many notifications are outstanding to pin any more pages
+            ssize_t written = write_all_to_socket(socket_fd, buffer + bytes_sent, count - bytes_sent);
+            return written < 0 ? -1 : (ssize_t) (bytes_sent + written);
+        } else {
+            return -1;
+        }
+    }
+
+    return bytes_sent;
+}
+
+ssize_t reap_zerocopy_completions(int socket_fd) {
+    ssize_t completed = 0;
+
+    while (1) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+        struct msghdr msg = { 0 };
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if ( recvmsg(socket_fd, &msg, MSG_ERRQUEUE) == -1 ) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return completed; }
+            return -1;
+        }
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if ( !(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR) )
+                continue;
+
+            // consecutive sends are reported together as the range [ee_info, ee_data]
+            struct sock_extended_err* serr = (struct sock_extended_err*) CMSG_DATA(cm);
+            if ( serr->ee_errno == 0 && serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY )
+                completed += serr->ee_data - serr->ee_info + 1;
+        }
+    }
+}
+#endif
+
+ssize_t sendfile_to_socket(int socket_fd, int file_fd, off_t offset, size_t count) {
+    size_t total_bytes_sent = 0;
+
+    while ( total_bytes_sent < count ) {
+#if defined(__linux__)
+        ssize_t ret = sendfile(socket_fd, file_fd, &offset, count - total_bytes_sent);
+        if (ret > 0)
+            total_bytes_sent += ret;
+#elif defined(__APPLE__)
+        // len reports partial progress even when sendfile fails with EAGAIN
+        off_t len = count - total_bytes_sent;
+        ssize_t ret = sendfile(file_fd, socket_fd, offset, &len, NULL, 0);
+        offset += len;
+        total_bytes_sent += len;
+        if (ret == 0)
+            ret = len;
+#endif
+        if (ret == 0) {
+            return total_bytes_sent;
+        } else if (ret == -1 && errno == EINTR) {
+            continue;
+        } else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return total_bytes_sent ? (ssize_t) total_bytes_sent : -1;
+        } else if (ret == -1) {
+            return -1;
+        }
+    }
+
+    return total_bytes_sent;
+}
+
 char* robust_getline(int socket_fd) {
     vector* vec = char_vector_create();
     char in[1] = { 0 };
@@ -152,26 +353,6 @@ void make_socket_non_blocking(int fd) {
         err(EXIT_FAILURE, "fcntl F_SETFL O_NONBLOCK");
 }
 
-int num_bytes_in_rd_socket(int fd) {
-    int count;
-    ioctl(fd, FIONREAD, &count);
-
-    return count;
-}
-
-int num_bytes_in_wr_socket(int fd) {
-    int count;
-#if defined(__linux__)
-    if ( ioctl(fd, TIOCOUTQ, &count) == -1) 
-        perror("ioctl TIOCOUTQ");
-#elif defined(__APPLE__)
-    unsigned int m = sizeof(count);
-    if ( getsockopt(fd, SOL_SOCKET, SO_NWRITE, &count, &m) < 0 )
-        perror("getsockopt SO_NWRITE");
-#endif
-    return count;
-}
-
 int socket_snd_buf_size(int fd) {
     int count;
     unsigned int m = sizeof(count);
@@ -180,9 +361,4 @@ int socket_snd_buf_size(int fd) {
         perror("getsockopt SO_SNDBUF");
 
     return count;
-}
-
-int free_bytes_in_wr_socket(int fd) {
-    // adapted from https://stackoverflow.com/a/36771727
-    return socket_snd_buf_size(fd) - num_bytes_in_wr_socket(fd);
 }
\ No newline at end of file
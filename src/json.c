@@ -0,0 +1,307 @@
+#include "json.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define JSON_INITIAL_CAPACITY (1UL << 10UL)
+
+// The longest escape sequence, e.g. \u001f
+#define JSON_MAX_ESCAPE_LENGTH 6
+
+// The longest "%.17g" formatting of a double, with room to spare
+#define JSON_MAX_NUMBER_LENGTH 32
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+json_writer_t* json_writer_create(void) {
+    json_writer_t* writer = calloc(1, sizeof(json_writer_t));
+    writer->buf = malloc(JSON_INITIAL_CAPACITY);
+    writer->capacity = JSON_INITIAL_CAPACITY;
+
+    return writer;
+}
+
+void json_writer_destroy(json_writer_t* writer) {
+    free(writer->buf);
+    free(writer);
+}
+
+// Make room for at least n more bytes
+static inline void __json_reserve(json_writer_t* writer, size_t n) {
+    if ( writer->len + n <= writer->capacity ) { return; }
+
+    while ( writer->len + n > writer->capacity )
+        writer->capacity *= 2;
+
+    writer->buf = realloc(writer->buf, writer->capacity);
+}
+
+static inline void __json_put(json_writer_t* writer, const char* s, size_t len) {
+    __json_reserve(writer, len);
+    memcpy(writer->buf + writer->len, s, len);
+    writer->len += len;
+}
+
+// Write the comma that separates a value from the one before it, and check
+// that values inside objects come after a key.
+static void __json_before_value(json_writer_t* writer) {
+    if ( writer->after_key ) {
+        writer->after_key = 0;
+        return;
+    }
+
+    if ( writer->depth == 0 ) {
+        if ( writer->len )
+            errx(EXIT_FAILURE, "json: only one top-level value may be written");
+        return;
+    }
+
+    uint64_t bit = 1ULL << (writer->depth - 1);
+    if ( writer->is_object & bit )
+        errx(EXIT_FAILURE, "json: a value inside an object needs a key first");
+
+    if ( writer->has_members & bit )
+        __json_put(writer, ",", 1);
+
+    writer->has_members |= bit;
+}
+
+static void __json_begin(json_writer_t* writer, char open, int is_object) {
+    __json_before_value(writer);
+    if ( writer->depth == JSON_MAX_DEPTH )
+        errx(EXIT_FAILURE, "json: containers nested deeper than %d", JSON_MAX_DEPTH);
+
+    uint64_t bit = 1ULL << writer->depth++;
+    writer->has_members &= ~bit;
+    if ( is_object ) { writer->is_object |= bit; }
+    else { writer->is_object &= ~bit; }
+
+    __json_put(writer, &open, 1);
+}
+
+static void __json_end(json_writer_t* writer, char close, int is_object) {
+    if ( writer->depth == 0 || writer->after_key
+            || !(writer->is_object & (1ULL << (writer->depth - 1))) != !is_object )
+        errx(EXIT_FAILURE, "json: %c does not close the innermost container", close);
+
+    --writer->depth;
+    __json_put(writer, &close, 1);
+}
+
+void json_begin_object(json_writer_t* writer) { __json_begin(writer, '{', 1); }
+void json_end_object(json_writer_t* writer) { __json_end(writer, '}', 1); }
+void json_begin_array(json_writer_t* writer) { __json_begin(writer, '[', 0); }
+void json_end_array(json_writer_t* writer) { __json_end(writer, ']', 0); }
+
+// Write the escape sequence for a quote, backslash or control character
+static void __json_escape_char(json_writer_t* writer, unsigned char c) {
+    char* out = writer->buf + writer->len;
+    out[0] = '\\';
+
+    switch ( c ) {
+        case '"':  out[1] = '"';  break;
+        case '\\': out[1] = '\\'; break;
+        case '\b': out[1] = 'b';  break;
+        case '\f': out[1] = 'f';  break;
+        case '\n': out[1] = 'n';  break;
+        case '\r': out[1] = 'r';  break;
+        case '\t': out[1] = 't';  break;
+        default:
+            memcpy(out + 1, "u00", 3);
+            out[4] = HEX_DIGITS[c >> 4];
+            out[5] = HEX_DIGITS[c & 0xf];
+            writer->len += JSON_MAX_ESCAPE_LENGTH;
+            return;
+    }
+
+    writer->len += 2;
+}
+
+static inline int __json_needs_escape(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Copy a string into the buffer, escaping the bytes JSON does not allow
+// unescaped. Most strings have nothing to escape, so 16 bytes at a time are
+// checked and copied with vector instructions until one needs it.
+static void __json_write_escaped(json_writer_t* writer, const char* s, size_t len) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i max_control = _mm_set1_epi8(0x1f);
+
+    while ( i + 16 <= len ) {
+        __json_reserve(writer, 16 + JSON_MAX_ESCAPE_LENGTH);
+        __m128i block = _mm_loadu_si128((const __m128i*) (s + i));
+
+        // an unsigned byte is a control character if max(byte, 0x1f) == 0x1f
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(block, max_control), max_control)
+        );
+
+        // the whole block is stored, but only the bytes before the first
+        // special one are kept
+        _mm_storeu_si128((__m128i*) (writer->buf + writer->len), block);
+        int mask = _mm_movemask_epi8(special);
+        if ( !mask ) {
+            writer->len += 16;
+            i += 16;
+            continue;
+        }
+
+        int clean = __builtin_ctz(mask);
+        writer->len += clean;
+        i += clean;
+        __json_escape_char(writer, s[i++]);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+
+    while ( i + 16 <= len ) {
+        __json_reserve(writer, 16 + JSON_MAX_ESCAPE_LENGTH);
+        uint8x16_t block = vld1q_u8((const uint8_t*) (s + i));
+        uint8x16_t special = vorrq_u8(
+            vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, backslash)),
+            vcltq_u8(block, space)
+        );
+
+        vst1q_u8((uint8_t*) (writer->buf + writer->len), block);
+        uint64x2_t lanes = vreinterpretq_u64_u8(special);
+        if ( !(vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) ) {
+            writer->len += 16;
+            i += 16;
+            continue;
+        }
+
+        while ( !__json_needs_escape(s[i]) ) {
+            ++writer->len;
+            ++i;
+        }
+
+        __json_escape_char(writer, s[i++]);
+    }
+#endif
+
+    while ( i < len ) {
+        size_t run = i;
+        while ( run < len && !__json_needs_escape(s[run]) ) { ++run; }
+
+        __json_put(writer, s + i, run - i);
+        i = run;
+
+        if ( i < len ) {
+            __json_reserve(writer, JSON_MAX_ESCAPE_LENGTH);
+            __json_escape_char(writer, s[i++]);
+        }
+    }
+}
+
+static void __json_write_string(json_writer_t* writer, const char* s, size_t len) {
+    __json_reserve(writer, len + 2);
+    writer->buf[writer->len++] = '"';
+    __json_write_escaped(writer, s, len);
+    __json_put(writer, "\"", 1);
+}
+
+void json_key(json_writer_t* writer, const char* key) {
+    if ( writer->depth == 0 || writer->after_key
+            || !(writer->is_object & (1ULL << (writer->depth - 1))) )
+        errx(EXIT_FAILURE, "json: a key may only start a member of an object");
+
+    uint64_t bit = 1ULL << (writer->depth - 1);
+    if ( writer->has_members & bit )
+        __json_put(writer, ",", 1);
+
+    writer->has_members |= bit;
+    __json_write_string(writer, key, strlen(key));
+    __json_put(writer, ":", 1);
+    writer->after_key = 1;
+}
+
+void json_string(json_writer_t* writer, const char* value) {
+    if ( !value ) {
+        json_null(writer);
+        return;
+    }
+
+    json_string_len(writer, value, strlen(value));
+}
+
+void json_string_len(json_writer_t* writer, const char* value, size_t len) {
+    __json_before_value(writer);
+    __json_write_string(writer, value, len);
+}
+
+void json_int(json_writer_t* writer, long long value) {
+    __json_before_value(writer);
+
+    // digits are produced from the end, with the magnitude taken unsigned so
+    // that LLONG_MIN does not overflow
+    char digits[JSON_MAX_NUMBER_LENGTH];
+    char* p = digits + sizeof(digits);
+    unsigned long long magnitude = value < 0
+        ? 0ULL - (unsigned long long) value : (unsigned long long) value;
+
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while ( magnitude );
+
+    if ( value < 0 ) { *--p = '-'; }
+    __json_put(writer, p, digits + sizeof(digits) - p);
+}
+
+void json_double(json_writer_t* writer, double value) {
+    if ( !isfinite(value) ) {
+        json_null(writer);
+        return;
+    }
+
+    __json_before_value(writer);
+    __json_reserve(writer, JSON_MAX_NUMBER_LENGTH);
+
+    // the shorter form is used whenever it reads back as the same number
+    char* out = writer->buf + writer->len;
+    int len = snprintf(out, JSON_MAX_NUMBER_LENGTH, "%.15g", value);
+    if ( strtod(out, NULL) != value )
+        len = snprintf(out, JSON_MAX_NUMBER_LENGTH, "%.17g", value);
+
+    writer->len += len;
+}
+
+void json_bool(json_writer_t* writer, int value) {
+    __json_before_value(writer);
+    if ( value ) { __json_put(writer, "true", 4); }
+    else { __json_put(writer, "false", 5); }
+}
+
+void json_null(json_writer_t* writer) {
+    __json_before_value(writer);
+    __json_put(writer, "null", 4);
+}
+
+response_t* json_finish(json_writer_t* writer, http_status status) {
+    if ( writer->depth || writer->after_key || !writer->len )
+        errx(EXIT_FAILURE, "json: finished before the value was complete");
+
+    // the body stays NUL-terminated like every other string body
+    __json_put(writer, "", 1);
+    response_t* response = response_from_owned_buffer(status, writer->buf, writer->len - 1);
+    response_set_content_type(response, CONTENT_TYPE_JSON);
+
+    free(writer);
+    return response;
+}
\ No newline at end of file
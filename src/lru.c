@@ -0,0 +1,33 @@
+#include "lru.h"
+
+void lru_unlink(lru_list_t* list, lru_node_t* node) {
+    if ( node->prev ) { node->prev->next = node->next; }
+    else { list->most_recent = node->next; }
+
+    if ( node->next ) { node->next->prev = node->prev; }
+    else { list->least_recent = node->prev; }
+
+    node->prev = node->next = NULL;
+}
+
+void lru_push_front(lru_list_t* list, lru_node_t* node) {
+    node->prev = NULL;
+    node->next = list->most_recent;
+    if ( list->most_recent ) { list->most_recent->prev = node; }
+    list->most_recent = node;
+
+    if ( !list->least_recent ) { list->least_recent = node; }
+}
+
+void lru_touch(lru_list_t* list, lru_node_t* node) {
+    lru_unlink(list, node);
+    lru_push_front(list, node);
+}
+
+void* lru_shallow_copy(void* ptr) {
+    return ptr;
+}
+
+void lru_shallow_destroy(void* ptr) {
+    (void) ptr;
+}
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include "microcache.h"
+
+#ifndef __DISABLE_MICROCACHE__
+#include "dictionary.h"
+#include "lru.h"
+#include "format.h"
+
+#include <strings.h>
+#include <string.h>
+#include <err.h>
+
+#define DEFAULT_DICT_CAPACITY 16
+#define MAX_GATHER_IOVECS 64
+
+static const char* CACHE_CONTROL_HEADER_KEY = "Cache-Control";
+
+// This struct is a response cached by the microcache. Entries are kept in an
+// lru_list_t ordered from most to least recently used.
+typedef struct _microcache_entry {
+    lru_node_t node; // must come first
+    char* key;
+    refbuf_t* body;
+    char* fields[NUM_RESPONSE_HEADER_FIELDS];
+    char** headers;      // the other headers as key, value, key, value, ...
+    size_t num_headers;
+    time_t last_modified;
+    http_status status;
+    struct timespec expires; // CLOCK_MONOTONIC
+    size_t cost;             // what the entry counts against the byte cap
+} microcache_entry_t;
+
+static dictionary* entries = NULL;  // (char*) -> (microcache_entry_t*)
+static lru_list_t lru = { NULL, NULL };
+static size_t bytes_cached = 0;
+static size_t num_entries = 0;
+
+static char** __microcache_copy_names(const char** names) {
+    if ( !names ) { return NULL; }
+
+    size_t n = 0;
+    while ( names[n] ) { ++n; }
+
+    char** copy = calloc(n + 1, sizeof(char*));
+    for (size_t i = 0; i < n; ++i)
+        copy[i] = strdup(names[i]);
+
+    return copy;
+}
+
+static void __microcache_free_names(const char** names) {
+    for (size_t i = 0; names && names[i]; ++i)
+        free((void*) names[i]);
+
+    free(names);
+}
+
+microcache_policy_t* microcache_policy_copy(const microcache_policy_t* policy) {
+    if ( !policy )
+        errx(EXIT_FAILURE, "Cannot copy a NULL microcache policy");
+
+    microcache_policy_t* copy = malloc(sizeof(microcache_policy_t));
+    copy->ttl_ms = policy->ttl_ms;
+    copy->params = (const char**) __microcache_copy_names(policy->params);
+    copy->headers = (const char**) __microcache_copy_names(policy->headers);
+
+    return copy;
+}
+
+void microcache_policy_destroy(microcache_policy_t* policy) {
+    __microcache_free_names(policy->params);
+    __microcache_free_names(policy->headers);
+    free(policy);
+}
+
+static void __microcache_entry_destroy(microcache_entry_t* entry) {
+    refbuf_release(entry->body);
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i)
+        free(entry->fields[i]);
+
+    for (size_t i = 0; i < entry->num_headers * 2; ++i)
+        free(entry->headers[i]);
+
+    free(entry->headers);
+    free(entry->key);
+    free(entry);
+}
+
+static void __microcache_evict(microcache_entry_t* entry) {
+    lru_unlink(&lru, &entry->node);
+    dictionary_remove(entries, entry->key);
+
+    bytes_cached -= entry->cost;
+    --num_entries;
+    __microcache_entry_destroy(entry);
+}
+
+// Count everything an entry holds on to: its body, key and header copies, plus
+// MICROCACHE_ENTRY_COST for the entry itself and its dictionary slot.
+static size_t __microcache_entry_cost(const microcache_entry_t* entry) {
+    size_t cost = entry->body->len + strlen(entry->key) + 1 + MICROCACHE_ENTRY_COST;
+
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i)
+        cost += entry->fields[i] ? strlen(entry->fields[i]) + 1 : 0;
+
+    for (size_t i = 0; i < entry->num_headers * 2; ++i)
+        cost += strlen(entry->headers[i]) + 1 + sizeof(char*);
+
+    return cost;
+}
+
+// Append a named value to the key being built. Values are length-prefixed so
+// that no value can be mistaken for a separator.
+static int __microcache_key_append(char* key, size_t* len, const char* name, const char* value) {
+    int n = value
+        ? snprintf(key + *len, MICROCACHE_MAX_KEY_SIZE - *len, "\n%s:%zu:%s", name, strlen(value), value)
+        : snprintf(key + *len, MICROCACHE_MAX_KEY_SIZE - *len, "\n%s!", name);
+
+    *len += n;
+    return *len < MICROCACHE_MAX_KEY_SIZE ? 0 : -1;
+}
+
+// Build the key a request is cached under. Returns -1 if it is too long.
+static int __microcache_key(
+        request_t* request, const microcache_policy_t* policy, char* key) {
+    size_t len = snprintf(key, MICROCACHE_MAX_KEY_SIZE, "%s %s",
+        http_method_to_string(request->method), request->path);
+    if ( len >= MICROCACHE_MAX_KEY_SIZE ) { return -1; }
+
+    for (size_t i = 0; policy->params && policy->params[i]; ++i) {
+        const char* name = policy->params[i];
+        const char* value = request->params && dictionary_contains(request->params, (void*) name)
+            ? dictionary_get(request->params, (void*) name) : NULL;
+
+        if ( __microcache_key_append(key, &len, name, value) ) { return -1; }
+    }
+
+    for (size_t i = 0; policy->headers && policy->headers[i]; ++i) {
+        const char* name = policy->headers[i];
+        const char* value = dictionary_contains(request->headers, (void*) name)
+            ? dictionary_get(request->headers, (void*) name) : NULL;
+
+        if ( __microcache_key_append(key, &len, name, value) ) { return -1; }
+    }
+
+    return 0;
+}
+
+static inline int __microcache_is_expired(
+        const microcache_entry_t* entry, const struct timespec* now) {
+    return now->tv_sec > entry->expires.tv_sec
+        || (now->tv_sec == entry->expires.tv_sec && now->tv_nsec >= entry->expires.tv_nsec);
+}
+
+// Construct a response from a cache entry. The body is shared, not copied.
+static response_t* __microcache_response(const microcache_entry_t* entry) {
+    response_t* response = response_from_shared(entry->status, entry->body);
+    response->last_modified = entry->last_modified;
+
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i)
+        response->fields[i] = entry->fields[i] ? strdup(entry->fields[i]) : NULL;
+
+    for (size_t i = 0; i < entry->num_headers; ++i)
+        response_set_header(response, entry->headers[2 * i], entry->headers[2 * i + 1]);
+
+    return response;
+}
+
+static int __microcache_is_cacheable(response_t* response) {
+    if ( response->status != STATUS_OK || response->preserialized ) { return 0; }
+    if ( response->rt != RT_STRING && response->rt != RT_IOVEC ) { return 0; }
+    if ( response->content_length > MICROCACHE_MAX_BODY_SIZE ) { return 0; }
+
+    const char* cache_control = response_get_header(response, CACHE_CONTROL_HEADER_KEY);
+    return !cache_control
+        || (!strcasestr(cache_control, "no-store") && !strcasestr(cache_control, "private"));
+}
+
+// Move the body of a response into a refbuf that the response and the cache
+// share. Bodies that already are a refbuf are kept as they are.
+static refbuf_t* __microcache_share_body(response_t* response) {
+    if ( response->ownership == BO_SHARED && response->rt == RT_STRING
+            && response->body_offset == 0 && response->content_length == response->shared_body->len )
+        return refbuf_retain(response->shared_body);
+
+    refbuf_t* body = refbuf_create(NULL, response->content_length);
+    if ( response->rt == RT_STRING ) {
+        memcpy(body->data, response->body_content.body + response->body_offset, body->len);
+    } else {
+        struct iovec iov[MAX_GATHER_IOVECS];
+        size_t copied = 0;
+        while ( copied < body->len ) {
+            int iovcnt = response_body_iovec(response, copied, iov, MAX_GATHER_IOVECS);
+            for (int i = 0; i < iovcnt; ++i) {
+                memcpy(body->data + copied, iov[i].iov_base, iov[i].iov_len);
+                copied += iov[i].iov_len;
+            }
+        }
+    }
+
+    response_set_shared_body(response, body);
+    return body;
+}
+
+// Remember a response under key until the policy's TTL runs out
+static void __microcache_store(const char* key, response_t* response,
+        const microcache_policy_t* policy, const struct timespec* now) {
+    if ( !entries ) {
+        entries = dictionary_create_with_capacity(
+            DEFAULT_DICT_CAPACITY, string_hash_function, string_compare,
+            string_copy_constructor, string_destructor,
+            lru_shallow_copy, lru_shallow_destroy
+        );
+    }
+
+    microcache_entry_t* entry = calloc(1, sizeof(microcache_entry_t));
+    entry->key = strdup(key);
+    entry->body = __microcache_share_body(response);
+    entry->status = response->status;
+    entry->last_modified = response->last_modified;
+
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i)
+        entry->fields[i] = response->fields[i] ? strdup(response->fields[i]) : NULL;
+
+    if ( response->headers ) {
+        vector* keys = dictionary_keys(response->headers);
+        entry->num_headers = vector_size(keys);
+        entry->headers = malloc(entry->num_headers * 2 * sizeof(char*));
+
+        for (size_t i = 0; i < entry->num_headers; ++i) {
+            char* name = vector_get(keys, i);
+            entry->headers[2 * i] = strdup(name);
+            entry->headers[2 * i + 1] = strdup(dictionary_get(response->headers, name));
+        }
+
+        vector_destroy(keys);
+    }
+
+    entry->expires.tv_sec = now->tv_sec + policy->ttl_ms / 1000;
+    entry->expires.tv_nsec = now->tv_nsec + (policy->ttl_ms % 1000) * 1000000L;
+    if ( entry->expires.tv_nsec >= 1000000000L ) {
+        ++entry->expires.tv_sec;
+        entry->expires.tv_nsec -= 1000000000L;
+    }
+
+    entry->cost = __microcache_entry_cost(entry);
+    if ( entry->cost > MICROCACHE_MAX_BYTES ) {
+        __microcache_entry_destroy(entry);
+        return;
+    }
+
+    // entries that were never asked for again would otherwise linger until the
+    // caps push them out
+    while ( lru.least_recent 
+            && __microcache_is_expired((microcache_entry_t*) lru.least_recent, now) )
+        __microcache_evict((microcache_entry_t*) lru.least_recent);
+
+    while ( lru.least_recent && (bytes_cached + entry->cost > MICROCACHE_MAX_BYTES
+            || num_entries >= MICROCACHE_MAX_ENTRIES) )
+        __microcache_evict((microcache_entry_t*) lru.least_recent);
+
+    dictionary_set(entries, entry->key, entry);
+    lru_push_front(&lru, &entry->node);
+    bytes_cached += entry->cost;
+    ++num_entries;
+}
+
+response_t* microcache_serve(request_t* request) {
+    const microcache_policy_t* policy = NULL;
+    route_handler_t handler = find_request_handler(request, &policy);
+    if ( !policy || (request->method != HTTP_GET && request->method != HTTP_HEAD) )
+        return handler(request);
+
+    char key[MICROCACHE_MAX_KEY_SIZE];
+    if ( __microcache_key(request, policy, key) ) { return handler(request); }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if ( entries && dictionary_contains(entries, key) ) {
+        microcache_entry_t* entry = dictionary_get(entries, key);
+        if ( !__microcache_is_expired(entry, &now) ) {
+            lru_touch(&lru, &entry->node);
+            return __microcache_response(entry);
+        }
+
+        __microcache_evict(entry);
+    }
+
+    // Handlers run to completion on the event loop, so no identical request
+    // can be served while this one fills the entry: every request after it
+    // finds the entry instead of calling the handler again.
+    response_t* response = handler(request);
+    if ( response && __microcache_is_cacheable(response) )
+        __microcache_store(key, response, policy, &now);
+
+    return response;
+}
+
+void microcache_clear(void) {
+    while ( lru.least_recent )
+        __microcache_evict((microcache_entry_t*) lru.least_recent);
+
+    if ( entries ) {
+        dictionary_destroy(entries);
+        entries = NULL;
+    }
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "multipart.h"
+#include "io_utils.h"
+#include "format.h"
+
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+
+#define INITIAL_PART_CAPACITY (1UL << 10UL)
+
+static const char* MULTIPART_FORM_DATA = "multipart/form-data";
+static const char* CONTENT_DISPOSITION_HEADER_KEY = "Content-Disposition:";
+
+char* multipart_parse_boundary(const char* content_type) {
+    static const char* BOUNDARY_PARAM = "boundary=";
+
+    if ( !content_type ) { return NULL; }
+    if ( strncasecmp(content_type, MULTIPART_FORM_DATA, strlen(MULTIPART_FORM_DATA)) )
+        return NULL;
+
+    const char* param = strcasestr(content_type, BOUNDARY_PARAM);
+    if ( !param ) { return NULL; }
+    param += strlen(BOUNDARY_PARAM);
+
+    size_t len = 0;
+    if ( *param == '"' ) {
+        const char* close_quote = strchr(++param, '"');
+        if ( !close_quote ) { return NULL; }
+        len = close_quote - param;
+    } else {
+        len = strcspn(param, "; \t");
+    }
+
+    if ( len == 0 || len > MULTIPART_MAX_BOUNDARY_LENGTH )
+        return NULL;
+
+    return strndup(param, len);
+}
+
+multipart_parser_t* multipart_parser_create(const char* boundary, dictionary* form) {
+    if ( !boundary || !*boundary || strlen(boundary) > MULTIPART_MAX_BOUNDARY_LENGTH )
+        errx(EXIT_FAILURE, "Multipart boundaries must be 1 to %d characters long", 
+            MULTIPART_MAX_BOUNDARY_LENGTH);
+
+    multipart_parser_t* this = malloc(sizeof(multipart_parser_t));
+    this->form = form;
+    this->part = NULL;
+    this->part_name = NULL;
+    this->part_capacity = 0;
+    this->headers_len = 0;
+    this->tail = '\0';
+    this->state = MPS_PREAMBLE;
+
+    // the delimiter is only ever compared with memcmp, so it is not terminated
+    size_t boundary_len = strlen(boundary);
+    memcpy(this->delimiter, "\r\n--", 4);
+    memcpy(this->delimiter + 4, boundary, boundary_len);
+    this->delimiter_len = boundary_len + 4;
+
+    // Boyer-Moore-Horspool: shift by the distance from the last occurrence of
+    // a byte to the end of the delimiter, or the full length if it is absent
+    size_t m = this->delimiter_len;
+    for (size_t i = 0; i < 256; ++i)
+        this->skip[i] = m;
+    for (size_t i = 0; i < m - 1; ++i)
+        this->skip[(unsigned char) this->delimiter[i]] = m - 1 - i;
+
+    // The first delimiter is not preceded by a CRLF, so pretend we saw one.
+    memcpy(this->carry, "\r\n", 2);
+    this->carry_len = 2;
+
+    return this;
+}
+
+void multipart_parser_destroy(multipart_parser_t* parser) {
+    if ( parser->part )
+        request_destroy_body(parser->part);
+
+    if ( parser->part_name )
+        free(parser->part_name);
+
+    free(parser);
+}
+
+// Find the leftmost delimiter in buf with a Boyer-Moore-Horspool search.
+static const char* __multipart_find_delimiter(
+        multipart_parser_t* parser, const char* buf, size_t len) {
+    const char* delimiter = parser->delimiter;
+    size_t m = parser->delimiter_len;
+    size_t i = 0;
+
+    while ( i + m <= len ) {
+        unsigned char last = buf[i + m - 1];
+        if ( last == (unsigned char) delimiter[m - 1]
+                && !memcmp(buf + i, delimiter, m - 1) )
+            return buf + i;
+        i += parser->skip[last];
+    }
+
+    return NULL;
+}
+
+// Pull the name="..." parameter out of the part's Content-Disposition header.
+char* __multipart_parse_part_name(char* headers) {
+    static const char* NAME_PARAM = "name=";
+    char* line = NULL;
+
+    while ( ( line = strsep(&headers, CRLF) ) ) {
+        if ( strncasecmp(line, CONTENT_DISPOSITION_HEADER_KEY,
+                strlen(CONTENT_DISPOSITION_HEADER_KEY)) )
+            continue;
+
+        // make sure we do not confuse filename= for name=
+        char* param = line;
+        while ( ( param = strcasestr(param, NAME_PARAM) ) ) {
+            if ( param[-1] == ';' || param[-1] == ' ' || param[-1] == '\t' )
+                break;
+            param += strlen(NAME_PARAM);
+        }
+
+        if ( !param ) { return NULL; }
+        param += strlen(NAME_PARAM);
+
+        if ( *param == '"' ) {
+            char* close_quote = strchr(++param, '"');
+            return close_quote ? strndup(param, close_quote - param) : NULL;
+        }
+
+        return strndup(param, strcspn(param, "; \t"));
+    }
+
+    return NULL;
+}
+
+void __multipart_begin_part(multipart_parser_t* parser) {
+    parser->part_name = __multipart_parse_part_name(parser->headers);
+    if ( !parser->part_name ) {
+        LOG("multipart part without a name");
+        parser->state = MPS_ERROR;
+        return;
+    }
+
+    parser->part_capacity = INITIAL_PART_CAPACITY;
+    parser->part = request_create_body(RQBT_STRING, INITIAL_PART_CAPACITY);
+    parser->part->length = 0;
+    parser->state = MPS_PART_BODY;
+}
+
+void __multipart_finish_part(multipart_parser_t* parser) {
+    request_body_t* part = parser->part;
+    if ( part->type == RQBT_FILE ) {
+        fflush(part->content.file);
+        rewind(part->content.file);
+    }
+
+    dictionary_set(parser->form, parser->part_name, part);
+    free(parser->part_name);
+    parser->part_name = NULL;
+    parser->part = NULL;
+}
+
+// Save bytes that belong to the current part, spilling it to a tmpfile once it
+// no longer fits in memory. Bytes in the preamble are simply dropped.
+void __multipart_emit(multipart_parser_t* parser, const char* buf, size_t len) {
+    request_body_t* part = parser->part;
+    if ( parser->state != MPS_PART_BODY || len == 0 ) { return; }
+
+    if ( part->type == RQBT_STRING
+            && part->length + len > MULTIPART_MAX_IN_MEMORY_PART )
+        request_convert_body_to_tmp_file(part);
+
+    if ( part->type == RQBT_FILE ) {
+        fwrite(buf, len, 1, part->content.file);
+    } else {
+        if ( part->length + len + 1 > parser->part_capacity ) {
+            while ( part->length + len + 1 > parser->part_capacity )
+                parser->part_capacity *= 2;
+            part->content.str = realloc(part->content.str, parser->part_capacity);
+        }
+
+        memcpy(part->content.str + part->length, buf, len);
+        part->content.str[part->length + len] = '\0';
+        part->__ptr += len;
+    }
+
+    part->length += len;
+}
+
+void __multipart_on_delimiter(multipart_parser_t* parser) {
+    if ( parser->state == MPS_PART_BODY )
+        __multipart_finish_part(parser);
+
+    parser->tail = '\0';
+    parser->state = MPS_BOUNDARY_TAIL;
+}
+
+// Consume part data (or preamble) up to and including the next delimiter. The
+// last few bytes of every chunk are held back in the carry buffer since they
+// could be the start of a delimiter that is split across two chunks.
+size_t __multipart_consume_data(multipart_parser_t* parser, const char* buf, size_t len) {
+    size_t m = parser->delimiter_len;
+
+    if ( parser->carry_len ) {
+        size_t carried = parser->carry_len;
+        size_t take = MIN(len, m - 1);
+        memcpy(parser->carry + carried, buf, take);
+
+        size_t window = carried + take;
+        const char* match = __multipart_find_delimiter(parser, parser->carry, window);
+
+        if ( match && (size_t) (match - parser->carry) < carried ) {
+            size_t pos = match - parser->carry;
+            __multipart_emit(parser, parser->carry, pos);
+            parser->carry_len = 0;
+            __multipart_on_delimiter(parser);
+            return pos + m - carried;
+        } else if ( window < carried + m - 1 ) {
+            // too few bytes to rule out a delimiter starting in the carry
+            size_t keep = MIN(window, m - 1);
+            __multipart_emit(parser, parser->carry, window - keep);
+            memmove(parser->carry, parser->carry + window - keep, keep);
+            parser->carry_len = keep;
+            return len;
+        }
+
+        // no delimiter starts in the carry, so it all belongs to the part
+        __multipart_emit(parser, parser->carry, carried);
+        parser->carry_len = 0;
+    }
+
+    const char* match = __multipart_find_delimiter(parser, buf, len);
+    if ( match ) {
+        size_t pos = match - buf;
+        __multipart_emit(parser, buf, pos);
+        __multipart_on_delimiter(parser);
+        return pos + m;
+    }
+
+    size_t keep = MIN(len, m - 1);
+    __multipart_emit(parser, buf, len - keep);
+    memcpy(parser->carry, buf + len - keep, keep);
+    parser->carry_len = keep;
+
+    return len;
+}
+
+// A delimiter is followed by either "--" (the last one) or CRLF, possibly
+// preceded by linear whitespace.
+size_t __multipart_consume_boundary_tail(
+        multipart_parser_t* parser, const char* buf, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        char c = buf[i];
+
+        if ( !parser->tail ) {
+            if ( c == ' ' || c == '\t' )
+                continue;
+
+            if ( c != '-' && c != '\r' ) {
+                parser->state = MPS_ERROR;
+                return i;
+            }
+
+            parser->tail = c;
+        } else if ( parser->tail == '-' && c == '-' ) {
+            parser->state = MPS_EPILOGUE;
+            return i + 1;
+        } else if ( parser->tail == '\r' && c == '\n' ) {
+            // keep the CRLF so an empty header block still ends in CRLFCRLF
+            memcpy(parser->headers, CRLF, 2);
+            parser->headers_len = 2;
+            parser->state = MPS_HEADERS;
+            return i + 1;
+        } else {
+            parser->state = MPS_ERROR;
+            return i;
+        }
+    }
+
+    return len;
+}
+
+size_t __multipart_consume_headers(multipart_parser_t* parser, const char* buf, size_t len) {
+    static const char* HEADERS_END = "\r\n\r\n";
+
+    size_t old_len = parser->headers_len;
+    size_t space = MULTIPART_MAX_HEADER_SIZE - old_len - 1;
+    size_t take = MIN(len, space);
+    size_t search_from = old_len >= 3 ? old_len - 3 : 0;
+
+    memcpy(parser->headers + old_len, buf, take);
+    parser->headers_len += take;
+
+    char* end = memmem(
+        parser->headers + search_from, parser->headers_len - search_from,
+        HEADERS_END, 4
+    );
+
+    if ( !end ) {
+        if ( take == space ) {
+            LOG("multipart part headers are too long");
+            parser->state = MPS_ERROR;
+        }
+
+        return take;
+    }
+
+    // keep the CRLF of the last header so every header line is terminated
+    end[2] = '\0';
+    size_t consumed = (end + 4 - parser->headers) - old_len;
+    __multipart_begin_part(parser);
+
+    return consumed;
+}
+
+int multipart_parser_feed(multipart_parser_t* parser, const char* buf, size_t len) {
+    size_t offset = 0;
+
+    while ( offset < len ) {
+        switch ( parser->state ) {
+            case MPS_PREAMBLE:
+            case MPS_PART_BODY:
+                offset += __multipart_consume_data(parser, buf + offset, len - offset);
+                break;
+            case MPS_BOUNDARY_TAIL:
+                offset += __multipart_consume_boundary_tail(parser, buf + offset, len - offset);
+                break;
+            case MPS_HEADERS:
+                offset += __multipart_consume_headers(parser, buf + offset, len - offset);
+                break;
+            case MPS_EPILOGUE:
+                return 0;
+            case MPS_ERROR:
+                return -1;
+        }
+    }
+
+    return parser->state == MPS_ERROR ? -1 : 0;
+}
+
+int multipart_parser_finish(multipart_parser_t* parser) {
+    return parser->state == MPS_EPILOGUE ? 0 : -1;
+}
@@ -0,0 +1,114 @@
+#include "outbox.h"
+#include "io_utils.h"
+#include "format.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string.h>
+#include <errno.h>
+
+refbuf_t* refbuf_create(const void* data, size_t len) {
+    refbuf_t* this = malloc(sizeof(refbuf_t) + len);
+    this->refcount = 1;
+    this->len = len;
+    if ( data )
+        memcpy(this->data, data, len);
+
+    return this;
+}
+
+refbuf_t* refbuf_retain(refbuf_t* buf) {
+    ++buf->refcount;
+    return buf;
+}
+
+void refbuf_release(refbuf_t* buf) {
+    if ( --buf->refcount == 0 )
+        free(buf);
+}
+
+void outbox_init(outbox_t* outbox, size_t capacity) {
+    outbox->entries = calloc(capacity, sizeof(refbuf_t*));
+    outbox->capacity = capacity;
+    outbox->head = 0;
+    outbox->length = 0;
+    outbox->offset = 0;
+    outbox->bytes_queued = 0;
+}
+
+void outbox_destroy(outbox_t* outbox) {
+    for (size_t i = 0; i < outbox->length; ++i)
+        refbuf_release(outbox->entries[(outbox->head + i) % outbox->capacity]);
+
+    free(outbox->entries);
+    outbox->entries = NULL;
+    outbox->length = 0;
+}
+
+int outbox_push(outbox_t* outbox, refbuf_t* buf) {
+    if ( outbox->length == outbox->capacity ) { return -1; }
+
+    size_t tail = (outbox->head + outbox->length) % outbox->capacity;
+    outbox->entries[tail] = refbuf_retain(buf);
+    outbox->bytes_queued += buf->len;
+    ++outbox->length;
+
+    return 0;
+}
+
+// Drop bytes that the socket accepted from the front of the outbox.
+void __outbox_consume(outbox_t* outbox, size_t bytes) {
+    outbox->bytes_queued -= bytes;
+
+    while ( bytes > 0 ) {
+        refbuf_t* head = outbox->entries[outbox->head];
+        size_t remaining = head->len - outbox->offset;
+
+        if ( bytes < remaining ) {
+            outbox->offset += bytes;
+            return;
+        }
+
+        bytes -= remaining;
+        refbuf_release(head);
+        outbox->offset = 0;
+        outbox->head = (outbox->head + 1) % outbox->capacity;
+        --outbox->length;
+    }
+}
+
+int outbox_flush(outbox_t* outbox, int fd) {
+    struct iovec iov[OUTBOX_MAX_IOVECS];
+
+    while ( outbox->length ) {
+        size_t count = MIN(outbox->length, (size_t) OUTBOX_MAX_IOVECS);
+        for (size_t i = 0; i < count; ++i) {
+            refbuf_t* buf = outbox->entries[(outbox->head + i) % outbox->capacity];
+            size_t skip = i == 0 ? outbox->offset : 0;
+            iov[i].iov_base = buf->data + skip;
+            iov[i].iov_len = buf->len - skip;
+        }
+
+        ssize_t written = writev(fd, iov, count);
+        if ( written < 0 ) {
+            if ( errno == EINTR ) { continue; }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+
+        __outbox_consume(outbox, written);
+    }
+
+    return 0;
+}
+
+int outbox_enqueue_or_drop(outbox_t* outbox, refbuf_t* buf, int fd, int flush_if_idle) {
+    int was_idle = outbox_is_empty(outbox);
+
+    if ( !outbox_push(outbox, buf) 
+            && !(was_idle && flush_if_idle && outbox_flush(outbox, fd)) )
+        return 0;
+
+    WARN("(fd=%d) dropping slow client", fd);
+    shutdown(fd, SHUT_RDWR);
+    return -1;
+}
\ No newline at end of file
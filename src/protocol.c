@@ -2,8 +2,13 @@
 #include "dictionary.h"
 #include "format.h"
 
+#include <strings.h>
+#include <string.h>
+
 const char* http_status_to_string(http_status status) {
     switch ( status ) {
+        case STATUS_SWITCHING_PROTOCOLS:
+            return "Switching Protocols";
         case STATUS_OK:
             return "OK";
         case STATUS_CREATED:
@@ -12,6 +17,8 @@ const char* http_status_to_string(http_status status) {
             return "Accepted";
         case STATUS_NO_CONTENT:
             return "No Content";
+        case STATUS_PARTIAL_CONTENT:
+            return "Partial Content";
         case STATUS_MOVED_PERMANENTLY:
             return "Moved Permanently";
         case STATUS_FOUND:
@@ -44,6 +51,8 @@ const char* http_status_to_string(http_status status) {
             return "URI Too Long";
         case STATUS_UNSUPPORTED_MEDIA_TYPE:
             return "Unsupported Media Type";
+        case STATUS_RANGE_NOT_SATISFIABLE:
+            return "Range Not Satisfiable";
         case STATUS_IM_A_TEAPOT:
             return "I'm a teapot";
         case STATUS_TOO_MANY_REQUESTS:
@@ -92,32 +101,59 @@ const char* http_method_to_string(http_method method) {
     }
 }
 
+http_method http_method_from_string(const char* method) {
+    // hash the string value and compare against known hash values to avoid many 
+    // calls to strncmp since HTTP methods ARE case sensitive
+    switch ( string_hash_function((void*) method) ) {
+        case 193456677UL:
+            return HTTP_GET;
+        case 6384105719UL:
+            return HTTP_HEAD;
+        case 6384404715UL:
+            return HTTP_POST;
+        case 193467006UL:
+            return HTTP_PUT;
+        case 6952134985656UL:
+            return HTTP_DELETE;
+        case 229419557091567UL:
+            return HTTP_CONNECT;
+        case 229435100789681UL:
+            return HTTP_OPTIONS;
+        case 210690186996UL:
+            return HTTP_TRACE;
+        default:
+            return HTTP_UNKNOWN;
+    }
+}
+
+// Maps an ASCII hex digit to its value, or -1 for any other byte
+static const char HEX_DECODE_TABLE[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+     0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+    -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
 // Adapted from https://stackoverflow.com/a/30895866
 int url_decode(char* out, const char* in) {
-    static const char tbl[256] = {
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-         0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
-        -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-    };
     char c, v1, v2, *beg=out;
     if(in != NULL) {
         while((c=*in++) != '\0') {
             if(c == '%') {
-                if((v1=tbl[(unsigned char)*in++])<0 || 
-                   (v2=tbl[(unsigned char)*in++])<0) {
+                if((v1=HEX_DECODE_TABLE[(unsigned char)*in++])<0 || 
+                   (v2=HEX_DECODE_TABLE[(unsigned char)*in++])<0) {
                     *beg = '\0';
                     return -1;
                 }
@@ -128,4 +164,109 @@ int url_decode(char* out, const char* in) {
     }
     *out = '\0';
     return 0;
+}
+
+int form_url_decode(char* out, const char* in) {
+    char c, v1, v2, *beg=out;
+    while((c=*in++) != '\0') {
+        if(c == '+') {
+            c = ' ';
+        } else if(c == '%') {
+            if((v1=HEX_DECODE_TABLE[(unsigned char)*in++])<0 || 
+               (v2=HEX_DECODE_TABLE[(unsigned char)*in++])<0) {
+                *beg = '\0';
+                return -1;
+            }
+            c = (v1<<4)|v2;
+        }
+        *out++ = c;
+    }
+    *out = '\0';
+    return out - beg;
+}
+
+int http_header_has_token(const char* value, const char* token) {
+    if ( !value ) { return 0; }
+
+    size_t len = strlen(token);
+    const char* match = value;
+
+    while ( ( match = strcasestr(match, token) ) ) {
+        int starts = match == value || match[-1] == ',' || match[-1] == ' ';
+        int ends = !match[len] || match[len] == ',' || match[len] == ' ';
+        if ( starts && ends ) { return 1; }
+        match += len;
+    }
+
+    return 0;
+}
+
+int http_accepts_encoding(const char* value, const char* coding) {
+    if ( !value ) { return 0; }
+
+    size_t len = strlen(coding);
+    const char* element = value;
+
+    while ( *element ) {
+        element += strspn(element, " \t,");
+        size_t element_len = strcspn(element, ",");
+
+        if ( !strncasecmp(element, coding, len) 
+                && strchr(" \t;,", element[len]) ) {
+            // the coding is accepted unless its qvalue is zero
+            const char* q = memchr(element, ';', element_len);
+            if ( !q ) { return 1; }
+
+            q = strcasestr(q, "q=");
+            return !q || q >= element + element_len || strtod(q + 2, NULL) > 0;
+        }
+
+        element += element_len;
+    }
+
+    return 0;
+}
+
+// This struct maps a file extension to the content type it is served with.
+typedef struct _content_type_mapping {
+    const char* extension;
+    const char* content_type;
+} content_type_mapping_t;
+
+static const content_type_mapping_t CONTENT_TYPES[] = {
+    { "html",  CONTENT_TYPE_HTML },
+    { "htm",   CONTENT_TYPE_HTML },
+    { "css",   CONTENT_TYPE_CSS },
+    { "js",    CONTENT_TYPE_JS },
+    { "mjs",   CONTENT_TYPE_JS },
+    { "json",  CONTENT_TYPE_JSON },
+    { "txt",   CONTENT_TYPE_PLAIN },
+    { "csv",   CONTENT_TYPE_CSV },
+    { "xml",   CONTENT_TYPE_XML },
+    { "png",   CONTENT_TYPE_PNG },
+    { "jpg",   CONTENT_TYPE_JPEG },
+    { "jpeg",  CONTENT_TYPE_JPEG },
+    { "gif",   CONTENT_TYPE_GIF },
+    { "svg",   CONTENT_TYPE_SVG },
+    { "ico",   CONTENT_TYPE_ICO },
+    { "webp",  CONTENT_TYPE_WEBP },
+    { "wasm",  CONTENT_TYPE_WASM },
+    { "woff2", CONTENT_TYPE_WOFF2 },
+    { "pdf",   CONTENT_TYPE_PDF },
+    { "zip",   CONTENT_TYPE_ZIP }
+};
+
+#define NUM_CONTENT_TYPES (sizeof(CONTENT_TYPES) / sizeof(CONTENT_TYPES[0]))
+
+const char* content_type_from_extension(const char* path) {
+    const char* slash = strrchr(path, '/');
+    const char* dot = strrchr(slash ? slash : path, '.');
+    if ( !dot ) { return CONTENT_TYPE_OCTET_STREAM; }
+
+    for (size_t i = 0; i < NUM_CONTENT_TYPES; ++i) {
+        if ( !strcasecmp(dot + 1, CONTENT_TYPES[i].extension) )
+            return CONTENT_TYPES[i].content_type;
+    }
+
+    return CONTENT_TYPE_OCTET_STREAM;
 }
\ No newline at end of file
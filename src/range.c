@@ -0,0 +1,269 @@
+#include "range.h"
+
+#ifndef __DISABLE_RANGE_REQUESTS__
+#include "format.h"
+
+#include <strings.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define BOUNDARY_BUFFER_SIZE 32
+#define CONTENT_RANGE_BUFFER_SIZE 64
+
+static const char* RANGE_HEADER_KEY = "Range";
+static const char* IF_RANGE_HEADER_KEY = "If-Range";
+static const char* ACCEPT_RANGES_HEADER_KEY = "Accept-Ranges";
+static const char* CONTENT_RANGE_HEADER_KEY = "Content-Range";
+static const char* CONTENT_TYPE_HEADER_KEY = "Content-Type";
+static const char* ETAG_HEADER_KEY = "ETag";
+static const char* BYTES_UNIT = "bytes";
+
+// Format: (first byte, last byte, complete length)
+static const char* CONTENT_RANGE_FMT = "bytes %zu-%zu/%zu";
+
+// This struct is an inclusive range of bytes in a response body.
+typedef struct _byte_range {
+    size_t first;
+    size_t last;
+} byte_range_t;
+
+static unsigned int boundaries_generated = 0;
+
+static inline const char* __range_request_header(request_t* request, const char* key) {
+    if ( !dictionary_contains(request->headers, (void*) key) ) { return NULL; }
+    return dictionary_get(request->headers, (void*) key);
+}
+
+// Only bodies that come from a file have validators to resume against
+static inline int __range_is_rangeable(response_t* response) {
+    return response->status == STATUS_OK
+        && (response->rt == RT_FILE || response->rt == RT_STRING)
+        && response->content_length != SIZE_MAX && !response->preserialized
+        && (response->rt == RT_FILE || response->fields[RHF_ETAG]
+            || response->last_modified != (time_t) -1);
+}
+
+// Parse a decimal byte position. Returns a pointer past the digits, or NULL if
+// there are none or the number overflows.
+static const char* __range_parse_position(const char* s, size_t* position) {
+    if ( *s < '0' || *s > '9' ) { return NULL; }
+
+    size_t value = 0;
+    for (; *s >= '0' && *s <= '9'; ++s) {
+        if ( value > (SIZE_MAX - 9) / 10 ) { return NULL; }
+        value = value * 10 + (*s - '0');
+    }
+
+    *position = value;
+    return s;
+}
+
+// Parse a Range header value against a body of the given length. Returns the
+// number of satisfiable ranges stored in ranges, which may be 0, or -1 if the
+// header is malformed or asks for too many ranges and should be ignored.
+static int __range_parse(const char* value, size_t length, byte_range_t* ranges) {
+    size_t unit_len = strlen(BYTES_UNIT);
+    if ( strncasecmp(value, BYTES_UNIT, unit_len) || value[unit_len] != '=' )
+        return -1;
+
+    const char* spec = value + unit_len + 1;
+    int num_specs = 0;
+    int num_ranges = 0;
+
+    while ( *spec ) {
+        spec += strspn(spec, " \t");
+        if ( ++num_specs > RANGE_MAX_PARTS ) { return -1; }
+
+        size_t first = 0, last = length - 1;
+        if ( *spec == '-' ) {
+            // a suffix range asks for the last n bytes
+            size_t suffix = 0;
+            if ( !( spec = __range_parse_position(spec + 1, &suffix) ) ) { return -1; }
+            if ( !suffix || !length ) { goto next; }
+
+            first = suffix < length ? length - suffix : 0;
+        } else {
+            if ( !( spec = __range_parse_position(spec, &first) ) || *spec++ != '-' )
+                return -1;
+
+            if ( *spec >= '0' && *spec <= '9' ) {
+                size_t requested_last = 0;
+                spec = __range_parse_position(spec, &requested_last);
+                if ( !spec || requested_last < first ) { return -1; }
+                if ( requested_last < last ) { last = requested_last; }
+            }
+
+            if ( first >= length ) { goto next; }
+        }
+
+        ranges[num_ranges].first = first;
+        ranges[num_ranges].last = last;
+        ++num_ranges;
+
+next:
+        spec += strspn(spec, " \t");
+        if ( *spec == ',' ) { ++spec; }
+        else if ( *spec ) { return -1; }
+    }
+
+    return num_specs ? num_ranges : -1;
+}
+
+// Check If-Range, which only lets a range through if the client's copy is
+// still current. Entity tags must match exactly (a strong comparison).
+static int __range_if_range_matches(request_t* request, response_t* response) {
+    const char* value = __range_request_header(request, IF_RANGE_HEADER_KEY);
+    if ( !value ) { return 1; }
+
+    if ( value[0] == '"' ) {
+        const char* etag = response->fields[RHF_ETAG];
+        return etag && !strcmp(value, etag);
+    }
+
+    time_t date = parse_time_str(value);
+    return date != (time_t) -1 && date == response->last_modified;
+}
+
+// Copy a range of the body of a response into dest
+static int __range_copy(response_t* response, const byte_range_t* range, char* dest) {
+    size_t len = range->last - range->first + 1;
+    size_t offset = response->body_offset + range->first;
+
+    if ( response->rt == RT_STRING ) {
+        memcpy(dest, response->body_content.body + offset, len);
+        return 0;
+    }
+
+    int fd = fileno(response->body_content.file);
+    size_t total = 0;
+    while ( total < len ) {
+        ssize_t bytes_read = pread(fd, dest + total, len - total, offset + total);
+        if ( bytes_read == -1 && errno == EINTR ) { continue; }
+        if ( bytes_read <= 0 ) { return -1; }
+        total += bytes_read;
+    }
+
+    return 0;
+}
+
+// Format the part header that precedes a range of a multipart/byteranges body
+static char* __range_part_header(const char* boundary, const char* content_type,
+        const byte_range_t* range, size_t length, size_t* len) {
+    char content_range[CONTENT_RANGE_BUFFER_SIZE];
+    snprintf(content_range, sizeof(content_range), CONTENT_RANGE_FMT,
+        range->first, range->last, length);
+
+    char* header = NULL;
+    int header_len = asprintf(&header, "%s--%s%s%s%s%s%s%s: %s%s%s",
+        CRLF, boundary, CRLF,
+        content_type ? CONTENT_TYPE_HEADER_KEY : "", content_type ? ": " : "",
+        content_type ? content_type : "", content_type ? CRLF : "",
+        CONTENT_RANGE_HEADER_KEY, content_range, CRLF, CRLF);
+    if ( header_len < 0 ) { err(EXIT_FAILURE, "failed to format part header"); }
+
+    *len = header_len;
+    return header;
+}
+
+// Replace the body with a multipart/byteranges body holding every range.
+// Returns -1 (leaving the response alone) if it would be too large.
+static int __range_make_multipart(response_t* response, const byte_range_t* ranges,
+        int num_ranges) {
+    char boundary[BOUNDARY_BUFFER_SIZE];
+    snprintf(boundary, sizeof(boundary), "%08lx%08x",
+        (unsigned long) cached_time(), ++boundaries_generated);
+
+    const char* content_type = response->fields[RHF_CONTENT_TYPE];
+    size_t length = response->content_length;
+
+    char* headers[RANGE_MAX_PARTS];
+    size_t header_lens[RANGE_MAX_PARTS];
+    size_t total = 0;
+    for (int i = 0; i < num_ranges; ++i) {
+        headers[i] = __range_part_header(boundary, content_type, &ranges[i], length,
+            &header_lens[i]);
+        total += header_lens[i] + ranges[i].last - ranges[i].first + 1;
+    }
+
+    // the closing delimiter: CRLF "--" boundary "--" CRLF
+    char closing[BOUNDARY_BUFFER_SIZE + 8];
+    size_t closing_len = snprintf(closing, sizeof(closing), "%s--%s--%s", CRLF, boundary, CRLF);
+    total += closing_len;
+
+    refbuf_t* body = total <= RANGE_MAX_MULTIPART_SIZE ? refbuf_create(NULL, total) : NULL;
+    char* p = body ? body->data : NULL;
+    for (int i = 0; i < num_ranges; ++i) {
+        if ( body ) {
+            memcpy(p, headers[i], header_lens[i]);
+            p += header_lens[i];
+
+            if ( __range_copy(response, &ranges[i], p) ) {
+                refbuf_release(body);
+                body = NULL;
+            } else {
+                p += ranges[i].last - ranges[i].first + 1;
+            }
+        }
+
+        free(headers[i]);
+    }
+
+    if ( !body ) { return -1; }
+    memcpy(p, closing, closing_len);
+
+    char multipart_type[sizeof(CONTENT_TYPE_MULTIPART_BYTERANGES) + BOUNDARY_BUFFER_SIZE + 16];
+    snprintf(multipart_type, sizeof(multipart_type), "%s; boundary=%s",
+        CONTENT_TYPE_MULTIPART_BYTERANGES, boundary);
+
+    response_set_shared_body(response, body);
+    refbuf_release(body);
+    response_set_content_type(response, multipart_type);
+
+    return 0;
+}
+
+void response_try_apply_range(response_t** response, request_t* request) {
+    response_t* r = *response;
+    if ( !__range_is_rangeable(r) ) { return; }
+
+    response_set_header(r, ACCEPT_RANGES_HEADER_KEY, BYTES_UNIT);
+
+    const char* value = __range_request_header(request, RANGE_HEADER_KEY);
+    if ( !value || !__range_if_range_matches(request, r) ) { return; }
+
+    byte_range_t ranges[RANGE_MAX_PARTS];
+    size_t length = r->content_length;
+    int num_ranges = __range_parse(value, length, ranges);
+    if ( num_ranges < 0 ) { return; }
+
+    char content_range[CONTENT_RANGE_BUFFER_SIZE];
+    if ( num_ranges == 0 ) {
+        response_t* unsatisfiable = response_empty(STATUS_RANGE_NOT_SATISFIABLE);
+        snprintf(content_range, sizeof(content_range), "bytes */%zu", length);
+        response_set_header(unsatisfiable, CONTENT_RANGE_HEADER_KEY, content_range);
+
+        if ( r->fields[RHF_ETAG] )
+            response_set_header(unsatisfiable, ETAG_HEADER_KEY, r->fields[RHF_ETAG]);
+
+        response_destroy(r);
+        *response = unsatisfiable;
+        return;
+    }
+
+    if ( num_ranges == 1 ) {
+        // the send paths start at body_offset, so nothing is copied
+        snprintf(content_range, sizeof(content_range), CONTENT_RANGE_FMT,
+            ranges[0].first, ranges[0].last, length);
+        response_set_header(r, CONTENT_RANGE_HEADER_KEY, content_range);
+
+        r->body_offset += ranges[0].first;
+        r->content_length = ranges[0].last - ranges[0].first + 1;
+    } else if ( __range_make_multipart(r, ranges, num_ranges) ) {
+        return;
+    }
+
+    r->status = STATUS_PARTIAL_CONTENT;
+}
+#endif
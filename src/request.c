@@ -1,6 +1,17 @@
+#include "multipart.h"
 #include "request.h"
 #include "format.h"
 
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define DEFAULT_FORM_CAPACITY 8
+
+static char* CONTENT_TYPE_HEADER_KEY = "Content-Type";
+static const char* FORM_URLENCODED = "application/x-www-form-urlencoded";
+
 request_t* request_create(http_method method) {
     request_t* request = malloc(sizeof(request_t));
     request->method = method;
@@ -8,16 +19,34 @@ request_t* request_create(http_method method) {
     request->params = NULL;
     request->protocol = NULL;
     request->path = NULL;
+    request->num_route_params = 0;
     request->body = NULL;
     request->form = NULL;
+    request->__form_parser = NULL;
 
     return request;
 }
 
+void* __request_body_copy(void* ptr) {
+    return ptr;
+}
+
+void* __request_form_key_copy(void* ptr) {
+    return ptr;
+}
+
+void __request_form_key_destroy(void* ptr) {
+    (void) ptr;
+}
+
+void __request_body_destroy(void* ptr) {
+    request_destroy_body(ptr);
+}
+
 void request_destroy_body(request_body_t* body) {
     if (body->type == RQBT_FILE) {
         fclose(body->content.file);
-    } else {
+    } else if ( !body->__borrowed ) {
         free(body->content.str);
     }
 
@@ -36,12 +65,16 @@ void request_destroy(request_t* request) {
     if ( request->path ) 
         free(request->path);
 
-    if ( request->body )
-        request_destroy_body(request->body);
+    if ( request->__form_parser )
+        multipart_parser_destroy(request->__form_parser);
 
+    // the form may borrow keys and values from the body, so destroy it first
     if ( request->form )
         dictionary_destroy(request->form);
 
+    if ( request->body )
+        request_destroy_body(request->body);
+
     free(request);
 }
 
@@ -73,39 +106,91 @@ void request_parse_query_params(request_t* request) {
     }
 }
 
-void request_init_str_body(request_t* request, size_t len) {
+const char* request_get_route_param(request_t* request, const char* name, size_t* len) {
+    for (size_t i = 0; i < request->num_route_params; ++i) {
+        if ( !strcmp(request->route_params[i].name, name) ) {
+            if ( len ) { *len = request->route_params[i].len; }
+            return request->route_params[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+// Create an anonymous temporary file. On Linux, prefer an O_TMPFILE descriptor
+// since it never appears in the filesystem yet can still be given a name with
+// linkat(2) once the request body has been received.
+FILE* __request_open_tmp_file(void) {
+#if defined(__linux__) && defined(O_TMPFILE)
+    static const char* tmp_dir = NULL;
+    if ( !tmp_dir ) 
+        tmp_dir = getenv("TMPDIR") ? getenv("TMPDIR") : P_tmpdir;
+
+    int fd = open(tmp_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if ( fd >= 0 ) {
+        FILE* f = fdopen(fd, "w+");
+        if ( f ) { return f; }
+        close(fd);
+    }
+
+    LOG("O_TMPFILE unavailable in %s, falling back to tmpfile()", tmp_dir);
+#endif
+    return tmpfile();
+}
+
+request_body_t* request_create_body(request_body_type_t type, size_t len) {
     request_body_t* body = malloc(sizeof(request_body_t));
-    body->type = RQBT_STRING;
-    body->content.str = calloc(len, sizeof(char));
+    body->type = type;
     body->length = len;
     body->__ptr = 0;
+    body->__borrowed = 0;
+
+    if ( type == RQBT_FILE )
+        body->content.file = __request_open_tmp_file();
+    else
+        body->content.str = calloc(len + 1, sizeof(char));
+
+    return body;
+}
 
-    request->body = body;
+void request_init_str_body(request_t* request, size_t len) {
+    request->body = request_create_body(RQBT_STRING, len);
 }
 
 void request_init_tmp_file_body(request_t* request, size_t len) {
-    request_body_t* body = malloc(sizeof(request_body_t));
-    body->type = RQBT_FILE;
-    body->content.file = tmpfile();
-    body->length = len;
-    body->__ptr = 0;
+    request->body = request_create_body(RQBT_FILE, len);
+}
+
+void request_init_multipart_body(request_t* request, const char* boundary) {
+    request->form = dictionary_create_with_capacity(
+        DEFAULT_FORM_CAPACITY, string_hash_function, string_compare,
+        string_copy_constructor, string_destructor, 
+        __request_body_copy, __request_body_destroy
+    );
 
-    request->body = body;
+    request->__form_parser = multipart_parser_create(boundary, request->form);
 }
 
-void request_convert_str_body_to_tmp_file(request_t* request) {
-    if ( request->body && request->body->type == RQBT_STRING ) {
-        FILE* f = tmpfile();
-        fwrite(request->body->content.str, request->body->length, 1, f);
-        free(request->body->content.str);
+void request_convert_body_to_tmp_file(request_body_t* body) {
+    if ( body->type == RQBT_STRING ) {
+        FILE* f = __request_open_tmp_file();
+        fwrite(body->content.str, body->__ptr, 1, f);
+        free(body->content.str);
 
-        request->body->type = RQBT_FILE;
-        request->body->content.file = f;
+        body->type = RQBT_FILE;
+        body->content.file = f;
     }
 }
 
+void request_convert_str_body_to_tmp_file(request_t* request) {
+    if ( request->body )
+        request_convert_body_to_tmp_file(request->body);
+}
+
 void request_read_body(request_t* request, char* rd_buf, size_t rd_len) {
-    if ( request->body->type == RQBT_FILE ) {
+    if ( request->__form_parser ) {
+        multipart_parser_feed(request->__form_parser, rd_buf, rd_len);
+    } else if ( request->body->type == RQBT_FILE ) {
         fwrite(rd_buf, rd_len, 1, request->body->content.file);
     } else if ( request->body->type == RQBT_STRING ) {
         ///@todo add some protection to avoid buffer overflow
@@ -113,4 +198,87 @@ void request_read_body(request_t* request, char* rd_buf, size_t rd_len) {
         memcpy(body_buf_end, rd_buf, rd_len);
         request->body->__ptr += rd_len;
     }
-}
\ No newline at end of file
+}
+
+// Split an urlencoded body on '&' and '=' and decode every key and value in 
+// place. The form keys and values all point into the body's own buffer.
+int __request_parse_urlencoded_form(request_t* request) {
+    static const char* PAIR_DELIM = "&";
+    static const char* PAIR_SEP = "=";
+
+    request->form = dictionary_create_with_capacity(
+        DEFAULT_FORM_CAPACITY, string_hash_function, string_compare,
+        __request_form_key_copy, __request_form_key_destroy, 
+        __request_body_copy, __request_body_destroy
+    );
+
+    char* cursor = request->body->content.str;
+    char* pair = NULL;
+    while ( ( pair = strsep(&cursor, PAIR_DELIM) ) ) {
+        if ( !*pair ) { continue; }
+
+        char* key = strsep(&pair, PAIR_SEP);
+        char* value = pair ? pair : key + strlen(key);
+
+        int value_len = form_url_decode(value, value);
+        if ( form_url_decode(key, key) < 0 || value_len < 0 )
+            return -1;
+
+        request_body_t* entry = malloc(sizeof(request_body_t));
+        entry->type = RQBT_STRING;
+        entry->content.str = value;
+        entry->length = value_len;
+        entry->__ptr = value_len;
+        entry->__borrowed = 1;
+
+        dictionary_set(request->form, key, entry);
+    }
+
+    return 0;
+}
+
+int request_finish_body(request_t* request) {
+    int ret = 0;
+
+    if ( request->__form_parser ) {
+        ret = multipart_parser_finish(request->__form_parser);
+        multipart_parser_destroy(request->__form_parser);
+        request->__form_parser = NULL;
+    } else if ( request->body && request->body->type == RQBT_STRING
+            && dictionary_contains(request->headers, CONTENT_TYPE_HEADER_KEY) ) {
+        char* content_type = dictionary_get(request->headers, CONTENT_TYPE_HEADER_KEY);
+
+        if ( !strncasecmp(content_type, FORM_URLENCODED, strlen(FORM_URLENCODED)) )
+            ret = __request_parse_urlencoded_form(request);
+    }
+
+    return ret;
+}
+
+int request_body_fd(request_t* request) {
+    if ( !request->body || request->body->type != RQBT_FILE )
+        return -1;
+
+    // make sure nothing is left behind in the stdio buffer
+    fflush(request->body->content.file);
+    return fileno(request->body->content.file);
+}
+
+int request_link_body(request_t* request, const char* path) {
+    int fd = request_body_fd(request);
+    if ( fd < 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if defined(__linux__)
+    // linkat(2) cannot name an fd directly without CAP_DAC_READ_SEARCH, but it
+    // can follow the magic /proc symlink of an O_TMPFILE descriptor
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+    return linkat(AT_FDCWD, proc_path, AT_FDCWD, path, AT_SYMLINK_FOLLOW);
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
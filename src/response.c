@@ -1,21 +1,39 @@
 #include "response.h"
+#include "file_cache.h"
 #include "format.h"
+#include "io_utils.h"
 
 #include <sys/utsname.h>
 #include <sys/stat.h>
+#include <strings.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <err.h>
 
 static char SERVER_OS[64] = { 0 };
 
-static char* DATE_HEADER_KEY             = "Date";
-static char* SERVER_HEADER_KEY           = "Server";
-static char* CONNECTION_HEADER_KEY       = "Connection";
-static char* CONTENT_TYPE_HEADER_KEY     = "Content-Type";
-static char* CONTENT_LENGTH_HEADER_KEY   = "Content-Length";
-static char* LAST_MODIFIED_HEADER_KEY    = "Last-Modified";
+static const char DATE_HEADER_KEY[]           = "Date";
+static const char SERVER_HEADER_KEY[]         = "Server";
+static const char CONNECTION_HEADER_KEY[]     = "Connection";
+static const char CONTENT_LENGTH_HEADER_KEY[] = "Content-Length";
+static const char CONNECTION_CLOSE[]          = "close";
+static const char HEADER_SEP[]                = ": ";
+static const char HTTP1_PROTOCOL[]            = "HTTP/1.0";
+
 static char* EXPIRES_HEADER_KEY          = "Expires";
 static char* CACHE_CONTROL_HEADER_KEY    = "Cache-Control";
+static char* VARY_HEADER_KEY             = "Vary";
+static char* IF_NONE_MATCH_HEADER_KEY    = "If-None-Match";
+static char* IF_MODIFIED_SINCE_HEADER_KEY = "If-Modified-Since";
+
+static const char* HEADER_FIELD_NAMES[NUM_RESPONSE_HEADER_FIELDS] = {
+    [RHF_CONTENT_TYPE]  = "Content-Type",
+    [RHF_LAST_MODIFIED] = "Last-Modified",
+    [RHF_CACHE_CONTROL] = "Cache-Control",
+    [RHF_EXPIRES]       = "Expires",
+    [RHF_ETAG]          = "ETag"
+};
 
 // Format: (message, status code)
 static const char* JSON_ERROR_CONTENT_FMT = "{\"message\":\"%s\",\"code\":%d}";
@@ -23,38 +41,180 @@ static const char* JSON_ERROR_CONTENT_FMT = "{\"message\":\"%s\",\"code\":%d}";
 static int MAX_AGE = 604800; // default to 7 day max age
 static char CACHE_CONTROL_HEADER_VALUE[32] = { 0 };
 
+// This struct caches the status line of an HTTP/1 response, e.g. 
+// "HTTP/1.0 404 Not Found\r\n". Lines are formatted the first time each status
+// is sent.
+typedef struct _status_line {
+    char* line;
+    size_t len;
+} status_line_t;
+
+#define MIN_HTTP_STATUS 100
+#define MAX_HTTP_STATUS 599
+static status_line_t STATUS_LINES[MAX_HTTP_STATUS - MIN_HTTP_STATUS + 1] = { { 0 } };
+
+// The built-in error responses that are serialized by response_preserialize_errors
+typedef enum _builtin_error {
+    BE_MALFORMED_REQUEST,
+    BE_BAD_REQUEST,
+    BE_RESOURCE_NOT_FOUND,
+    BE_METHOD_NOT_ALLOWED,
+    BE_LENGTH_REQUIRED,
+    BE_URI_TOO_LONG,
+    NUM_BUILTIN_ERRORS
+} builtin_error_t;
+
+typedef struct _builtin_error_response {
+    http_status status;
+    const char* msg;
+    preserialized_response_t preserialized;
+    size_t body_len;     // the body is the last body_len bytes of preserialized
+} builtin_error_response_t;
+
+static builtin_error_response_t BUILTIN_ERRORS[NUM_BUILTIN_ERRORS] = {
+    [BE_MALFORMED_REQUEST]  = { STATUS_BAD_REQUEST, "The client has issued a malformed or illegal request, and the server was unable to process it" },
+    [BE_BAD_REQUEST]        = { STATUS_BAD_REQUEST, "The server was unable to process the request" },
+    [BE_RESOURCE_NOT_FOUND] = { STATUS_NOT_FOUND, "The requested resource was not found" },
+    [BE_METHOD_NOT_ALLOWED] = { STATUS_METHOD_NOT_ALLOWED, "The request method is inappropriate for the requested resource" },
+    [BE_LENGTH_REQUIRED]    = { STATUS_LENGTH_REQUIRED, "The Content-Length header is required" },
+    [BE_URI_TOO_LONG]       = { STATUS_URI_TOO_LONG, "The requested URI is too long" }
+};
+
+static int were_errors_preserialized = 0;
+
 response_t* response_create(http_status status) {
     response_t* response = malloc(sizeof(response_t));
     response->status = status;
-    response->headers = string_to_string_dictionary_create();
+    response->preserialized = NULL;
+    response->shared_body = NULL;
+    response->ownership = BO_OWNED;
+    response->headers = NULL;
+    response->content_length = SIZE_MAX;
+    response->body_offset = 0;
+    response->num_segments = 0;
+    response->last_modified = (time_t) -1;
+
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i)
+        response->fields[i] = NULL;
 
-    char time_buf[TIME_BUFFER_SIZE] = { 0 };
-    format_current_time(time_buf);
+    return response;
+}
 
-    if ( !(*SERVER_OS) ) {
-        struct utsname uts;
-        uname(&uts);
-        sprintf(SERVER_OS, "kqueue-epoll/0.0.1 (%s %s)", uts.sysname, uts.release);
+// Free, close or release whatever backs the body, depending on who owns it
+static void __response_release_body(response_t* response) {
+    if ( response->rt == RT_FILE )
+        fclose(response->body_content.file);
+    else if ( response->rt == RT_IOVEC ) {
+        body_segment_t* segments = response->body_content.segments;
+        for (size_t i = 0; i < response->num_segments; ++i) {
+            if ( segments[i].release )
+                segments[i].release(segments[i].ctx);
+        }
+
+        free(segments);
+        response->num_segments = 0;
+    } else if ( response->ownership == BO_SHARED )
+        refbuf_release(response->shared_body);
+    else if ( response->ownership == BO_OWNED && response->body_content.body
+            && (response->rt == RT_STRING || response->rt == RT_EVENT_STREAM) )
+        free((void*) response->body_content.body);
+}
+
+void response_destroy(response_t* response) {
+    if ( response->headers )
+        dictionary_destroy(response->headers);
+
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i)
+        free(response->fields[i]);
+
+    __response_release_body(response);
+    free(response);
+}
+
+void response_set_shared_body(response_t* response, refbuf_t* body) {
+    refbuf_retain(body);
+    __response_release_body(response);
+    response->preserialized = NULL;
+
+    response->shared_body = body;
+    response->body_content.body = body->data;
+    response->ownership = BO_SHARED;
+    response->rt = RT_STRING;
+    response->content_length = body->len;
+    response->body_offset = 0;
+}
+
+void response_append_segment(response_t* response, const char* data, size_t len,
+        body_segment_release_t release, void* ctx) {
+    if ( response->rt != RT_IOVEC )
+        errx(EXIT_FAILURE, "cannot append a segment to a response that is not RT_IOVEC");
+
+    // grow by doubling whenever the count reaches a power of two
+    size_t n = response->num_segments;
+    if ( (n & (n - 1)) == 0 ) {
+        response->body_content.segments = realloc(
+            response->body_content.segments, (n ? n * 2 : 1) * sizeof(body_segment_t));
     }
 
-    dictionary_set(response->headers, DATE_HEADER_KEY, time_buf);
-    dictionary_set(response->headers, SERVER_HEADER_KEY, SERVER_OS);
+    body_segment_t* segment = &response->body_content.segments[n];
+    segment->data = data;
+    segment->len = len;
+    segment->release = release;
+    segment->ctx = ctx;
 
-    /// @todo make this dynamic
-    dictionary_set(response->headers, CONNECTION_HEADER_KEY, "close");
+    ++response->num_segments;
+    response_set_content_length(response, response->content_length + len);
+}
 
-    return response;
+static void __response_release_shared_segment(void* ctx) {
+    refbuf_release(ctx);
 }
 
-void response_destroy(response_t* response) {
-    dictionary_destroy(response->headers);
+void response_append_shared_segment(response_t* response, refbuf_t* buf) {
+    response_append_segment(response, buf->data, buf->len, 
+        __response_release_shared_segment, refbuf_retain(buf));
+}
 
-    if ( response->rt == RT_FILE )
-        fclose(response->body_content.file);
-    else if ( response->rt == RT_STRING && response->body_content.body )
-        free((void*) response->body_content.body);
+int response_body_iovec(response_t* response, size_t offset, struct iovec* iov, int max_iov) {
+    size_t skip = response->body_offset + offset;
+    size_t remaining = response->content_length - offset;
+    int iovcnt = 0;
 
-    free(response);
+    body_segment_t* segments = response->body_content.segments;
+    for (size_t i = 0; i < response->num_segments && remaining && iovcnt < max_iov; ++i) {
+        if ( skip >= segments[i].len ) {
+            skip -= segments[i].len;
+            continue;
+        }
+
+        size_t len = MIN(segments[i].len - skip, remaining);
+        iov[iovcnt].iov_base = (void*) (segments[i].data + skip);
+        iov[iovcnt].iov_len = len;
+        ++iovcnt;
+
+        remaining -= len;
+        skip = 0;
+    }
+
+    return iovcnt;
+}
+
+// Add the Cache-Control and Expires headers that static files are sent with
+static void __response_set_cache_headers(response_t* response) {
+#ifndef __DISABLE_FILE_AUTO_CACHE__
+    if ( !(*CACHE_CONTROL_HEADER_VALUE) )
+        sprintf(CACHE_CONTROL_HEADER_VALUE, "max-age=%d", MAX_AGE);
+
+    response_set_header(
+        response, CACHE_CONTROL_HEADER_KEY, CACHE_CONTROL_HEADER_VALUE);
+
+    char time_buf[TIME_BUFFER_SIZE] = { 0 };
+    time_t expires = cached_time() + MAX_AGE;
+    format_time(time_buf, expires);
+    response_set_header(response, EXPIRES_HEADER_KEY, time_buf);
+#else
+    (void) response;
+#endif
 }
 
 response_t* response_from_file(http_status status, FILE* file) {
@@ -68,51 +228,175 @@ response_t* response_from_file(http_status status, FILE* file) {
 
     char time_buf[TIME_BUFFER_SIZE] = { 0 };
 #if defined(__APPLE__)
-    format_time(time_buf, info.st_mtimespec.tv_sec);
+    response->last_modified = info.st_mtimespec.tv_sec;
 #elif defined(__linux__)
-    format_time(time_buf, info.st_mtim.tv_sec);
+    response->last_modified = info.st_mtim.tv_sec;
 #endif
-    dictionary_set(response->headers, LAST_MODIFIED_HEADER_KEY, time_buf);
+    format_time(time_buf, response->last_modified);
+    response->fields[RHF_LAST_MODIFIED] = strdup(time_buf);
+
+    char etag[ETAG_BUFFER_SIZE];
+    format_etag(etag, info.st_ino, response->last_modified, (size_t) info.st_size);
+    response->fields[RHF_ETAG] = strdup(etag);
+
     response_set_content_length(response, (size_t) info.st_size);
+    __response_set_cache_headers(response);
+    
+    return response;
+}
 
-#ifndef __DISABLE_FILE_AUTO_CACHE__
-    if ( !(*CACHE_CONTROL_HEADER_VALUE) )
-        sprintf(CACHE_CONTROL_HEADER_VALUE, "max-age=%d", MAX_AGE);
+response_t* response_from_cached_file(http_status status, const char* path) {
+    const file_cache_entry_t* entry = file_cache_get(path);
+    if ( !entry ) {
+        FILE* file = fopen(path, "r");
+        struct stat info;
+        if ( file && (fstat(fileno(file), &info) || !S_ISREG(info.st_mode)) ) {
+            fclose(file);
+            file = NULL;
+        }
 
-    response_set_header(
-        response, CACHE_CONTROL_HEADER_KEY, CACHE_CONTROL_HEADER_VALUE);
+        return file ? response_from_file(status, file) : NULL;
+    }
+
+    response_t* response = response_from_shared(status, entry->contents);
+    response->last_modified = entry->mtime;
+    response->fields[RHF_LAST_MODIFIED] = strdup(entry->last_modified);
+    response->fields[RHF_ETAG] = strdup(entry->etag);
+    __response_set_cache_headers(response);
 
-    time_t expires = time(NULL) + MAX_AGE;
-    format_time(time_buf, expires);
-    response_set_header(response, EXPIRES_HEADER_KEY, time_buf);
-#endif
-    
     return response;
 }
 
 #ifndef __DISABLE_HANDLE_IF_MODIFIED_SINCE__
-void response_try_optimize_if_not_modified_since(
-        response_t** response, char* target_date) {
+// Compare two entity tags with the weak comparison function of RFC 7232 2.3.2
+static int __response_etags_match(const char* a, size_t a_len, const char* b) {
+    size_t b_len = strlen(b);
+    if ( a_len >= 2 && !strncmp(a, "W/", 2) ) { a += 2; a_len -= 2; }
+    if ( b_len >= 2 && !strncmp(b, "W/", 2) ) { b += 2; b_len -= 2; }
+
+    return a_len == b_len && !memcmp(a, b, a_len);
+}
+
+// Check whether an If-None-Match value, a list of entity tags or "*", matches
+static int __response_if_none_match(const char* value, const char* etag) {
+    while ( *value ) {
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, ",");
+        size_t trimmed = len;
+        while ( trimmed > 0 && (value[trimmed - 1] == ' ' || value[trimmed - 1] == '\t') )
+            --trimmed;
+
+        if ( trimmed == 1 && value[0] == '*' ) { return 1; }
+        if ( trimmed && __response_etags_match(value, trimmed, etag) ) { return 1; }
+
+        value += len;
+    }
+
+    return 0;
+}
+
+int request_is_not_modified(request_t* request, const char* etag, time_t last_modified) {
+    dictionary* headers = request->headers;
+
+    if ( dictionary_contains(headers, IF_NONE_MATCH_HEADER_KEY) ) {
+        const char* value = dictionary_get(headers, IF_NONE_MATCH_HEADER_KEY);
+        return etag && __response_if_none_match(value, etag);
+    }
+
+    if ( last_modified != (time_t) -1 
+            && dictionary_contains(headers, IF_MODIFIED_SINCE_HEADER_KEY) ) {
+        time_t since = parse_time_str(dictionary_get(headers, IF_MODIFIED_SINCE_HEADER_KEY));
+        return since != (time_t) -1 && last_modified <= since;
+    }
+
+    return 0;
+}
+
+void response_try_optimize_not_modified(response_t** response, request_t* request) {
+    static const response_header_field_t KEPT_FIELDS[] = {
+        RHF_ETAG, RHF_CACHE_CONTROL, RHF_EXPIRES
+    };
+
     response_t* r = *response;
-    if ( r->rt == RT_FILE && target_date) {
-        char* last_modified_str = 
-            dictionary_get(r->headers, "Last-Modified");
-        time_t last_modified = parse_time_str(last_modified_str);
-
-        if ( last_modified <= parse_time_str(target_date) ) {
-            response_destroy(r);
-            *response = response_not_modified(NULL);
-        }
+    if ( r->status != STATUS_OK 
+            || !request_is_not_modified(request, r->fields[RHF_ETAG], r->last_modified) )
+        return;
+
+    response_t* not_modified = response_not_modified(request);
+    for (size_t i = 0; i < sizeof(KEPT_FIELDS) / sizeof(KEPT_FIELDS[0]); ++i) {
+        response_header_field_t field = KEPT_FIELDS[i];
+        not_modified->fields[field] = r->fields[field];
+        r->fields[field] = NULL;
     }
+
+    const char* vary = response_get_header(r, VARY_HEADER_KEY);
+    if ( vary )
+        response_set_header(not_modified, VARY_HEADER_KEY, vary);
+
+    response_destroy(r);
+    *response = not_modified;
 }
 #endif
 
 response_t* response_from_string(http_status status, const char* body) {
+    return response_from_owned(status, strdup(body));
+}
+
+response_t* response_from_owned(http_status status, char* body) {
+    response_t* response = response_create(status);
+    response->body_content.body = body;
+    response->rt = RT_STRING;
+
+    response_set_content_length(response, strlen(body)); 
+
+    return response;
+}
+
+response_t* response_from_owned_buffer(http_status status, char* body, size_t len) {
     response_t* response = response_create(status);
-    response->body_content.body = strdup(body);
+    response->body_content.body = body;
     response->rt = RT_STRING;
 
-    response_set_content_length(response, strlen(response->body_content.body)); 
+    response_set_content_length(response, len); 
+
+    return response;
+}
+
+response_t* response_from_static(http_status status, const char* body) {
+    response_t* response = response_create(status);
+    response->body_content.body = body;
+    response->ownership = BO_STATIC;
+    response->rt = RT_STRING;
+
+    response_set_content_length(response, strlen(body)); 
+
+    return response;
+}
+
+response_t* response_from_shared(http_status status, refbuf_t* body) {
+    response_t* response = response_create(status);
+    response->shared_body = refbuf_retain(body);
+    response->body_content.body = body->data;
+    response->ownership = BO_SHARED;
+    response->rt = RT_STRING;
+
+    response_set_content_length(response, body->len); 
+
+    return response;
+}
+
+response_t* response_from_segments(
+        http_status status, const body_segment_t* segments, size_t num_segments) {
+    response_t* response = response_create(status);
+    response->body_content.segments = NULL;
+    response->rt = RT_IOVEC;
+
+    response_set_content_length(response, 0);
+
+    for (size_t i = 0; i < num_segments; ++i) {
+        response_append_segment(response, segments[i].data, segments[i].len, 
+            segments[i].release, segments[i].ctx);
+    }
 
     return response;
 }
@@ -127,6 +411,17 @@ response_t* response_empty(http_status status) {
     return response;
 }
 
+response_t* response_event_stream(const char* channel) {
+    response_t* response = response_create(STATUS_OK);
+    response->body_content.body = strdup(channel);
+    response->rt = RT_EVENT_STREAM;
+
+    response_set_content_type(response, CONTENT_TYPE_EVENT_STREAM);
+    response_set_header(response, CACHE_CONTROL_HEADER_KEY, "no-cache");
+
+    return response;
+}
+
 response_t* response_format_error(http_status status, const char* msg) {
     char* buf = NULL;
     asprintf(&buf, JSON_ERROR_CONTENT_FMT, msg, status);
@@ -137,6 +432,59 @@ response_t* response_format_error(http_status status, const char* msg) {
     return response;
 }
 
+void response_preserialize_errors(void) {
+    if ( were_errors_preserialized ) { return; }
+    were_errors_preserialized = 1;
+
+    for (size_t i = 0; i < NUM_BUILTIN_ERRORS; ++i) {
+        builtin_error_response_t* builtin = &BUILTIN_ERRORS[i];
+        preserialized_response_t* preserialized = &builtin->preserialized;
+
+        response_t* response = response_format_error(builtin->status, builtin->msg);
+        size_t header_len = response_format_header(response, NULL, 0);
+        size_t body_len = response->content_length;
+
+        char* bytes = malloc(header_len + body_len + 1);
+        response_format_header(response, bytes, header_len);
+        memcpy(bytes + header_len, response->body_content.body, body_len);
+        bytes[header_len + body_len] = '\0';
+        response_destroy(response);
+
+        // cut the value of the Date header, which directly follows the 
+        // status line, out of the bytes
+        size_t date_len;
+        cached_time_str(&date_len);
+        char* date = strstr(bytes, CRLF) + (sizeof(CRLF) - 1) 
+            + (sizeof(DATE_HEADER_KEY) - 1) + (sizeof(HEADER_SEP) - 1);
+        size_t date_offset = date - bytes;
+        memmove(date, date + date_len, header_len + body_len + 1 - date_offset - date_len);
+
+        preserialized->bytes = bytes;
+        preserialized->date_offset = date_offset;
+        preserialized->len = header_len + body_len - date_len;
+        builtin->body_len = body_len;
+    }
+}
+
+static response_t* __response_builtin_error(builtin_error_t error) {
+    response_preserialize_errors();
+
+    const builtin_error_response_t* builtin = &BUILTIN_ERRORS[error];
+    const preserialized_response_t* preserialized = &builtin->preserialized;
+
+    response_t* response = response_from_static(builtin->status, 
+        preserialized->bytes + preserialized->len - builtin->body_len);
+    response->preserialized = preserialized;
+
+    return response;
+}
+
+// Turn a built-in response into an ordinary one before it is modified. Its 
+// body stays where it is since the preserialized bytes are never freed.
+static inline void __response_detach_preserialized(response_t* response) {
+    response->preserialized = NULL;
+}
+
 response_t* response_not_modified(request_t* request) {
     (void) request;
     return response_empty(STATUS_NOT_MODIFIED);
@@ -144,50 +492,205 @@ response_t* response_not_modified(request_t* request) {
 
 response_t* response_malformed_request(request_t* request) {
     (void) request;
-    static const char* msg = "The client has issued a malformed or illegal request, and the server was unable to process it";
-    return response_format_error(STATUS_BAD_REQUEST, msg);
+    return __response_builtin_error(BE_MALFORMED_REQUEST);
 }
 
 response_t* response_bad_request(request_t* request) {
     (void) request;
-    static const char* msg = "The server was unable to process the request";
-    return response_format_error(STATUS_BAD_REQUEST, msg);
+    return __response_builtin_error(BE_BAD_REQUEST);
 }
 
 response_t* response_resource_not_found(request_t* request) {
     (void) request;
-    static const char* msg = "The requested resource was not found";
-    return response_format_error(STATUS_NOT_FOUND, msg);
+    return __response_builtin_error(BE_RESOURCE_NOT_FOUND);
 }
 
 response_t* response_method_not_allowed(request_t* request) {
     (void) request;
-    static const char* msg = "The request method is inappropriate for the requested resource";
-    return response_format_error(STATUS_METHOD_NOT_ALLOWED, msg);
+    return __response_builtin_error(BE_METHOD_NOT_ALLOWED);
 }
 
 response_t* response_length_required(request_t* request) {
     (void) request;
-    static const char* msg = "The Content-Length header is required";
-    return response_format_error(STATUS_LENGTH_REQUIRED, msg);
+    return __response_builtin_error(BE_LENGTH_REQUIRED);
 }
 
 response_t* response_uri_too_long(request_t* request) {
     (void) request;
-    static const char* msg = "The requested URI is too long";
-    return response_format_error(STATUS_URI_TOO_LONG, msg);
+    return __response_builtin_error(BE_URI_TOO_LONG);
 }
 
 void response_set_content_type(response_t* response, const char* content_type) {
-    dictionary_set(response->headers, CONTENT_TYPE_HEADER_KEY, (void*) content_type);
+    __response_detach_preserialized(response);
+    free(response->fields[RHF_CONTENT_TYPE]);
+    response->fields[RHF_CONTENT_TYPE] = strdup(content_type);
 }
 
 void response_set_content_length(response_t* response, size_t length) {
-    char buf[32];
-    sprintf(buf, "%zu", length);
-    dictionary_set(response->headers, CONTENT_LENGTH_HEADER_KEY, buf);
+    __response_detach_preserialized(response);
+    response->content_length = length;
 }
 
 void response_set_header(response_t* response, const char* key, const char* value) {
+    __response_detach_preserialized(response);
+
+    if ( !strcasecmp(key, CONTENT_LENGTH_HEADER_KEY) ) {
+        response->content_length = strtoull(value, NULL, 10);
+        return;
+    }
+
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i) {
+        if ( !strcasecmp(key, HEADER_FIELD_NAMES[i]) ) {
+            free(response->fields[i]);
+            response->fields[i] = strdup(value);
+
+            if ( i == RHF_LAST_MODIFIED )
+                response->last_modified = parse_time_str(value);
+            return;
+        }
+    }
+
+    if ( !response->headers )
+        response->headers = string_to_string_dictionary_create();
+
     dictionary_set(response->headers, (void*) key, (void*) value);
 }
+
+const char* response_get_header(response_t* response, const char* key) {
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i) {
+        if ( !strcasecmp(key, HEADER_FIELD_NAMES[i]) ) 
+            return response->fields[i];
+    }
+
+    if ( response->headers && dictionary_contains(response->headers, (void*) key) )
+        return dictionary_get(response->headers, (void*) key);
+
+    return NULL;
+}
+
+void response_add_vary(response_t* response, const char* header) {
+    const char* vary = response_get_header(response, VARY_HEADER_KEY);
+    if ( !vary || !*vary ) {
+        response_set_header(response, VARY_HEADER_KEY, header);
+        return;
+    }
+
+    // nothing to add if the header, or every header ("*"), is already listed
+    size_t header_len = strlen(header);
+    for (const char* it = vary; *it; ) {
+        it += strspn(it, ", \t");
+        size_t len = strcspn(it, ", \t");
+
+        if ( (len == 1 && *it == '*') 
+                || (len == header_len && !strncasecmp(it, header, len)) )
+            return;
+
+        it += len;
+    }
+
+    char* updated = NULL;
+    asprintf(&updated, "%s, %s", vary, header);
+    response_set_header(response, VARY_HEADER_KEY, updated);
+    free(updated);
+}
+
+// The automatic headers give way to a value the handler set explicitly
+static inline int __response_has_custom_header(response_t* response, const char* key) {
+    return response->headers && dictionary_contains(response->headers, (void*) key);
+}
+
+void response_for_each_header(
+        response_t* response, response_header_callback_t callback, void* ctx) {
+    if ( !(*SERVER_OS) ) {
+        struct utsname uts;
+        uname(&uts);
+        sprintf(SERVER_OS, "kqueue-epoll/0.0.1 (%s %s)", uts.sysname, uts.release);
+    }
+
+    if ( !__response_has_custom_header(response, DATE_HEADER_KEY) ) {
+        size_t time_len;
+        const char* time_str = cached_time_str(&time_len);
+        callback(ctx, DATE_HEADER_KEY, sizeof(DATE_HEADER_KEY) - 1, 
+            time_str, time_len);
+    }
+
+    if ( !__response_has_custom_header(response, SERVER_HEADER_KEY) )
+        callback(ctx, SERVER_HEADER_KEY, sizeof(SERVER_HEADER_KEY) - 1, 
+            SERVER_OS, strlen(SERVER_OS));
+
+    /// @todo make this dynamic
+    if ( !__response_has_custom_header(response, CONNECTION_HEADER_KEY) )
+        callback(ctx, CONNECTION_HEADER_KEY, sizeof(CONNECTION_HEADER_KEY) - 1,
+            CONNECTION_CLOSE, sizeof(CONNECTION_CLOSE) - 1);
+
+    for (size_t i = 0; i < NUM_RESPONSE_HEADER_FIELDS; ++i) {
+        const char* value = response->fields[i];
+        if ( value ) 
+            callback(ctx, HEADER_FIELD_NAMES[i], strlen(HEADER_FIELD_NAMES[i]), 
+                value, strlen(value));
+    }
+
+    if ( response->content_length != SIZE_MAX ) {
+        char length_buf[24];
+        int len = sprintf(length_buf, "%zu", response->content_length);
+        callback(ctx, CONTENT_LENGTH_HEADER_KEY, sizeof(CONTENT_LENGTH_HEADER_KEY) - 1,
+            length_buf, len);
+    }
+
+    if ( !response->headers ) { return; }
+
+    vector* keys = dictionary_keys(response->headers);
+    for (size_t i = 0; i < vector_size(keys); ++i) {
+        char* key = vector_get(keys, i);
+        char* value = dictionary_get(response->headers, key);
+        callback(ctx, key, strlen(key), value, strlen(value));
+    }
+
+    vector_destroy(keys);
+}
+
+static const status_line_t* __response_status_line(http_status status) {
+    if ( status < MIN_HTTP_STATUS || status > MAX_HTTP_STATUS )
+        status = STATUS_INTERNAL_SERVER_ERROR;
+
+    status_line_t* cached = &STATUS_LINES[status - MIN_HTTP_STATUS];
+    if ( !cached->line ) {
+        cached->len = asprintf(&cached->line, "%s %d %s\r\n", 
+            HTTP1_PROTOCOL, status, http_status_to_string(status));
+    }
+
+    return cached;
+}
+
+// This struct is the state of response_format_header while it appends headers.
+typedef struct _header_builder {
+    char* buf;
+    size_t size;
+    size_t len;
+} header_builder_t;
+
+static inline void __header_builder_append(header_builder_t* builder, const char* s, size_t n) {
+    if ( builder->len + n <= builder->size )
+        memcpy(builder->buf + builder->len, s, n);
+    builder->len += n;
+}
+
+void __header_builder_add(void* ctx, const char* key, size_t key_len, 
+        const char* value, size_t value_len) {
+    header_builder_t* builder = ctx;
+    __header_builder_append(builder, key, key_len);
+    __header_builder_append(builder, HEADER_SEP, sizeof(HEADER_SEP) - 1);
+    __header_builder_append(builder, value, value_len);
+    __header_builder_append(builder, CRLF, sizeof(CRLF) - 1);
+}
+
+size_t response_format_header(response_t* response, char* buf, size_t size) {
+    header_builder_t builder = { buf, size, 0 };
+
+    const status_line_t* status_line = __response_status_line(response->status);
+    __header_builder_append(&builder, status_line->line, status_line->len);
+    response_for_each_header(response, __header_builder_add, &builder);
+    __header_builder_append(&builder, CRLF, sizeof(CRLF) - 1);
+
+    return builder.len;
+}
@@ -1,13 +1,57 @@
 #include "route.h"
+#include "microcache.h"
 #include "format.h"
+#include "io_utils.h"
 
+#include <string.h>
+#include <stdint.h>
 #include <err.h>
 
 #define DEFAULT_DICT_CAPACITY 5
 
+// Labels up to this long are stored inside their entry of the compiled table
+#define ROUTER_INLINE_LABEL_SIZE 16
+
+// This struct is a node of the compiled route table. Chains of constant 
+// components that cannot branch are merged into one label, e.g. "v1/api", and
+// a node's constant children sit next to each other sorted by their first
+// component. Entries are 32 bytes, so two share a cache line.
+typedef struct _route_entry {
+    union {
+        char chars[ROUTER_INLINE_LABEL_SIZE];
+        uint32_t offset;      // where a longer label starts in the label pool
+    } label;
+    uint16_t label_len;
+    uint16_t first_len;       // the length of the first component of the label
+    uint16_t first_child;
+    uint16_t num_children;
+    uint16_t var_child;       // 0 if there is no parameter child
+    uint16_t handlers;        // 1 + the row of the handler table, or 0 if none
+    uint8_t is_param;         // the label is the NUL-terminated parameter name
+} route_entry_t;
+
+// This struct holds the tables while router_compile builds them.
+typedef struct _router_builder {
+    route_entry_t* entries;
+    node_t** sources;         // the trie node whose children each entry takes
+    size_t num_entries;
+    size_t entries_capacity;
+    char* labels;
+    size_t labels_len;
+    size_t labels_capacity;
+    route_handler_t* handlers;
+    const microcache_policy_t** policies;
+    size_t num_handler_rows;
+} router_builder_t;
+
 static node_t* root = NULL;
 static const char* URL_SEP = "/";
 
+static route_entry_t* compiled_entries = NULL;
+static char* compiled_labels = NULL;
+static route_handler_t* compiled_handlers = NULL;
+static const microcache_policy_t** compiled_policies = NULL; // rows like compiled_handlers
+
 static route_handler_t RH_METHOD_NOT_ALLOWED = response_method_not_allowed;
 static route_handler_t RH_MALFORMED_REQUEST = response_malformed_request;
 static route_handler_t RH_NOT_FOUND = response_resource_not_found;
@@ -23,6 +67,8 @@ void __node_destroy(void* ptr) {
 node_t* node_init(char* component) {
     node_t* node = malloc(sizeof(node_t));
     node->handlers = NULL;
+    node->policies = NULL;
+    node->var_child = NULL;
     node->const_children = dictionary_create_with_capacity(
         DEFAULT_DICT_CAPACITY, string_hash_function, string_compare,
         string_copy_constructor, string_destructor, __node_init, __node_destroy
@@ -45,8 +91,8 @@ void node_destroy(node_t* node) {
     if ( node->const_children ) 
         dictionary_destroy(node->const_children);
 
-    if ( node->var_children ) 
-        dictionary_destroy(node->var_children);
+    if ( node->var_child ) 
+        node_destroy(node->var_child);
 
     if ( node->component )
         free(node->component);
@@ -54,15 +100,62 @@ void node_destroy(node_t* node) {
     if ( node->handlers )
         free(node->handlers);
 
+    if ( node->policies ) {
+#ifndef __DISABLE_MICROCACHE__
+        for (size_t i = 0; i < NUM_HTTP_METHODS; ++i) {
+            if ( node->policies[i] ) { microcache_policy_destroy(node->policies[i]); }
+        }
+#endif
+        free(node->policies);
+    }
+
     free(node);
 }
 
 static inline void __allocate_handler_array(node_t* node) {
     node->handlers = calloc(NUM_HTTP_METHODS, sizeof(route_handler_t));
+    node->policies = calloc(NUM_HTTP_METHODS, sizeof(microcache_policy_t*));
+}
+
+// Free the compiled route table, if there is one.
+static void __router_discard(void) {
+    free(compiled_entries);
+    free(compiled_labels);
+    free(compiled_handlers);
+    free(compiled_policies);
+    compiled_entries = NULL;
+    compiled_labels = NULL;
+    compiled_handlers = NULL;
+    compiled_policies = NULL;
+}
+
+static inline int __is_route_param(const char* component, size_t len) {
+    return len >= 2 && component[0] == '<' && component[len - 1] == '>';
+}
+
+// Get the parameter child of a node, creating it for the first route with a
+// parameter in this position. Every route must give it the same name.
+static node_t* __route_param_child(node_t* node, char* token, const char* route) {
+    size_t len = strlen(token);
+    if ( len == 2 )
+        errx(EXIT_FAILURE, "Route '%s' has a parameter without a name", route);
+
+    if ( !node->var_child ) {
+        node->var_child = node_init(token);
+        return node->var_child;
+    }
+
+    token[len - 1] = '\0';
+    if ( strcmp(node->var_child->component, token + 1) )
+        errx(EXIT_FAILURE, "Route '%s' names parameter <%s> where another route has <%s>", 
+            route, token + 1, node->var_child->component);
+
+    return node->var_child;
 }
 
 /// @todo investigate segfault on /
-void register_route(http_method method, const char* route, route_handler_t handler) {
+static void __register_route(http_method method, const char* route, 
+        route_handler_t handler, const microcache_policy_t* policy) {
     if ( method == HTTP_UNKNOWN )
         errx(EXIT_FAILURE, "Cannot register handler for HTTP_UNKNOWN");
     else if ( !route ) 
@@ -73,14 +166,30 @@ void register_route(http_method method, const char* route, route_handler_t handl
     if ( !root )
         root = node_init("");
 
+    if ( compiled_entries ) {
+        LOG("Route '%s' registered after router_compile(), so routes are looked "
+            "up in the trie until it is called again", route);
+        __router_discard();
+    }
+
     char* route_dup = strdup(route + 1);
     char* route_str = route_dup;
     char* token = NULL;
     node_t* curr = root;
+    size_t num_params = 0;
     while ( ( token = strsep(&route_str, URL_SEP) ) ) {
         if ( !strcmp(token, "") )
             break;
 
+        if ( __is_route_param(token, strlen(token)) ) {
+            if ( ++num_params > MAX_ROUTE_PARAMS )
+                errx(EXIT_FAILURE, "Route '%s' has more than %d parameters", 
+                    route, MAX_ROUTE_PARAMS);
+
+            curr = __route_param_child(curr, token, route);
+            continue;
+        }
+
         if ( !dictionary_contains(curr->const_children, token) )
             dictionary_set(curr->const_children, token, token);
 
@@ -94,39 +203,332 @@ void register_route(http_method method, const char* route, route_handler_t handl
         WARN("Redefinition of route '%s %s'", http_method_to_string(method), route);
 
     curr->handlers[method] = handler;
+#ifndef __DISABLE_MICROCACHE__
+    // registering the route again replaces its policy, or drops it
+    if ( curr->policies[method] )
+        microcache_policy_destroy(curr->policies[method]);
+
+    curr->policies[method] = policy ? microcache_policy_copy(policy) : NULL;
+#else
+    (void) policy;
+#endif
     free(route_dup);
 }
 
-route_handler_t find_route_handler(http_method method, const char* route) {
+void register_route(http_method method, const char* route, route_handler_t handler) {
+    __register_route(method, route, handler, NULL);
+}
+
+#ifndef __DISABLE_MICROCACHE__
+void register_cached_route(http_method method, const char* route, 
+        route_handler_t handler, const microcache_policy_t* policy) {
+    if ( !policy )
+        errx(EXIT_FAILURE, "Cannot register a cached route without a policy");
+
+    __register_route(method, route, handler, policy);
+}
+#endif
+
+// Match the components of a route from offset onwards against the subtree
+// under node. path is a copy of the route that each component is cut out of
+// in place (and restored) so it can be looked up in const_children. Constant
+// children are tried first, and the parameter child only if the rest of the
+// route does not match under them. Returns the node holding the handlers for
+// the route, or NULL if there is none.
+static node_t* __route_match(
+        node_t* node, char* path, size_t offset, const char* route, request_t* request) {
+    char* component = path + offset;
+    size_t len = strcspn(component, URL_SEP);
+
+    // the route ends at the first empty component, e.g. a trailing slash
+    if ( !len ) { return node->handlers ? node : NULL; }
+
+    int is_last = component[len] == '\0';
+    size_t next = is_last ? offset + len : offset + len + 1;
+    component[len] = '\0';
+
+    node_t* match = NULL;
+    if ( dictionary_contains(node->const_children, component) )
+        match = __route_match(
+            dictionary_get(node->const_children, component), path, next, route, request);
+
+    if ( !match && node->var_child ) {
+        // a route never has more parameters than a registered one, so there
+        // is always room to capture this one
+        if ( request ) {
+            route_param_t* param = request->route_params + request->num_route_params++;
+            param->name = node->var_child->component;
+            param->value = route + offset;
+            param->len = len;
+        }
+
+        match = __route_match(node->var_child, path, next, route, request);
+        if ( !match && request ) { --request->num_route_params; }
+    }
+
+    if ( !is_last ) { component[len] = '/'; }
+    return match;
+}
+
+static inline const char* __router_label(const route_entry_t* entry) {
+    return entry->is_param || entry->label_len > ROUTER_INLINE_LABEL_SIZE
+        ? compiled_labels + entry->label.offset : entry->label.chars;
+}
+
+// Order components by their bytes, and a component before the longer ones it
+// is a prefix of.
+static inline int __router_compare(const char* a, size_t a_len, const char* b, size_t b_len) {
+    int cmp = memcmp(a, b, MIN(a_len, b_len));
+    return cmp ? cmp : (a_len > b_len) - (a_len < b_len);
+}
+
+static int __router_compare_nodes(const void* a, const void* b) {
+    const char* a_str = (*(node_t* const*) a)->component;
+    const char* b_str = (*(node_t* const*) b)->component;
+    return __router_compare(a_str, strlen(a_str), b_str, strlen(b_str));
+}
+
+// Match the rest of route from offset, which is the start of a component,
+// against the children of entry. The route is read in place: labels are
+// compared to it directly, so nothing needs to be copied or NUL-terminated.
+// Returns the entry holding the handlers for the route, or NULL.
+static const route_entry_t* __router_match(
+        const route_entry_t* entry, const char* route, size_t offset, request_t* request) {
+    const char* component = route + offset;
+    size_t len = strcspn(component, URL_SEP);
+
+    // the route ends at the first empty component, e.g. a trailing slash
+    if ( !len ) { return entry->handlers ? entry : NULL; }
+
+    // binary search the sorted children for the one starting with this
+    // component, then check the rest of its label
+    size_t lo = entry->first_child;
+    size_t hi = lo + entry->num_children;
+    while ( lo < hi ) {
+        size_t mid = lo + (hi - lo) / 2;
+        const route_entry_t* child = compiled_entries + mid;
+        const char* label = __router_label(child);
+        int cmp = __router_compare(component, len, label, child->first_len);
+
+        if ( cmp < 0 ) { hi = mid; continue; }
+        if ( cmp > 0 ) { lo = mid + 1; continue; }
+
+        // strncmp stops at the end of the route, so the byte after the label
+        // is only looked at once the route is known to be that long
+        if ( !strncmp(component, label, child->label_len) 
+                && (component[child->label_len] == '/' || component[child->label_len] == '\0') ) {
+            size_t next = offset + child->label_len + (component[child->label_len] == '/');
+            const route_entry_t* match = __router_match(child, route, next, request);
+            if ( match ) { return match; }
+        }
+
+        break;
+    }
+
+    if ( !entry->var_child ) { return NULL; }
+
+    const route_entry_t* var_child = compiled_entries + entry->var_child;
+    if ( request ) {
+        route_param_t* param = request->route_params + request->num_route_params++;
+        param->name = compiled_labels + var_child->label.offset;
+        param->value = component;
+        param->len = len;
+    }
+
+    size_t next = offset + len + (component[len] == '/');
+    const route_entry_t* match = __router_match(var_child, route, next, request);
+    if ( !match && request ) { --request->num_route_params; }
+
+    return match;
+}
+
+static route_handler_t __route_find(http_method method, const char* route, 
+        request_t* request, const microcache_policy_t** policy) {
+    if ( policy ) { *policy = NULL; }
     if ( method == HTTP_UNKNOWN )
         return RH_MALFORMED_REQUEST;
 
-    char* route_dup = strdup(route + 1);
-    char* route_str = route_dup;
-    char* token = NULL;
-    node_t* curr = root;
-    while ( ( token = strsep(&route_str, URL_SEP) ) ) {
-        if ( !strcmp(token, "") )
-            break;
-
-        /// @todo handle variable case
-        if ( !dictionary_contains(curr->const_children, token) ) {
-            free(route_dup);
-            return RH_NOT_FOUND;
+    route_handler_t* handlers = NULL;
+    const microcache_policy_t* const* policies = NULL;
+    if ( compiled_entries ) {
+        const route_entry_t* entry = __router_match(compiled_entries, route + 1, 0, request);
+        if ( entry ) {
+            size_t row = (entry->handlers - 1) * NUM_HTTP_METHODS;
+            handlers = compiled_handlers + row;
+            policies = compiled_policies + row;
         }
+    } else {
+        // the route is copied to the stack rather than the heap, and only so 
+        // that its components can be NUL-terminated for the dictionary lookups
+        char path[MAX_URL_LENGTH + 1];
+        size_t len = strlen(route + 1);
+        if ( !root || len > MAX_URL_LENGTH )
+            return RH_NOT_FOUND;
 
-        curr = dictionary_get(curr->const_children, token);
+        memcpy(path, route + 1, len + 1);
+        node_t* node = __route_match(root, path, 0, route + 1, request);
+        if ( node ) {
+            handlers = node->handlers;
+            policies = (const microcache_policy_t* const*) node->policies;
+        }
     }
 
-    free(route_dup);
-    if ( curr->handlers ) { // the route exists...
-        route_handler_t handler = curr->handlers[method];
+    if ( handlers ) { // the route exists...
+        route_handler_t handler = handlers[method];
 
         if ( !handler ) // however, the route is not defined for the requested method
             return RH_METHOD_NOT_ALLOWED;
 
+        if ( policy ) { *policy = policies[method]; }
         return handler;
     } else { // the route does not exist...
         return RH_NOT_FOUND;
     }
+}
+
+route_handler_t find_route_handler(http_method method, const char* route) {
+    return __route_find(method, route, NULL, NULL);
+}
+
+route_handler_t find_request_handler(request_t* request, const microcache_policy_t** policy) {
+    request->num_route_params = 0;
+    return __route_find(request->method, request->path, request, policy);
+}
+
+// Copy a label into the label pool and return where it starts. It is always
+// NUL-terminated so that parameter names can be handed out as strings.
+static uint32_t __router_add_label(router_builder_t* b, const char* label, size_t len) {
+    while ( b->labels_len + len + 1 > b->labels_capacity ) {
+        b->labels_capacity = b->labels_capacity ? b->labels_capacity * 2 : 256;
+        b->labels = realloc(b->labels, b->labels_capacity);
+    }
+
+    uint32_t offset = b->labels_len;
+    memcpy(b->labels + offset, label, len);
+    b->labels[offset + len] = '\0';
+    b->labels_len += len + 1;
+
+    return offset;
+}
+
+// Append an entry that takes its handlers and children from source, and
+// return its index.
+static size_t __router_add_entry(router_builder_t* b, node_t* source, 
+        const char* label, size_t label_len, size_t first_len, int is_param) {
+    if ( b->num_entries > UINT16_MAX || label_len > UINT16_MAX )
+        errx(EXIT_FAILURE, "Too many routes to compile");
+
+    if ( b->num_entries == b->entries_capacity ) {
+        b->entries_capacity = b->entries_capacity ? b->entries_capacity * 2 : 16;
+        b->entries = realloc(b->entries, b->entries_capacity * sizeof(route_entry_t));
+        b->sources = realloc(b->sources, b->entries_capacity * sizeof(node_t*));
+    }
+
+    size_t index = b->num_entries++;
+    route_entry_t* entry = b->entries + index;
+    memset(entry, 0, sizeof(route_entry_t));
+    entry->label_len = label_len;
+    entry->first_len = first_len;
+    entry->is_param = is_param;
+
+    if ( is_param || label_len > ROUTER_INLINE_LABEL_SIZE )
+        entry->label.offset = __router_add_label(b, label, label_len);
+    else
+        memcpy(entry->label.chars, label, label_len);
+
+    if ( source->handlers ) {
+        size_t rows = b->num_handler_rows + 1;
+        b->handlers = realloc(b->handlers, rows * NUM_HTTP_METHODS * sizeof(route_handler_t));
+        b->policies = realloc(b->policies, rows * NUM_HTTP_METHODS * sizeof(microcache_policy_t*));
+
+        // the policies stay owned by the trie, which outlives the table
+        memcpy(b->handlers + b->num_handler_rows * NUM_HTTP_METHODS, 
+            source->handlers, NUM_HTTP_METHODS * sizeof(route_handler_t));
+        memcpy(b->policies + b->num_handler_rows * NUM_HTTP_METHODS, 
+            source->policies, NUM_HTTP_METHODS * sizeof(microcache_policy_t*));
+        entry->handlers = ++b->num_handler_rows;
+    }
+
+    b->sources[index] = source;
+    return index;
+}
+
+// Append the sorted constant children of an entry and then its parameter 
+// child. A child that only leads on to a single constant child is merged 
+// with it into one label.
+static void __router_add_children(
+        router_builder_t* b, size_t index, char** label_buf, size_t* label_cap) {
+    node_t* source = b->sources[index];
+    vector* values = dictionary_values(source->const_children);
+    size_t num_children = vector_size(values);
+
+    node_t** children = malloc((num_children + 1) * sizeof(node_t*));
+    for (size_t i = 0; i < num_children; ++i)
+        children[i] = vector_get(values, i);
+
+    vector_destroy(values);
+    qsort(children, num_children, sizeof(node_t*), __router_compare_nodes);
+
+    b->entries[index].first_child = b->num_entries;
+    b->entries[index].num_children = num_children;
+
+    for (size_t i = 0; i < num_children; ++i) {
+        node_t* node = children[i];
+        size_t first_len = strlen(node->component);
+        size_t label_len = 0;
+
+        while ( 1 ) {
+            size_t len = strlen(node->component);
+            while ( label_len + len + 1 > *label_cap ) {
+                *label_cap *= 2;
+                *label_buf = realloc(*label_buf, *label_cap);
+            }
+
+            if ( label_len ) { (*label_buf)[label_len++] = '/'; }
+            memcpy(*label_buf + label_len, node->component, len);
+            label_len += len;
+
+            if ( node->handlers || node->var_child 
+                    || dictionary_size(node->const_children) != 1 )
+                break;
+
+            vector* only = dictionary_values(node->const_children);
+            node = vector_get(only, 0);
+            vector_destroy(only);
+        }
+
+        __router_add_entry(b, node, *label_buf, label_len, first_len, 0);
+    }
+
+    free(children);
+
+    if ( source->var_child ) {
+        const char* name = source->var_child->component;
+        b->entries[index].var_child = __router_add_entry(
+            b, source->var_child, name, strlen(name), 0, 1);
+    }
+}
+
+void router_compile(void) {
+    __router_discard();
+    if ( !root ) { return; }
+
+    router_builder_t b = { 0 };
+    size_t label_cap = 256;
+    char* label_buf = malloc(label_cap);
+
+    // entries are added breadth first, so every entry's children are
+    // appended together after it
+    __router_add_entry(&b, root, "", 0, 0, 0);
+    for (size_t i = 0; i < b.num_entries; ++i)
+        __router_add_children(&b, i, &label_buf, &label_cap);
+
+    free(label_buf);
+    free(b.sources);
+
+    compiled_entries = b.entries;
+    compiled_labels = b.labels;
+    compiled_handlers = b.handlers;
+    compiled_policies = b.policies;
+    LOG("Compiled %zu routes into %zu table entries", b.num_handler_rows, b.num_entries);
 }
\ No newline at end of file
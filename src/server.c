@@ -1,5 +1,12 @@
 #include "connection.h"
 #include "io_utils.h"
+#include "websocket.h"
+#include "sse.h"
+#include "static_dir.h"
+#include "http2.h"
+#include "file_cache.h"
+#include "compression.h"
+#include "microcache.h"
 #include "format.h"
 #include "dictionary.h"
 #include "callbacks.h"
@@ -29,6 +36,7 @@ static struct epoll_event* events_array = NULL;
 #endif
 
 static int event_queue_fd = 0;
+static int num_events = 0;
 static int stop_server = 0;
 static int server_socket = 0;
 static int was_server_initialized = 0;
@@ -94,8 +102,9 @@ void __server_setup_resources(void) {
         err(EXIT_FAILURE, "sigaction SIGPIPE");
 }
 
-static inline void __queue_event_change(int16_t filter, int fd, void* data) {
-    EV_SET(change_list + changes_queued, fd, filter, EV_ADD, 0, 0, data);  // add EV_CLEAR?
+#if defined(__APPLE__)
+static inline void __queue_event_change(int16_t filter, int fd, void* data, uint16_t flags) {
+    EV_SET(change_list + changes_queued, fd, filter, EV_ADD | flags, 0, 0, data);
     ++changes_queued;
 }
 
@@ -103,6 +112,7 @@ static inline void __reset_queued_events(void) {
     // memset(change_list, 0, changes_queued * sizeof(struct kevent));
     changes_queued = 0; 
 }
+#endif
 
 // Handle an kqueue event triggered from a client requesting to connect.
 int __server_handle_new_client(void) {
@@ -131,7 +141,7 @@ int __server_handle_new_client(void) {
         connection_t* connection = connection_init(&c_init);
     
 #if defined(__APPLE__)
-        __queue_event_change(EVFILT_READ, client_fd, connection);
+        __queue_event_change(EVFILT_READ, client_fd, connection, 0);
 #elif defined(__linux__)
         struct epoll_event event = {0};
         LOG("creating epoll event for fd=%d", client_fd);
@@ -148,15 +158,112 @@ int __server_handle_new_client(void) {
     }
 }
 
+// Stop watching a client connection and release everything it holds.
+void __server_close_connection(connection_t* c) {
+#if defined(__APPLE__)
+    // the connection may have both a read and a write event in this batch
+    for (int i = 0; i < num_events; ++i) {
+        if ( events_array[i].udata == c ) 
+            events_array[i].udata = NULL;
+    }
+#elif defined(__linux__)
+    if (epoll_ctl(event_queue_fd, EPOLL_CTL_DEL, c->client_fd, NULL) < 0)
+        err(EXIT_FAILURE, "epoll_ctl EPOLL_CTL_DEL");
+#endif
+    connection_destroy(c);
+}
+
+// Switch a connection to edge triggered readiness notifications. Long-lived 
+// connections (HTTP/2, WebSocket, event streams) always read and write until EAGAIN, and would otherwise 
+// be woken up on every loop iteration just because the socket is writable.
+void __server_make_edge_triggered(connection_t* c) {
+#if defined(__APPLE__)
+    __queue_event_change(EVFILT_READ, c->client_fd, c, EV_CLEAR);
+    __queue_event_change(EVFILT_WRITE, c->client_fd, c, EV_CLEAR);
+#elif defined(__linux__)
+    struct epoll_event event = {0};
+    event.data.ptr = c;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET;
+
+    if ( epoll_ctl(event_queue_fd, EPOLL_CTL_MOD, c->client_fd, &event) < 0 )
+        err(EXIT_FAILURE, "epoll_ctl EPOLL_CTL_MOD");
+#endif
+    SET_EDGE_TRIGGERED(c);
+}
+
+#ifdef ZEROCOPY_ENABLED
+// Keep a connection whose response went out with MSG_ZEROCOPY open until the
+// kernel is done reading its body. Only the error queue is watched meanwhile,
+// since the socket staying writable would otherwise wake the loop constantly.
+void __server_await_zerocopy(connection_t* c) {
+    struct epoll_event event = {0};
+    event.data.ptr = c;
+    event.events = EPOLLERR | EPOLLRDHUP | EPOLLHUP;
+
+    LOG("(fd=%d) waiting for the kernel to finish zero-copy sends", c->client_fd);
+    if ( epoll_ctl(event_queue_fd, EPOLL_CTL_MOD, c->client_fd, &event) < 0 )
+        err(EXIT_FAILURE, "epoll_ctl EPOLL_CTL_MOD");
+
+    c->state = CS_AWAITING_ZEROCOPY;
+}
+#endif
+
+static inline int __server_is_long_lived(connection_t* c) {
+    return c->state == CS_HTTP2 || c->state == CS_WEBSOCKET 
+        || c->state == CS_EVENT_STREAM;
+}
+
+// Handle an event from a connection that has switched to HTTP/2 or WebSocket,
+// or is streaming events. Returns -1 if the connection was closed.
+int __server_handle_long_lived(connection_t* c) {
+    if ( !IS_EDGE_TRIGGERED(c) )
+        __server_make_edge_triggered(c);
+
+    int ret = 0;
+    if ( c->state == CS_HTTP2 )
+        ret = http2_session_on_event(c->h2);
+    else if ( c->state == CS_WEBSOCKET )
+        ret = websocket_on_event(c->ws);
+    else
+        ret = sse_on_event(c->sse);
+
+    if ( ret < 0 )
+        __server_close_connection(c);
+
+    return ret;
+}
+
 // Handle an kqueue event from a client connection.
-void __server_handle_client(connection_t* c, size_t event_data) {
+void __server_handle_client(connection_t* c) {
     /// @todo split function into 2 for handling read and handling write
-    if ( c->state < CS_REQUEST_RECEIVED ) {
-        if ( connection_read(c, event_data) <= 0 ) { return; }
+    if ( __server_is_long_lived(c) ) {
+        __server_handle_long_lived(c);
+        return;
+    }
+
+#ifdef ZEROCOPY_ENABLED
+    if ( c->state == CS_AWAITING_ZEROCOPY ) {
+        if ( connection_reap_zerocopy(c) <= 0 )
+            __server_close_connection(c);
+        return;
+    }
+#endif
+
+    if ( IS_SPLICE_REQUEST_BODY(c) && c->state < CS_REQUEST_RECEIVED ) {
+        ssize_t bytes_moved = connection_splice_request_body(c);
+        if ( !bytes_moved ) { __server_close_connection(c); }
+        if ( bytes_moved <= 0 ) { return; }
+    } else if ( c->state < CS_REQUEST_RECEIVED ) {
+        if ( connection_read(c) <= 0 ) { return; }
     }
 
     if ( c->state == CS_CLIENT_CONNECTED )
         connection_try_parse_verb(c);
+
+    if ( c->state == CS_HTTP2 ) {
+        __server_handle_long_lived(c);
+        return;
+    }
     
     if ( c->state == CS_METHOD_PARSED )
         connection_try_parse_url(c);
@@ -172,18 +279,51 @@ void __server_handle_client(connection_t* c, size_t event_data) {
     if ( c->state == CS_HEADERS_PARSED )
         connection_read_request_body(c);
 
+    if ( c->state == CS_REQUEST_RECEIVED && http2_try_upgrade(c) ) {
+        __server_handle_long_lived(c);
+        return;
+    }
+
     if ( c->state == CS_REQUEST_RECEIVED ) {
         request_t* req = c->request;
-        c->response = find_route_handler(req->method, req->path)(req);
+        int upgraded = websocket_try_upgrade(c);
+        if ( upgraded > 0 ) {
+            __server_handle_long_lived(c);
+            return;
+        }
+
+        if ( upgraded < 0 )
+            c->response = response_bad_request(req);
+        else if ( !( c->response = static_dir_try_serve(req) ) )
+#ifndef __DISABLE_MICROCACHE__
+            c->response = microcache_serve(req);
+#else
+            c->response = find_request_handler(req, NULL)(req);
+#endif
+
         c->state = CS_WRITING_RESPONSE_HEADER;
-        event_data = free_bytes_in_wr_socket(c->client_fd);
     }
 
     if ( c->state == CS_WRITING_RESPONSE_HEADER )
         connection_write_response_header(c);
 
+    if ( c->state == CS_EVENT_STREAM ) {
+#ifndef __SKIP_LOG_REQUESTS__
+        clock_gettime(CLOCK_REALTIME, &c->time_begin_send);
+        print_client_request_resolution(
+            c->client_address, c->client_port, 
+            http_method_to_string(c->request->method), c->request->path, 
+            c->request->protocol, c->client_fd, c->response->status, 
+            http_status_to_string(c->response->status), c->body_bytes_to_receive, 
+            0, &c->time_connected, &c->time_received, &c->time_begin_send
+        );
+#endif
+        __server_handle_long_lived(c);
+        return;
+    }
+
     if ( c->state == CS_WRITING_RESPONSE_BODY ) {
-        if ( !connection_try_send_response_body(c, event_data) ) {
+        if ( !connection_try_send_response_body(c) ) {
 #ifndef __SKIP_LOG_REQUESTS__
             const char* http_method_str = http_method_to_string(c->request->method);
             const char* http_status_str = http_status_to_string(c->response->status);
@@ -196,14 +336,18 @@ void __server_handle_client(connection_t* c, size_t event_data) {
                 &c->time_received, &c->time_begin_send
             );
 #endif
-#if defined(__linux__)
-            if (epoll_ctl(event_queue_fd, EPOLL_CTL_DEL, c->client_fd, NULL) < 0)
-                err(EXIT_FAILURE, "epoll_ctl EPOLL_CTL_DEL");
+#ifdef ZEROCOPY_ENABLED
+            if ( connection_reap_zerocopy(c) > 0 ) {
+                __server_await_zerocopy(c);
+                return;
+            }
 #endif
-            connection_destroy(c);
+            __server_close_connection(c);
         } else if ( !IS_MULTI_CYCLE_RESPONSE_DELIVERY(c) ) {
             SET_MULTI_CYCLE_RESPONSE_DELIVERY(c);
-            __queue_event_change(EVFILT_WRITE, c->client_fd, c);
+#if defined(__APPLE__)
+            __queue_event_change(EVFILT_WRITE, c->client_fd, c, 0);
+#endif
         }
     }
 }
@@ -214,9 +358,18 @@ void __server_cleanup(void) {
     if ( events_array ) 
         free(events_array);
 
+#if defined(__APPLE__)
     if ( change_list ) 
         free(change_list);
+#endif
     
+    file_cache_clear();
+#ifndef __DISABLE_COMPRESSION__
+    compression_cache_clear();
+#endif
+#ifndef __DISABLE_MICROCACHE__
+    microcache_clear();
+#endif
     close(server_socket);
 }
 
@@ -232,6 +385,7 @@ void server_init(char* port) {
     __server_setup_socket(port);
     print_server_details(port);
     __server_setup_resources();
+    response_preserialize_errors();
 
 #ifndef __SKIP_LOG_REQUESTS__
     init_logging();
@@ -264,9 +418,9 @@ void server_init(char* port) {
 }
 
 void server_launch(void) {
+    router_compile();
     print_server_ready();
 
-    int num_events = 0;
     while ( !stop_server ) {
 #if defined(__APPLE__)
         num_events = kevent(
@@ -279,6 +433,8 @@ void server_launch(void) {
 #endif
         if ( num_events == -1 )  { break; }
 
+        refresh_cached_time();
+
         for(int i = 0; i < num_events; i++) {
 #if defined(__APPLE__)
             int fd = events_array[i].ident;
@@ -290,11 +446,14 @@ void server_launch(void) {
             } else {
 #if defined(__APPLE__)
                 connection_t* connection = events_array[i].udata;
-                size_t event_data = events_array[i].data;
 
-                if ( events_array[i].flags & EV_EOF ) {
+                if ( !connection ) { // closed earlier in this batch
+                    continue;
+                } else if ( events_array[i].flags & EV_EOF ) {
                     WARN("client on fd=%d disconnected", connection->client_fd);
-                    close(fd);
+                    // let an upgraded connection handle what it sent before hanging up
+                    if ( !__server_is_long_lived(connection) || !__server_handle_long_lived(connection) )
+                        __server_close_connection(connection);
                     continue;
                 } else if ( events_array[i].flags & EV_ERROR ) {
                     WARN("Event error: %s on fd=%d", strerror(events_array[i].data), fd);
@@ -302,17 +461,18 @@ void server_launch(void) {
                 }
 #elif defined(__linux__)
                 connection_t* connection = events_array[i].data.ptr;
-                size_t event_data = num_bytes_in_rd_socket(connection->client_fd);
 
+                // a client that hung up no longer cares what the kernel still 
+                // sends it, so pending MSG_ZEROCOPY sends do not delay this
                 if ( events_array[i].events & (EPOLLRDHUP | EPOLLHUP) ) {
                     WARN("client on fd=%d disconnected", connection->client_fd);
-                    close(fd);
-                    if (epoll_ctl(event_queue_fd, EPOLL_CTL_DEL, connection->client_fd, NULL) < 0)
-                        err(EXIT_FAILURE, "epoll_ctl EPOLL_CTL_DEL");
+                    // let an upgraded connection handle what it sent before hanging up
+                    if ( !__server_is_long_lived(connection) || !__server_handle_long_lived(connection) )
+                        __server_close_connection(connection);
                     continue;
                 }
 #endif
-                __server_handle_client(connection, event_data);
+                __server_handle_client(connection);
             }
         }
     }
@@ -320,4 +480,22 @@ void server_launch(void) {
 
 void server_register_route(http_method method, char* route, route_handler_t handler) {
     register_route(method, route, handler);
+}
+
+void server_register_cached_route(http_method method, char* route, 
+        route_handler_t handler, const microcache_policy_t* policy) {
+#ifndef __DISABLE_MICROCACHE__
+    register_cached_route(method, route, handler, policy);
+#else
+    (void) policy;
+    register_route(method, route, handler);
+#endif
+}
+
+void server_register_websocket(char* route, const websocket_handlers_t* handlers) {
+    websocket_register(route, handlers);
+}
+
+void server_register_static_dir(char* prefix, char* root_dir) {
+    static_dir_register(prefix, root_dir);
 }
\ No newline at end of file
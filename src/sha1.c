@@ -0,0 +1,78 @@
+#include "sha1.h"
+
+#include <string.h>
+
+#define SHA1_BLOCK_LENGTH 64
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void __sha1_compress(uint32_t state[5], const uint8_t block[SHA1_BLOCK_LENGTH]) {
+    uint32_t w[80];
+    for (size_t i = 0; i < 16; ++i) {
+        w[i] = ((uint32_t) block[4 * i] << 24) | ((uint32_t) block[4 * i + 1] << 16)
+            | ((uint32_t) block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+
+    for (size_t i = 16; i < 80; ++i)
+        w[i] = ROTL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (size_t i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if ( i < 20 ) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if ( i < 40 ) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if ( i < 60 ) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        uint32_t temp = ROTL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void sha1(const uint8_t* data, size_t len, uint8_t digest[SHA1_DIGEST_LENGTH]) {
+    uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+    size_t full_blocks = len / SHA1_BLOCK_LENGTH;
+    for (size_t i = 0; i < full_blocks; ++i)
+        __sha1_compress(state, data + i * SHA1_BLOCK_LENGTH);
+
+    // pad the tail with a 1 bit, zeros, and the message length in bits
+    uint8_t tail[2 * SHA1_BLOCK_LENGTH] = { 0 };
+    size_t tail_len = len % SHA1_BLOCK_LENGTH;
+    memcpy(tail, data + full_blocks * SHA1_BLOCK_LENGTH, tail_len);
+    tail[tail_len] = 0x80;
+
+    size_t padded_len = tail_len + 9 <= SHA1_BLOCK_LENGTH ? SHA1_BLOCK_LENGTH : 2 * SHA1_BLOCK_LENGTH;
+    uint64_t bit_len = (uint64_t) len * 8;
+    for (size_t i = 0; i < 8; ++i)
+        tail[padded_len - 1 - i] = bit_len >> (8 * i);
+
+    for (size_t i = 0; i < padded_len; i += SHA1_BLOCK_LENGTH)
+        __sha1_compress(state, tail + i);
+
+    for (size_t i = 0; i < 5; ++i) {
+        digest[4 * i] = state[i] >> 24;
+        digest[4 * i + 1] = state[i] >> 16;
+        digest[4 * i + 2] = state[i] >> 8;
+        digest[4 * i + 3] = state[i];
+    }
+}
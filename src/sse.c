@@ -0,0 +1,165 @@
+#include "sse.h"
+#include "dictionary.h"
+#include "format.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define DEFAULT_DICT_CAPACITY 16
+#define DISCARD_BUFFER_SIZE 512
+
+// This struct is the set of connections subscribed to a named channel.
+struct _sse_channel {
+    char* name;
+    sse_subscriber_t** subscribers;
+    size_t num_subscribers;
+    size_t capacity;
+};
+
+static dictionary* channels = NULL; // (char*) -> (sse_channel_t*)
+
+void* __sse_channel_copy(void* ptr) {
+    return ptr;
+}
+
+void __sse_channel_destroy(void* ptr) {
+    (void) ptr;
+}
+
+void sse_subscribe(connection_t* conn) {
+    const char* name = conn->response->body_content.body;
+
+    if ( !channels ) {
+        channels = dictionary_create_with_capacity(
+            DEFAULT_DICT_CAPACITY, string_hash_function, string_compare,
+            string_copy_constructor, string_destructor,
+            __sse_channel_copy, __sse_channel_destroy
+        );
+    }
+
+    sse_channel_t* channel = NULL;
+    if ( dictionary_contains(channels, (void*) name) ) {
+        channel = dictionary_get(channels, (void*) name);
+    } else {
+        channel = calloc(1, sizeof(sse_channel_t));
+        channel->name = strdup(name);
+        dictionary_set(channels, (void*) name, channel);
+    }
+
+    if ( channel->num_subscribers == channel->capacity ) {
+        channel->capacity = channel->capacity ? 2 * channel->capacity : 16;
+        channel->subscribers = realloc(
+            channel->subscribers, channel->capacity * sizeof(sse_subscriber_t*));
+    }
+
+    sse_subscriber_t* this = malloc(sizeof(sse_subscriber_t));
+    this->conn = conn;
+    this->channel = channel;
+    this->failed = 0;
+    outbox_init(&this->outbox, SSE_MAX_BACKLOG);
+
+    channel->subscribers[channel->num_subscribers++] = this;
+    conn->sse = this;
+    conn->state = CS_EVENT_STREAM;
+}
+
+void sse_subscriber_destroy(sse_subscriber_t* subscriber) {
+    sse_channel_t* channel = subscriber->channel;
+
+    for (size_t i = 0; i < channel->num_subscribers; ++i) {
+        if ( channel->subscribers[i] == subscriber ) {
+            channel->subscribers[i] = channel->subscribers[--channel->num_subscribers];
+            break;
+        }
+    }
+
+    if ( !channel->num_subscribers ) {
+        dictionary_remove(channels, channel->name);
+        free(channel->name);
+        free(channel->subscribers);
+        free(channel);
+    }
+
+    outbox_destroy(&subscriber->outbox);
+    free(subscriber);
+}
+
+int sse_on_event(sse_subscriber_t* subscriber) {
+    char discard[DISCARD_BUFFER_SIZE];
+
+    // the client has nothing to say, but reading tells us when it goes away
+    while ( 1 ) {
+        ssize_t bytes_read = read(subscriber->conn->client_fd, discard, sizeof(discard));
+        if ( bytes_read > 0 ) { continue; }
+        if ( bytes_read < 0 && errno == EINTR ) { continue; }
+        if ( bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) )
+            return -1;
+        break;
+    }
+
+    if ( subscriber->failed || outbox_flush(&subscriber->outbox, subscriber->conn->client_fd) )
+        return -1;
+
+    return 0;
+}
+
+// Encode an event in the text/event-stream format, with one data field for 
+// every line of data.
+refbuf_t* __sse_encode_event(const char* event, const char* id, const char* data) {
+    static const char* EVENT_FIELD = "event: ";
+    static const char* ID_FIELD = "id: ";
+    static const char* DATA_FIELD = "data: ";
+
+    size_t data_len = strlen(data);
+    size_t num_lines = 1;
+    for (const char* c = data; *c; ++c)
+        num_lines += *c == '\n';
+
+    size_t len = data_len + num_lines * (strlen(DATA_FIELD) + 1) + 1;
+    if ( event ) { len += strlen(EVENT_FIELD) + strlen(event) + 1; }
+    if ( id ) { len += strlen(ID_FIELD) + strlen(id) + 1; }
+
+    refbuf_t* buf = refbuf_create(NULL, len + 1); // sprintf writes a NUL
+    char* out = buf->data;
+
+    if ( event )
+        out += sprintf(out, "%s%s\n", EVENT_FIELD, event);
+    if ( id )
+        out += sprintf(out, "%s%s\n", ID_FIELD, id);
+
+    const char* line = data;
+    for (size_t i = 0; i < num_lines; ++i) {
+        size_t line_len = strcspn(line, "\n");
+        out += sprintf(out, "%s%.*s\n", DATA_FIELD, (int) line_len, line);
+        line += line_len + 1;
+    }
+
+    *out++ = '\n';
+    buf->len = out - buf->data;
+
+    return buf;
+}
+
+size_t sse_publish(const char* name, const char* event, const char* id, const char* data) {
+    if ( !channels || !dictionary_contains(channels, (void*) name) ) { return 0; }
+
+    sse_channel_t* channel = dictionary_get(channels, (void*) name);
+    refbuf_t* buf = __sse_encode_event(event, id, data);
+    size_t sent = 0;
+
+    for (size_t i = 0; i < channel->num_subscribers; ++i) {
+        sse_subscriber_t* subscriber = channel->subscribers[i];
+        if ( subscriber->failed ) { continue; }
+
+        if ( outbox_enqueue_or_drop(&subscriber->outbox, buf, subscriber->conn->client_fd, 1) ) {
+            subscriber->failed = 1;
+            continue;
+        }
+
+        ++sent;
+    }
+
+    refbuf_release(buf);
+    return sent;
+}
@@ -0,0 +1,141 @@
+#include "static_dir.h"
+#include "format.h"
+
+#include <limits.h>
+#include <string.h>
+#include <err.h>
+
+#define INDEX_FILE "index.html"
+
+// This struct is a directory whose files are served under a route prefix.
+typedef struct _static_dir {
+    char* prefix;        // without a trailing slash
+    size_t prefix_len;
+    char* root;
+} static_dir_t;
+
+// This struct is a precompressed sibling of a file that may be sent instead.
+typedef struct _encoded_variant {
+    const char* coding;  // as named in Accept-Encoding and Content-Encoding
+    const char* suffix;
+} encoded_variant_t;
+
+// Variants are tried in order of how well they usually compress
+static const encoded_variant_t ENCODED_VARIANTS[] = {
+    { "br",   ".br" },
+    { "zstd", ".zst" },
+    { "gzip", ".gz" }
+};
+
+#define NUM_ENCODED_VARIANTS (sizeof(ENCODED_VARIANTS) / sizeof(ENCODED_VARIANTS[0]))
+
+static const char* ACCEPT_ENCODING_HEADER_KEY = "Accept-Encoding";
+static const char* CONTENT_ENCODING_HEADER_KEY = "Content-Encoding";
+
+static static_dir_t* dirs = NULL;
+static size_t num_dirs = 0;
+
+void static_dir_register(const char* prefix, const char* root_dir) {
+    if ( !prefix || prefix[0] != '/' )
+        errx(EXIT_FAILURE, "Static directory prefixes must begin with '/'");
+    else if ( !root_dir ) 
+        errx(EXIT_FAILURE, "Cannot serve a NULL static directory");
+
+    dirs = realloc(dirs, (num_dirs + 1) * sizeof(static_dir_t));
+    static_dir_t* dir = &dirs[num_dirs++];
+
+    dir->prefix_len = strlen(prefix);
+    while ( dir->prefix_len > 0 && prefix[dir->prefix_len - 1] == '/' )
+        --dir->prefix_len;
+
+    dir->prefix = strndup(prefix, dir->prefix_len);
+    dir->root = strdup(root_dir);
+}
+
+// Find the static directory with the longest prefix that the path falls under
+static const static_dir_t* __static_dir_find(const char* path) {
+    const static_dir_t* best = NULL;
+
+    for (size_t i = 0; i < num_dirs; ++i) {
+        const static_dir_t* dir = &dirs[i];
+        if ( strncmp(path, dir->prefix, dir->prefix_len) ) { continue; }
+
+        // only look past the prefix once the path is known to be that long
+        char next = path[dir->prefix_len];
+        if ( (next == '/' || next == '\0' || next == '?')
+                && (!best || dir->prefix_len > best->prefix_len) )
+            best = dir;
+    }
+
+    return best;
+}
+
+// Check that a path relative to a static directory cannot climb out of it
+static int __static_dir_is_safe(const char* rel, size_t len) {
+    const char* component = rel;
+    const char* end = rel + len;
+
+    while ( component < end ) {
+        const char* slash = memchr(component, '/', end - component);
+        size_t component_len = (slash ? slash : end) - component;
+
+        if ( (component_len == 1 && component[0] == '.') 
+                || (component_len == 2 && !strncmp(component, "..", 2)) 
+                || memchr(component, '\\', component_len) )
+            return 0;
+
+        component += component_len + 1;
+    }
+
+    return 1;
+}
+
+response_t* static_dir_try_serve(request_t* request) {
+    if ( !num_dirs || !request->path ) { return NULL; }
+
+    const static_dir_t* dir = __static_dir_find(request->path);
+    if ( !dir ) { return NULL; }
+
+    if ( request->method != HTTP_GET )
+        return response_method_not_allowed(request);
+
+    const char* rel = request->path + dir->prefix_len;
+    size_t rel_len = strcspn(rel, "?");
+    if ( !__static_dir_is_safe(rel, rel_len) )
+        return response_resource_not_found(request);
+
+    char path[PATH_MAX];
+    int path_len = snprintf(path, sizeof(path), "%s%.*s%s", dir->root, (int) rel_len, 
+        rel, rel_len == 0 || rel[rel_len - 1] == '/' ? "/"INDEX_FILE : "");
+    if ( path_len < 0 || (size_t) path_len + sizeof(".zst") > sizeof(path) )
+        return response_uri_too_long(request);
+
+    const char* accept_encoding = NULL;
+    if ( dictionary_contains(request->headers, (void*) ACCEPT_ENCODING_HEADER_KEY) )
+        accept_encoding = dictionary_get(request->headers, (void*) ACCEPT_ENCODING_HEADER_KEY);
+
+    response_t* response = NULL;
+    for (size_t i = 0; i < NUM_ENCODED_VARIANTS && accept_encoding; ++i) {
+        const encoded_variant_t* variant = &ENCODED_VARIANTS[i];
+        if ( !http_accepts_encoding(accept_encoding, variant->coding) ) { continue; }
+
+        strcpy(path + path_len, variant->suffix);
+        response = response_from_cached_file(STATUS_OK, path);
+        path[path_len] = '\0';
+
+        if ( response ) {
+            response_set_header(response, CONTENT_ENCODING_HEADER_KEY, variant->coding);
+            break;
+        }
+    }
+
+    if ( !response )
+        response = response_from_cached_file(STATUS_OK, path);
+    if ( !response )
+        return response_resource_not_found(request);
+
+    response_set_content_type(response, content_type_from_extension(path));
+    response_add_vary(response, ACCEPT_ENCODING_HEADER_KEY);
+
+    return response;
+}
@@ -0,0 +1,644 @@
+#include "websocket.h"
+#include "dictionary.h"
+#include "base64.h"
+#include "format.h"
+#include "sha1.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define WS_MAX_FRAME_HEADER_LENGTH 14
+#define WS_MAX_CONTROL_PAYLOAD 125
+#define WS_MASK_KEY_LENGTH 4
+#define WS_KEY_LENGTH 16
+#define WS_ENCODED_KEY_LENGTH 24
+
+#define WS_INPUT_BUFFER_SIZE (1UL << 12UL)
+#define WS_INITIAL_MESSAGE_SIZE (1UL << 12UL)
+#define DEFAULT_DICT_CAPACITY 16
+
+static char* UPGRADE_HEADER_KEY = "Upgrade";
+static char* CONNECTION_HEADER_KEY = "Connection";
+static char* SEC_WEBSOCKET_KEY_HEADER_KEY = "Sec-WebSocket-Key";
+static char* SEC_WEBSOCKET_VERSION_HEADER_KEY = "Sec-WebSocket-Version";
+
+static const char* UPGRADE_PROTOCOL = "HTTP/1.1";
+static const char* UPGRADE_TOKEN = "websocket";
+static const char* CONNECTION_TOKEN = "upgrade";
+static const char* WEBSOCKET_VERSION = "13";
+
+// Appended to the client's key before hashing it (RFC 6455 1.3)
+static const char* WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// This struct is a named set of sockets that messages can be broadcast to.
+struct _websocket_group {
+    char* name;
+    websocket_t** members;
+    size_t num_members;
+    size_t capacity;
+};
+
+static dictionary* routes = NULL; // (char*) -> (websocket_handlers_t*)
+static dictionary* groups = NULL; // (char*) -> (websocket_group_t*)
+
+void* __websocket_shallow_copy(void* ptr) {
+    return ptr;
+}
+
+void __websocket_shallow_destroy(void* ptr) {
+    (void) ptr;
+}
+
+static inline dictionary* __websocket_create_dictionary(void) {
+    return dictionary_create_with_capacity(
+        DEFAULT_DICT_CAPACITY, string_hash_function, string_compare,
+        string_copy_constructor, string_destructor,
+        __websocket_shallow_copy, __websocket_shallow_destroy
+    );
+}
+
+void websocket_register(const char* route, const websocket_handlers_t* handlers) {
+    if ( !routes )
+        routes = __websocket_create_dictionary();
+
+    dictionary_set(routes, (void*) route, (void*) handlers);
+}
+
+/// FRAMES
+
+// XOR a payload with its 4-byte masking key. The key repeats every 4 bytes, so
+// it is widened to a 16-byte pattern and applied a vector at a time.
+void __websocket_unmask(uint8_t* data, size_t len, const uint8_t key[WS_MASK_KEY_LENGTH]) {
+    uint8_t pattern[16];
+    for (size_t i = 0; i < sizeof(pattern); ++i)
+        pattern[i] = key[i & 3];
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i mask = _mm_loadu_si128((const __m128i*) pattern);
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (data + i));
+        _mm_storeu_si128((__m128i*) (data + i), _mm_xor_si128(block, mask));
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t mask = vld1q_u8(pattern);
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), mask));
+#endif
+
+    uint64_t mask64;
+    memcpy(&mask64, pattern, sizeof(mask64));
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        word ^= mask64;
+        memcpy(data + i, &word, sizeof(word));
+    }
+
+    for (; i < len; ++i)
+        data[i] ^= key[i & 3];
+}
+
+// Validate UTF-8, rejecting overlong encodings, surrogates and code points
+// past U+10FFFF. Runs of ASCII are skipped 8 bytes at a time.
+int __websocket_is_valid_utf8(const uint8_t* s, size_t len) {
+    size_t i = 0;
+
+    while ( i < len ) {
+        if ( i + 8 <= len ) {
+            uint64_t word;
+            memcpy(&word, s + i, sizeof(word));
+            if ( !(word & 0x8080808080808080ULL) ) {
+                i += 8;
+                continue;
+            }
+        }
+
+        uint8_t c = s[i];
+        if ( c < 0x80 ) {
+            ++i;
+            continue;
+        }
+
+        size_t n;
+        uint32_t code_point, min;
+        if ( (c & 0xe0) == 0xc0 ) {
+            n = 1; code_point = c & 0x1f; min = 0x80;
+        } else if ( (c & 0xf0) == 0xe0 ) {
+            n = 2; code_point = c & 0x0f; min = 0x800;
+        } else if ( (c & 0xf8) == 0xf0 ) {
+            n = 3; code_point = c & 0x07; min = 0x10000;
+        } else {
+            return 0;
+        }
+
+        if ( len - i <= n ) { return 0; }
+
+        for (size_t k = 1; k <= n; ++k) {
+            if ( (s[i + k] & 0xc0) != 0x80 ) { return 0; }
+            code_point = (code_point << 6) | (s[i + k] & 0x3f);
+        }
+
+        if ( code_point < min || code_point > 0x10ffff
+                || (code_point >= 0xd800 && code_point <= 0xdfff) )
+            return 0;
+
+        i += n + 1;
+    }
+
+    return 1;
+}
+
+// Encode an unmasked server frame into a refbuf so it can be queued on any
+// number of connections.
+refbuf_t* __websocket_encode_frame(websocket_opcode_t opcode, const char* data, size_t len) {
+    uint8_t header[WS_MAX_FRAME_HEADER_LENGTH];
+    size_t header_len = 2;
+
+    header[0] = 0x80 | opcode;
+    if ( len < 126 ) {
+        header[1] = len;
+    } else if ( len <= UINT16_MAX ) {
+        header[1] = 126;
+        header[2] = len >> 8;
+        header[3] = len;
+        header_len = 4;
+    } else {
+        header[1] = 127;
+        for (size_t i = 0; i < 8; ++i)
+            header[2 + i] = (uint64_t) len >> (56 - 8 * i);
+        header_len = 10;
+    }
+
+    refbuf_t* frame = refbuf_create(NULL, header_len + len);
+    memcpy(frame->data, header, header_len);
+    if ( len )
+        memcpy(frame->data + header_len, data, len);
+
+    return frame;
+}
+
+// Queue a frame on the socket. Output is normally written once the current
+// event has been processed, but other sockets (and this one, outside of its
+// own event) would not be woken up to write it, so an idle socket is flushed
+// right away.
+int __websocket_queue(websocket_t* ws, refbuf_t* frame) {
+    if ( ws->failed ) { return -1; }
+
+    if ( outbox_enqueue_or_drop(&ws->outbox, frame, ws->conn->client_fd, !ws->dispatching) ) {
+        ws->failed = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void __websocket_send_close(websocket_t* ws, uint16_t code, const char* reason, size_t reason_len) {
+    char payload[WS_MAX_CONTROL_PAYLOAD];
+    size_t len = 0;
+
+    if ( code ) {
+        payload[0] = code >> 8;
+        payload[1] = code;
+        len = 2 + MIN(reason_len, sizeof(payload) - 2);
+        if ( reason_len )
+            memcpy(payload + 2, reason, len - 2);
+    }
+
+    refbuf_t* frame = __websocket_encode_frame(WS_CLOSE, payload, len);
+    __websocket_queue(ws, frame);
+    refbuf_release(frame);
+    ws->close_sent = 1;
+}
+
+// Fail the connection (RFC 6455 7.1.7): send a close frame with the reason and
+// stop processing input. The socket is closed once the frame is written.
+int __websocket_fail(websocket_t* ws, uint16_t code) {
+    LOG("(fd=%d) failing websocket with %u", ws->conn->client_fd, code);
+    if ( !ws->close_sent )
+        __websocket_send_close(ws, code, NULL, 0);
+
+    ws->failed = 1;
+    return -1;
+}
+
+int websocket_send(websocket_t* ws, websocket_opcode_t opcode, const char* data, size_t len) {
+    if ( ws->close_sent ) { return -1; }
+    if ( opcode == WS_CLOSE || opcode == WS_CONTINUATION ) { return -1; }
+    if ( opcode >= WS_CLOSE && len > WS_MAX_CONTROL_PAYLOAD ) { return -1; }
+
+    refbuf_t* frame = __websocket_encode_frame(opcode, data, len);
+    int ret = __websocket_queue(ws, frame);
+    refbuf_release(frame);
+
+    return ret;
+}
+
+int websocket_send_text(websocket_t* ws, const char* text) {
+    return websocket_send(ws, WS_TEXT, text, strlen(text));
+}
+
+void websocket_close(websocket_t* ws, uint16_t code, const char* reason) {
+    if ( ws->close_sent ) { return; }
+    __websocket_send_close(ws, code, reason, reason ? strlen(reason) : 0);
+}
+
+/// GROUPS
+
+void websocket_join(websocket_t* ws, const char* name) {
+    if ( !groups )
+        groups = __websocket_create_dictionary();
+
+    websocket_group_t* group = NULL;
+    if ( dictionary_contains(groups, (void*) name) ) {
+        group = dictionary_get(groups, (void*) name);
+        for (size_t i = 0; i < ws->num_groups; ++i) {
+            if ( ws->groups[i] == group ) { return; }
+        }
+    } else {
+        group = calloc(1, sizeof(websocket_group_t));
+        group->name = strdup(name);
+        dictionary_set(groups, (void*) name, group);
+    }
+
+    if ( group->num_members == group->capacity ) {
+        group->capacity = group->capacity ? 2 * group->capacity : 4;
+        group->members = realloc(group->members, group->capacity * sizeof(websocket_t*));
+    }
+
+    group->members[group->num_members++] = ws;
+    ws->groups = realloc(ws->groups, (ws->num_groups + 1) * sizeof(websocket_group_t*));
+    ws->groups[ws->num_groups++] = group;
+}
+
+// Remove a socket from a group, destroying the group once it is empty.
+void __websocket_group_remove(websocket_group_t* group, websocket_t* ws) {
+    for (size_t i = 0; i < group->num_members; ++i) {
+        if ( group->members[i] == ws ) {
+            group->members[i] = group->members[--group->num_members];
+            break;
+        }
+    }
+
+    if ( !group->num_members ) {
+        dictionary_remove(groups, group->name);
+        free(group->name);
+        free(group->members);
+        free(group);
+    }
+}
+
+void websocket_leave(websocket_t* ws, const char* name) {
+    if ( !groups || !dictionary_contains(groups, (void*) name) ) { return; }
+
+    websocket_group_t* group = dictionary_get(groups, (void*) name);
+    for (size_t i = 0; i < ws->num_groups; ++i) {
+        if ( ws->groups[i] == group ) {
+            ws->groups[i] = ws->groups[--ws->num_groups];
+            __websocket_group_remove(group, ws);
+            return;
+        }
+    }
+}
+
+size_t websocket_broadcast(const char* name, websocket_opcode_t opcode,
+        const char* data, size_t len) {
+    if ( !groups || !dictionary_contains(groups, (void*) name) ) { return 0; }
+    if ( opcode != WS_TEXT && opcode != WS_BINARY ) { return 0; }
+
+    websocket_group_t* group = dictionary_get(groups, (void*) name);
+    refbuf_t* frame = __websocket_encode_frame(opcode, data, len);
+    size_t sent = 0;
+
+    for (size_t i = 0; i < group->num_members; ++i) {
+        websocket_t* member = group->members[i];
+        if ( !member->close_sent && !__websocket_queue(member, frame) )
+            ++sent;
+    }
+
+    refbuf_release(frame);
+    return sent;
+}
+
+/// INPUT
+
+void __websocket_deliver(websocket_t* ws, websocket_opcode_t opcode, const char* data, size_t len) {
+    if ( opcode == WS_TEXT && !__websocket_is_valid_utf8((const uint8_t*) data, len) ) {
+        __websocket_fail(ws, WS_CLOSE_INVALID_DATA);
+        return;
+    }
+
+    if ( ws->handlers->on_message && !ws->close_sent )
+        ws->handlers->on_message(ws, opcode, data, len);
+}
+
+static inline int __websocket_is_valid_close_code(uint16_t code) {
+    return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011)
+        || (code >= 3000 && code <= 4999);
+}
+
+void __websocket_on_close_frame(websocket_t* ws, const uint8_t* payload, size_t len) {
+    uint16_t code = WS_CLOSE_NO_STATUS;
+
+    if ( len == 1 ) {
+        __websocket_fail(ws, WS_CLOSE_PROTOCOL_ERROR);
+        return;
+    } else if ( len >= 2 ) {
+        code = ((uint16_t) payload[0] << 8) | payload[1];
+        if ( !__websocket_is_valid_close_code(code) ) {
+            __websocket_fail(ws, WS_CLOSE_PROTOCOL_ERROR);
+            return;
+        } else if ( !__websocket_is_valid_utf8(payload + 2, len - 2) ) {
+            __websocket_fail(ws, WS_CLOSE_INVALID_DATA);
+            return;
+        }
+    }
+
+    ws->close_received = 1;
+    ws->close_code = code;
+
+    // echo the status code back to complete the closing handshake
+    if ( !ws->close_sent )
+        __websocket_send_close(ws, code == WS_CLOSE_NO_STATUS ? 0 : code, NULL, 0);
+}
+
+void __websocket_on_data_frame(websocket_t* ws, websocket_opcode_t opcode,
+        int fin, const uint8_t* payload, size_t len) {
+    // an unfragmented message is delivered straight out of the input buffer
+    if ( fin && opcode != WS_CONTINUATION ) {
+        __websocket_deliver(ws, opcode, (const char*) payload, len);
+        return;
+    }
+
+    if ( opcode != WS_CONTINUATION )
+        ws->message_opcode = opcode;
+
+    if ( ws->message_len + len > ws->message_size ) {
+        size_t size = ws->message_size ? ws->message_size : WS_INITIAL_MESSAGE_SIZE;
+        while ( size < ws->message_len + len ) { size *= 2; }
+        ws->message = realloc(ws->message, size);
+        ws->message_size = size;
+    }
+
+    if ( len )
+        memcpy(ws->message + ws->message_len, payload, len);
+    ws->message_len += len;
+
+    if ( fin ) {
+        websocket_opcode_t message_opcode = ws->message_opcode;
+        ws->message_opcode = WS_CONTINUATION;
+        __websocket_deliver(ws, message_opcode, ws->message, ws->message_len);
+        ws->message_len = 0;
+    }
+}
+
+// Parse the frame at the start of buf. Returns the number of bytes it took up,
+// 0 if the frame is incomplete, or -1 if the connection failed.
+ssize_t __websocket_process_frame(websocket_t* ws, uint8_t* buf, size_t len) {
+    if ( len < 2 ) { return 0; }
+
+    int fin = buf[0] & 0x80;
+    websocket_opcode_t opcode = buf[0] & 0x0f;
+    uint64_t payload_len = buf[1] & 0x7f;
+    size_t header_len = 2;
+
+    // we negotiate no extensions, so the reserved bits must be clear, and
+    // every frame from a client must be masked (RFC 6455 5.1)
+    if ( (buf[0] & 0x70) || !(buf[1] & 0x80) )
+        return __websocket_fail(ws, WS_CLOSE_PROTOCOL_ERROR);
+
+    if ( payload_len == 126 ) {
+        if ( len < 4 ) { return 0; }
+        payload_len = ((uint64_t) buf[2] << 8) | buf[3];
+        header_len = 4;
+    } else if ( payload_len == 127 ) {
+        if ( len < 10 ) { return 0; }
+        payload_len = 0;
+        for (size_t i = 0; i < 8; ++i)
+            payload_len = (payload_len << 8) | buf[2 + i];
+        header_len = 10;
+    }
+
+    if ( opcode >= WS_CLOSE ) {
+        if ( opcode > WS_PONG || !fin || payload_len > WS_MAX_CONTROL_PAYLOAD )
+            return __websocket_fail(ws, WS_CLOSE_PROTOCOL_ERROR);
+    } else {
+        int in_message = ws->message_opcode != WS_CONTINUATION;
+        if ( opcode > WS_BINARY || in_message != (opcode == WS_CONTINUATION) )
+            return __websocket_fail(ws, WS_CLOSE_PROTOCOL_ERROR);
+
+        if ( payload_len > WEBSOCKET_MAX_MESSAGE_SIZE - ws->message_len )
+            return __websocket_fail(ws, WS_CLOSE_MESSAGE_TOO_BIG);
+    }
+
+    const uint8_t* key = buf + header_len;
+    header_len += WS_MASK_KEY_LENGTH;
+
+    size_t frame_len = header_len + payload_len;
+    if ( len < frame_len ) {
+        if ( frame_len > ws->in_size ) {
+            ws->in_size = frame_len;
+            ws->in_buf = realloc(ws->in_buf, ws->in_size);
+        }
+
+        return 0;
+    }
+
+    uint8_t* payload = buf + header_len;
+    __websocket_unmask(payload, payload_len, key);
+
+    switch ( opcode ) {
+        case WS_PING:
+            if ( !ws->close_sent ) {
+                refbuf_t* pong = __websocket_encode_frame(WS_PONG, (char*) payload, payload_len);
+                __websocket_queue(ws, pong);
+                refbuf_release(pong);
+            }
+            break;
+        case WS_PONG:
+            break;
+        case WS_CLOSE:
+            __websocket_on_close_frame(ws, payload, payload_len);
+            break;
+        default:
+            __websocket_on_data_frame(ws, opcode, fin, payload, payload_len);
+            break;
+    }
+
+    return frame_len;
+}
+
+// Process every complete frame in the input buffer and shift what is left of
+// an incomplete one to the front.
+int __websocket_process_input(websocket_t* ws) {
+    size_t offset = 0;
+
+    while ( !ws->failed && !ws->close_received ) {
+        ssize_t ret = __websocket_process_frame(
+            ws, ws->in_buf + offset, ws->in_len - offset);
+        if ( ret <= 0 ) { break; }
+        offset += ret;
+    }
+
+    if ( offset ) {
+        memmove(ws->in_buf, ws->in_buf + offset, ws->in_len - offset);
+        ws->in_len -= offset;
+    }
+
+    return ws->failed ? -1 : 0;
+}
+
+int websocket_on_event(websocket_t* ws) {
+    int eof = 0;
+    ws->dispatching = 1;
+
+    // frames may be left over from the handshake or a previous event
+    __websocket_process_input(ws);
+
+    while ( !ws->failed && !ws->close_received ) {
+        if ( ws->in_len == ws->in_size ) {
+            // a frame that is still arriving has already had room made for it
+            ws->in_size *= 2;
+            ws->in_buf = realloc(ws->in_buf, ws->in_size);
+        }
+
+        ssize_t bytes_read = read(
+            ws->conn->client_fd, ws->in_buf + ws->in_len, ws->in_size - ws->in_len);
+
+        if ( bytes_read < 0 ) {
+            if ( errno == EINTR ) { continue; }
+            if ( errno != EAGAIN && errno != EWOULDBLOCK ) { eof = 1; }
+            break;
+        } else if ( bytes_read == 0 ) {
+            eof = 1;
+            break;
+        }
+
+        ws->in_len += bytes_read;
+        __websocket_process_input(ws);
+    }
+
+    ws->dispatching = 0;
+
+    if ( outbox_flush(&ws->outbox, ws->conn->client_fd) )
+        return -1;
+
+    // close the TCP connection once the closing handshake is done (or the
+    // connection failed) and the last frame has been written
+    int closing = ws->failed || (ws->close_sent && ws->close_received);
+    if ( eof || (closing && outbox_is_empty(&ws->outbox)) )
+        return -1;
+
+    return 0;
+}
+
+/// HANDSHAKE
+
+websocket_t* __websocket_create(connection_t* conn, const websocket_handlers_t* handlers) {
+    websocket_t* this = calloc(1, sizeof(websocket_t));
+    this->conn = conn;
+    this->handlers = handlers;
+    this->message_opcode = WS_CONTINUATION;
+    this->in_size = WS_INPUT_BUFFER_SIZE;
+    this->in_buf = malloc(this->in_size);
+    outbox_init(&this->outbox, WEBSOCKET_MAX_BACKLOG);
+
+    return this;
+}
+
+int websocket_try_upgrade(connection_t* conn) {
+    static const char* UPGRADE_RESPONSE_FMT =
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+        "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n";
+
+    request_t* request = conn->request;
+    if ( !routes || !dictionary_contains(routes, request->path) ) { return 0; }
+
+    const websocket_handlers_t* handlers = dictionary_get(routes, request->path);
+    dictionary* headers = request->headers;
+
+    if ( request->method != HTTP_GET || request->body || request->form
+            || !request->protocol || strcmp(request->protocol, UPGRADE_PROTOCOL)
+            || !dictionary_contains(headers, SEC_WEBSOCKET_KEY_HEADER_KEY)
+            || !dictionary_contains(headers, SEC_WEBSOCKET_VERSION_HEADER_KEY)
+            || strcmp(dictionary_get(headers, SEC_WEBSOCKET_VERSION_HEADER_KEY), WEBSOCKET_VERSION) )
+        return -1;
+
+    if ( !dictionary_contains(headers, UPGRADE_HEADER_KEY)
+            || !dictionary_contains(headers, CONNECTION_HEADER_KEY)
+            || !http_header_has_token(dictionary_get(headers, UPGRADE_HEADER_KEY), UPGRADE_TOKEN)
+            || !http_header_has_token(dictionary_get(headers, CONNECTION_HEADER_KEY), CONNECTION_TOKEN) )
+        return -1;
+
+    // the key must be 16 random bytes in base64 (RFC 6455 4.1)
+    const char* key = dictionary_get(headers, SEC_WEBSOCKET_KEY_HEADER_KEY);
+    size_t key_len = strlen(key);
+    uint8_t decoded_key[BASE64_DECODED_LENGTH(WS_ENCODED_KEY_LENGTH)];
+    if ( key_len != WS_ENCODED_KEY_LENGTH
+            || base64_decode(key, key_len, decoded_key) != WS_KEY_LENGTH )
+        return -1;
+
+    char concatenated[64];
+    size_t concatenated_len = sprintf(concatenated, "%s%s", key, WEBSOCKET_GUID);
+    uint8_t digest[SHA1_DIGEST_LENGTH];
+    sha1((const uint8_t*) concatenated, concatenated_len, digest);
+
+    char accept[BASE64_ENCODED_LENGTH(SHA1_DIGEST_LENGTH) + 1];
+    base64_encode(digest, SHA1_DIGEST_LENGTH, accept);
+
+    char response[192];
+    size_t response_len = sprintf(response, UPGRADE_RESPONSE_FMT, accept);
+    write_all_to_socket(conn->client_fd, response, response_len);
+
+#ifndef __SKIP_LOG_REQUESTS__
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    print_client_request_resolution(
+        conn->client_address, conn->client_port, http_method_to_string(request->method),
+        request->path, request->protocol, conn->client_fd, STATUS_SWITCHING_PROTOCOLS,
+        http_status_to_string(STATUS_SWITCHING_PROTOCOLS), 0, 0,
+        &conn->time_connected, &now, &now
+    );
+#endif
+
+    websocket_t* ws = __websocket_create(conn, handlers);
+    conn->ws = ws;
+    conn->state = CS_WEBSOCKET;
+
+    // frames the client sent right behind the handshake
+    if ( (size_t) conn->buf_end > ws->in_size ) {
+        ws->in_size = conn->buf_end;
+        ws->in_buf = realloc(ws->in_buf, ws->in_size);
+    }
+
+    memcpy(ws->in_buf, conn->buf, conn->buf_end);
+    ws->in_len = conn->buf_end;
+    conn->buf_end = 0;
+    conn->buf_ptr = 0;
+
+    if ( handlers->on_open )
+        handlers->on_open(ws, request);
+
+    return 1;
+}
+
+void websocket_destroy(websocket_t* ws) {
+    if ( ws->handlers->on_close )
+        ws->handlers->on_close(ws, ws->close_received ? ws->close_code : WS_CLOSE_ABNORMAL);
+
+    while ( ws->num_groups )
+        __websocket_group_remove(ws->groups[--ws->num_groups], ws);
+
+    outbox_destroy(&ws->outbox);
+    free(ws->groups);
+    free(ws->in_buf);
+    free(ws->message);
+    free(ws);
+}
@@ -0,0 +1,131 @@
+#include "format.h"
+#include "hpack.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#define MAX_DECODED_LENGTH 1024
+
+typedef struct _hpack_test_case {
+    const char* description;
+    const char* block;     // hex encoded header block
+    const char* expected;  // "name: value\n" for every header
+    size_t table_size;
+} hpack_test_case_t;
+
+static void append_header(void* ctx, const char* name, size_t name_len,
+        const char* value, size_t value_len) {
+    char* decoded = ctx;
+    size_t len = strlen(decoded);
+    snprintf(decoded + len, MAX_DECODED_LENGTH - len, "%.*s: %.*s\n", 
+        (int) name_len, name, (int) value_len, value);
+}
+
+static size_t hex_to_bytes(const char* hex, uint8_t* out) {
+    size_t len = 0;
+    unsigned int byte = 0;
+    while ( *hex ) {
+        if ( *hex == ' ' ) { ++hex; continue; }
+        sscanf(hex, "%2x", &byte);
+        out[len++] = byte;
+        hex += 2;
+    }
+
+    return len;
+}
+
+static int run_test_cases(hpack_test_case_t* cases, size_t num_cases, size_t max_size) {
+    hpack_table_t table;
+    hpack_table_init(&table, max_size);
+    int failed = 0;
+
+    for (size_t i = 0; i < num_cases; ++i) {
+        uint8_t block[MAX_DECODED_LENGTH];
+        char decoded[MAX_DECODED_LENGTH] = { 0 };
+        size_t len = hex_to_bytes(cases[i].block, block);
+
+        printf("hpack_decode(%s) ... ", cases[i].description);
+        int ret = hpack_decode(&table, block, len, append_header, decoded);
+
+        if ( !ret && !strcmp(decoded, cases[i].expected) 
+                && table.size == cases[i].table_size ) {
+            printf(BOLDGREEN"PASSED\n"RESET);
+        } else {
+            printf(BOLDRED"FAILED\n"RESET);
+            printf("\tExpected (size %zu):\n%s\tActual (size %zu):\n%s", 
+                cases[i].table_size, cases[i].expected, table.size, decoded);
+            failed = 1;
+        }
+    }
+
+    hpack_table_destroy(&table);
+    return failed;
+}
+
+int main(void) {
+    // RFC 7541 Appendix C.3: requests without Huffman coding
+    hpack_test_case_t plain_requests[] = {
+        { "C.3.1", "828684410f7777772e6578616d706c652e636f6d",
+          ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n", 57 },
+        { "C.3.2", "828684be58086e6f2d6361636865",
+          ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+          "cache-control: no-cache\n", 110 },
+        { "C.3.3", "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+          ":method: GET\n:scheme: https\n:path: /index.html\n"
+          ":authority: www.example.com\ncustom-key: custom-value\n", 164 }
+    };
+
+    // RFC 7541 Appendix C.4: requests with Huffman coding
+    hpack_test_case_t huffman_requests[] = {
+        { "C.4.1", "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+          ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n", 57 },
+        { "C.4.2", "828684be5886a8eb10649cbf",
+          ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+          "cache-control: no-cache\n", 110 },
+        { "C.4.3", "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+          ":method: GET\n:scheme: https\n:path: /index.html\n"
+          ":authority: www.example.com\ncustom-key: custom-value\n", 164 }
+    };
+
+    // RFC 7541 Appendix C.6: responses with Huffman coding and eviction
+    hpack_test_case_t huffman_responses[] = {
+        { "C.6.1", "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166"
+                   "e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+          ":status: 302\ncache-control: private\n"
+          "date: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n", 222 },
+        { "C.6.2", "4883640effc1c0bf",
+          ":status: 307\ncache-control: private\n"
+          "date: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n", 222 },
+        { "C.6.3", "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a83"
+                   "9bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1"
+                   "ab270fb5291f9587316065c003ed4ee5b1063d5007",
+          ":status: 200\ncache-control: private\n"
+          "date: Mon, 21 Oct 2013 20:13:22 GMT\nlocation: https://www.example.com\n"
+          "content-encoding: gzip\n"
+          "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n", 215 }
+    };
+
+    // the encoder's output has to round trip through the decoder
+    uint8_t block[MAX_DECODED_LENGTH];
+    size_t len = hpack_encode_status(block, 200);
+    len += hpack_encode_status(block + len, 302);
+    len += hpack_encode_header(block + len, "Content-Type", 12, "text/html", 9);
+    len += hpack_encode_header(block + len, "X-Custom", 8, "value", 5);
+
+    hpack_test_case_t round_trip[] = {
+        { "encoder round trip", NULL, 
+          ":status: 200\n:status: 302\ncontent-type: text/html\nx-custom: value\n", 0 }
+    };
+
+    char hex[2 * MAX_DECODED_LENGTH + 1];
+    for (size_t i = 0; i < len; ++i)
+        sprintf(hex + 2 * i, "%02x", block[i]);
+    round_trip[0].block = hex;
+
+    int failed = run_test_cases(plain_requests, 3, HPACK_DEFAULT_TABLE_SIZE);
+    failed |= run_test_cases(huffman_requests, 3, HPACK_DEFAULT_TABLE_SIZE);
+    failed |= run_test_cases(huffman_responses, 3, 256);
+    failed |= run_test_cases(round_trip, 1, HPACK_DEFAULT_TABLE_SIZE);
+
+    return failed;
+}
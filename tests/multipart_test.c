@@ -0,0 +1,90 @@
+#include "format.h"
+#include "multipart.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#define MAX_BODY_LENGTH 512
+
+static const char* FIELD_NAME = "field";
+static const char* FIELD_VALUE = "hello\r\n-- not a delimiter --\r\nworld";
+
+static size_t build_body(const char* boundary, char* body) {
+    return snprintf(body, MAX_BODY_LENGTH,
+        "--%s\r\n"
+        "Content-Disposition: form-data; name=\"%s\"\r\n"
+        "\r\n"
+        "%s\r\n"
+        "--%s--\r\n", boundary, FIELD_NAME, FIELD_VALUE, boundary);
+}
+
+// Feed body to a new parser in two chunks, the first one split bytes long, and
+// check that the field comes out intact.
+static int parse_in_two_chunks(const char* boundary, const char* body, size_t len, size_t split) {
+    request_t* request = request_create(HTTP_POST);
+    request_init_multipart_body(request, boundary);
+    multipart_parser_t* parser = request->__form_parser;
+
+    int ok = !multipart_parser_feed(parser, body, split)
+        && !multipart_parser_feed(parser, body + split, len - split)
+        && !multipart_parser_finish(parser)
+        && dictionary_contains(request->form, (void*) FIELD_NAME);
+
+    if ( ok ) {
+        request_body_t* field = dictionary_get(request->form, (void*) FIELD_NAME);
+        ok = field->type == RQBT_STRING && field->length == strlen(FIELD_VALUE)
+            && !memcmp(field->content.str, FIELD_VALUE, field->length);
+    }
+
+    request_destroy(request);
+    return ok;
+}
+
+static int report(const char* description, int ok) {
+    printf("%s ... ", description);
+    printf(ok ? BOLDGREEN"PASSED\n"RESET : BOLDRED"FAILED\n"RESET);
+    return !ok;
+}
+
+int main(void) {
+    int failed = 0;
+
+    char longest[MULTIPART_MAX_BOUNDARY_LENGTH + 1];
+    memset(longest, 'b', MULTIPART_MAX_BOUNDARY_LENGTH);
+    longest[MULTIPART_MAX_BOUNDARY_LENGTH] = '\0';
+
+    char content_type[MAX_BODY_LENGTH];
+    snprintf(content_type, sizeof(content_type), "multipart/form-data; boundary=%s", longest);
+    char* parsed = multipart_parse_boundary(content_type);
+    failed |= report("multipart_parse_boundary(70 characters)",
+        parsed && !strcmp(parsed, longest));
+    free(parsed);
+
+    snprintf(content_type, sizeof(content_type), "multipart/form-data; boundary=%sb", longest);
+    parsed = multipart_parse_boundary(content_type);
+    failed |= report("multipart_parse_boundary(71 characters) is rejected", !parsed);
+    free(parsed);
+
+    const char* boundaries[] = { "xyz", "----WebKitFormBoundary7MA4YWxkTrZu0gW", longest };
+    char body[MAX_BODY_LENGTH];
+
+    for (size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); ++i) {
+        size_t len = build_body(boundaries[i], body);
+        char description[MAX_BODY_LENGTH];
+
+        snprintf(description, sizeof(description),
+            "multipart_parser_feed(%zu character boundary, one chunk)", strlen(boundaries[i]));
+        failed |= report(description, parse_in_two_chunks(boundaries[i], body, len, len));
+
+        // split the body at every byte, which cuts each delimiter in every place
+        int ok = 1;
+        for (size_t split = 0; split <= len; ++split)
+            ok &= parse_in_two_chunks(boundaries[i], body, len, split);
+
+        snprintf(description, sizeof(description),
+            "multipart_parser_feed(%zu character boundary, split at every byte)", strlen(boundaries[i]));
+        failed |= report(description, ok);
+    }
+
+    return failed;
+}
\ No newline at end of file
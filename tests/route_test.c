@@ -9,6 +9,16 @@ response_t* post(request_t* request) { (void) request; return NULL; }
 
 response_t* favicon(request_t* request) { (void) request; return NULL; }
 
+response_t* user(request_t* request) { (void) request; return NULL; }
+
+response_t* me(request_t* request) { (void) request; return NULL; }
+
+response_t* order(request_t* request) { (void) request; return NULL; }
+
+response_t* settings(request_t* request) { (void) request; return NULL; }
+
+response_t* report(request_t* request) { (void) request; return NULL; }
+
 #if defined(__APPLE__) && defined(DEBUG)
 #include <unistd.h>
 void check_leaks(void) {
@@ -27,8 +37,13 @@ int main(void) {
     register_route(HTTP_GET, "/favicon.ico", favicon);
     register_route(HTTP_GET, "/v1/api/test", get);
     register_route(HTTP_POST, "/v1/api/test", post);
+    register_route(HTTP_GET, "/v1/users/<id>", user);
+    register_route(HTTP_GET, "/v1/users/me", me);
+    register_route(HTTP_GET, "/v1/users/<id>/orders/<oid>", order);
+    register_route(HTTP_GET, "/v1/users/me/settings", settings);
+    register_route(HTTP_GET, "/v1/reports/quarterly/summary", report);
 
-    #define NUM_TESTS 10
+    #define NUM_TESTS 20
     void* test_cases[NUM_TESTS][3] = {
         {(void*) HTTP_GET, "/v1/api/test", get},
         {(void*) HTTP_GET, "/v1/api/test/", get},
@@ -39,25 +54,60 @@ int main(void) {
         {(void*) HTTP_GET, "/random", response_resource_not_found},
         {(void*) HTTP_GET, "/v1", response_resource_not_found},
         {(void*) HTTP_GET, "/v1/api", response_resource_not_found},
-        {(void*) HTTP_UNKNOWN, "/random", response_malformed_request}
+        {(void*) HTTP_UNKNOWN, "/random", response_malformed_request},
+        {(void*) HTTP_GET, "/v1/users/42", user},
+        {(void*) HTTP_GET, "/v1/users/42/", user},
+        {(void*) HTTP_GET, "/v1/users/me", me},
+        {(void*) HTTP_GET, "/v1/users/me/settings", settings},
+        {(void*) HTTP_GET, "/v1/users/me/orders/7", order},
+        {(void*) HTTP_GET, "/v1/users/42/orders/7", order},
+        {(void*) HTTP_POST, "/v1/users/42", response_method_not_allowed},
+        {(void*) HTTP_GET, "/v1/users/42/orders", response_resource_not_found},
+        {(void*) HTTP_GET, "/v1/reports/quarterly/summary", report},
+        {(void*) HTTP_GET, "/v1/reports/quarterly", response_resource_not_found}
     };
 
-    for (size_t i = 0; i < NUM_TESTS; ++i) {
-        http_method method = (size_t) test_cases[i][0];
-        char* route = test_cases[i][1];
+    // every case runs against the trie and then against the compiled table
+    for (int compiled = 0; compiled <= 1; ++compiled) {
+        const char* suffix = compiled ? " [compiled]" : "";
+        if ( compiled ) { router_compile(); }
+
+        for (size_t i = 0; i < NUM_TESTS; ++i) {
+            http_method method = (size_t) test_cases[i][0];
+            char* route = test_cases[i][1];
 
-        route_handler_t expected = test_cases[i][2];
-        route_handler_t actual = find_route_handler(method, route);
+            route_handler_t expected = test_cases[i][2];
+            route_handler_t actual = find_route_handler(method, route);
 
-        const char* mstr = http_method_to_string(method);
-        printf("find_route_handler(%s, %s) ... ", mstr, route);
+            const char* mstr = http_method_to_string(method);
+            printf("find_route_handler(%s, %s)%s ... ", mstr, route, suffix);
 
-        if ( expected == actual ) {
+            if ( expected == actual ) {
+                printf(BOLDGREEN"PASSED\n"RESET);
+            } else {
+                printf(BOLDRED"FAILED\n"RESET);
+                printf("\tExpected: %s%p%s / Actual: %s%p%s\n", 
+                    BOLDRED, expected, RESET, BOLDRED, actual, RESET);
+            }
+        }
+
+        request_t* request = request_create(HTTP_GET);
+        request->path = strdup("/v1/users/me/orders/7");
+        find_request_handler(request, NULL);
+
+        size_t id_len = 0, oid_len = 0;
+        const char* id = request_get_route_param(request, "id", &id_len);
+        const char* oid = request_get_route_param(request, "oid", &oid_len);
+        printf("find_request_handler(GET, %s)%s captures id and oid ... ", 
+            request->path, suffix);
+
+        if ( request->num_route_params == 2 && id && id_len == 2 && !strncmp(id, "me", 2) 
+                && oid && oid_len == 1 && *oid == '7' ) {
             printf(BOLDGREEN"PASSED\n"RESET);
         } else {
             printf(BOLDRED"FAILED\n"RESET);
-            printf("\tExpected: %s%p%s / Actual: %s%p%s\n", 
-                BOLDRED, expected, RESET, BOLDRED, actual, RESET);
         }
+
+        request_destroy(request);
     }
 }
\ No newline at end of file